@@ -25,14 +25,15 @@ void print_hashtable(hashtable_t *tab)
 
 static uint64_t hash_function(char *str)
 {
-    int p = 31;
-    int m = 1000000007;
+    // 64-bit: k * p does not overflow, and the key is scanned once
+    uint64_t p = 31;
+    uint64_t m = 1000000007;
 
-    int k = p;
-    int v = 0;
-    for (int i = 0; i < strlen(str); ++ i)
+    uint64_t k = p;
+    uint64_t v = 0;
+    for (int i = 0; str[i] != '\0'; ++ i)
     {
-        v = (v + ((int)str[i] * k) % m) % m;
+        v = (v + ((uint8_t)str[i] * k) % m) % m;
         k = (k * p) % m;
     }
     return v;
@@ -96,6 +97,12 @@ void hashtable_free(hashtable_t *tab)
         {
             continue;
         }
+        // the bucket is shared by the slots with the same low localdepth bits
+        // free it only once
+        for (int j = i; j < tab->num; j += (1 << b->localdepth))
+        {
+            tab->directory[j] = NULL;
+        }
 
         for (int j = 0; j < b->counter; ++ j)
         {
@@ -0,0 +1,204 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../header/common.h"
+
+
+// LZ77 codec in the LZ4 block format
+// each sequence is:
+//  token:      high 4 bits - literal length, low 4 bits - match length - 4
+//              15 means the length continues in the following bytes, 255 each
+//  literals
+//  offset:     2 bytes little-endian, distance back to the match
+// the last sequence has literals only
+
+#define LZ_MIN_MATCH    (4)
+#define LZ_MAX_OFFSET   (0xffff)
+#define LZ_HASH_BITS    (12)
+
+
+static uint32_t read32(const uint8_t *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static uint32_t lz_hash(uint32_t v){
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+
+// bytes of the extended length
+static uint64_t length_bytes(uint64_t len){
+    return len < 15 ? 0 : (len - 15) / 255 + 1;
+}
+
+
+static uint64_t write_length(uint8_t *dst, uint64_t len){
+    uint64_t n = 0;
+    if (len >= 15){
+        len -= 15;
+        while (len >= 255){
+            dst[n ++] = 255;
+            len -= 255;
+        }
+        dst[n ++] = (uint8_t)len;
+    }
+    return n;
+}
+
+
+// return 0 if the capacity is not enough
+static int emit_sequence(uint8_t *dst, uint64_t capacity, uint64_t *op,
+    const uint8_t *literals, uint64_t literal_len, uint64_t offset, uint64_t match_len){
+
+    uint64_t need = 1 + length_bytes(literal_len) + literal_len;
+    if (match_len > 0){
+        need += 2 + length_bytes(match_len - LZ_MIN_MATCH);
+    }
+    if (*op + need > capacity){
+        return 0;
+    }
+
+    uint8_t *token = &dst[(*op) ++];
+    uint64_t ml = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+    *token = ((literal_len < 15 ? literal_len : 15) << 4) | (ml < 15 ? ml : 15);
+
+    *op += write_length(&dst[*op], literal_len);
+    memcpy(&dst[*op], literals, literal_len);
+    *op += literal_len;
+
+    if (match_len > 0){
+        dst[(*op) ++] = offset & 0xff;
+        dst[(*op) ++] = (offset >> 8) & 0xff;
+        *op += write_length(&dst[*op], ml);
+    }
+    return 1;
+}
+
+
+uint64_t lz_compress(const uint8_t *src, uint64_t size, uint8_t *dst, uint64_t capacity){
+
+    // last position of each hashed 4-byte sequence
+    uint32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint64_t ip = 0;
+    uint64_t anchor = 0;
+    uint64_t op = 0;
+
+    while (ip + LZ_MIN_MATCH <= size){
+
+        uint32_t seq = read32(&src[ip]);
+        uint32_t h = lz_hash(seq);
+        uint64_t candidate = table[h];
+        table[h] = ip;
+
+        if (candidate < ip && ip - candidate <= LZ_MAX_OFFSET && read32(&src[candidate]) == seq){
+
+            uint64_t len = LZ_MIN_MATCH;
+            while (ip + len < size && src[candidate + len] == src[ip + len]){
+                len ++;
+            }
+
+            if (emit_sequence(dst, capacity, &op, &src[anchor], ip - anchor, ip - candidate, len) == 0){
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+        else {
+            ip ++;
+        }
+    }
+
+    // the last literals
+    if (emit_sequence(dst, capacity, &op, &src[anchor], size - anchor, 0, 0) == 0){
+        return 0;
+    }
+    return op;
+}
+
+
+static int read_length(const uint8_t *src, uint64_t size, uint64_t *ip, uint64_t *len){
+    if (*len == 15){
+        uint8_t b;
+        do {
+            if (*ip >= size){
+                return 0;
+            }
+            b = src[(*ip) ++];
+            *len += b;
+        } while (b == 255);
+    }
+    return 1;
+}
+
+
+uint64_t lz_decompress(const uint8_t *src, uint64_t size, uint8_t *dst, uint64_t capacity){
+
+    uint64_t ip = 0;
+    uint64_t op = 0;
+
+    while (ip < size){
+
+        uint8_t token = src[ip ++];
+
+        uint64_t literal_len = token >> 4;
+        if (read_length(src, size, &ip, &literal_len) == 0 ||
+            ip + literal_len > size || op + literal_len > capacity){
+            return 0;
+        }
+        memcpy(&dst[op], &src[ip], literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        if (ip == size){
+            // the last sequence
+            break;
+        }
+
+        if (ip + 2 > size){
+            return 0;
+        }
+        uint64_t offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+
+        uint64_t match_len = token & 0xf;
+        if (read_length(src, size, &ip, &match_len) == 0){
+            return 0;
+        }
+        match_len += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > op || op + match_len > capacity){
+            return 0;
+        }
+        // the match may overlap the output: copy byte by byte
+        for (uint64_t i = 0; i < match_len; ++ i){
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += match_len;
+    }
+    return op;
+}
+
+
+int same_filled(const uint8_t *src, uint64_t size, uint64_t *value){
+
+    assert(size % sizeof(uint64_t) == 0);
+
+    uint64_t first;
+    memcpy(&first, src, sizeof(first));
+    for (uint64_t i = sizeof(uint64_t); i < size; i += sizeof(uint64_t)){
+        uint64_t v;
+        memcpy(&v, &src[i], sizeof(v));
+        if (v != first){
+            return 0;
+        }
+    }
+    *value = first;
+    return 1;
+}
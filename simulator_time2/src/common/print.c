@@ -6,14 +6,11 @@
 
 #include<stdint.h>
 
-// wrapper of stdio printf
-// controlled by the debug verbose bit set
-uint64_t debug_printf(uint64_t open_set, const char *format, ...){
-
-    if ((open_set & DEBUG_VERBOSE_SET) == 0x0){
-        return 0x1;
-    }
+uint64_t debug_mask = DEBUG_VERBOSE_SET;
 
+// wrapper of stdio printf
+// called by debug_printf when the category is on
+uint64_t debug_print(const char *format, ...){
 
     // Implementation of std printf()
     va_list argptr;
@@ -22,4 +19,4 @@ uint64_t debug_printf(uint64_t open_set, const char *format, ...){
     va_end(argptr);
 
     return 0x0;
-}
\ No newline at end of file
+}
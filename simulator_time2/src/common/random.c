@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../header/common.h"
+
+
+// one xoshiro256** generator for each component
+// the draws of one component never shift the sequence of another
+//
+// record/replay log:
+//  header:     magic, seed
+//  events:     1 byte kind, 1 byte component, 8 bytes value
+// on replay the values come from the log, not from the generators,
+// so the run is the same even if the generator is changed
+
+
+#define RR_MAGIC        "CSAPPRR1"
+
+typedef struct{
+    uint64_t s[4];
+} rng_state_t;
+
+static rng_state_t rng_states[NUM_RNG];
+static int rng_seeded = 0;
+static uint64_t rng_seed_value = 0;
+
+static int rr_mode = RR_OFF;
+static FILE *rr_file = NULL;
+static uint64_t rr_events = 0;
+
+
+static uint64_t splitmix64(uint64_t *x){
+    uint64_t z = (*x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+
+static uint64_t rotl(uint64_t x, int k){
+    return (x << k) | (x >> (64 - k));
+}
+
+
+static uint64_t xoshiro_next(rng_state_t *st){
+    uint64_t *s = st->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+
+void rng_seed(uint64_t seed){
+    for (int c = 0; c < NUM_RNG; ++ c){
+        // each component has its own stream derived from the seed
+        uint64_t x = seed ^ (0x6a09e667f3bcc909ull * (c + 1));
+        for (int i = 0; i < 4; ++ i){
+            rng_states[c].s[i] = splitmix64(&x);
+        }
+    }
+    rng_seed_value = seed;
+    rng_seeded = 1;
+}
+
+
+static void check_rng(){
+    if (rng_seeded == 0){
+        rng_seed(DEFAULT_RNG_SEED);
+    }
+}
+
+
+static void rr_write_event(int kind, int component, uint64_t value){
+    uint8_t head[2] = {kind, component};
+    if (fwrite(head, 1, 2, rr_file) != 2 || fwrite(&value, sizeof(value), 1, rr_file) != 1){
+        printf("replay: write failed\n");
+        exit(0);
+    }
+}
+
+
+static uint64_t rr_read_event(int kind, int component){
+    uint8_t head[2];
+    uint64_t value;
+    if (fread(head, 1, 2, rr_file) != 2 || fread(&value, sizeof(value), 1, rr_file) != 1){
+        printf("replay: the log ends at event %lu\n", rr_events);
+        exit(0);
+    }
+    if (head[0] != kind || head[1] != component){
+        printf("replay: diverged at event %lu: logged %d:%d, requested %d:%d\n",
+            rr_events, head[0], head[1], kind, component);
+        exit(0);
+    }
+    return value;
+}
+
+
+uint64_t rng_next(rng_component_t component){
+
+    assert(0 <= component && component < NUM_RNG);
+    check_rng();
+
+    uint64_t value;
+    if (rr_mode == RR_REPLAY){
+        value = rr_read_event(RR_EVENT_RNG, component);
+    }
+    else {
+        value = xoshiro_next(&rng_states[component]);
+        if (rr_mode == RR_RECORD){
+            rr_write_event(RR_EVENT_RNG, component, value);
+        }
+    }
+    rr_events ++;
+    return value;
+}
+
+
+uint64_t rng_below(rng_component_t component, uint64_t n){
+    assert(n > 0);
+    return rng_next(component) % n;
+}
+
+
+void rng_save_state(rng_snapshot_t *snapshot){
+    check_rng();
+    snapshot->seed = rng_seed_value;
+    for (int c = 0; c < NUM_RNG; ++ c){
+        memcpy(snapshot->s[c], rng_states[c].s, sizeof(snapshot->s[c]));
+    }
+}
+
+
+void rng_load_state(const rng_snapshot_t *snapshot){
+    rng_seed_value = snapshot->seed;
+    for (int c = 0; c < NUM_RNG; ++ c){
+        memcpy(rng_states[c].s, snapshot->s[c], sizeof(snapshot->s[c]));
+    }
+    rng_seeded = 1;
+}
+
+
+uint64_t rr_input(int source, uint64_t value){
+
+    if (rr_mode == RR_REPLAY){
+        value = rr_read_event(RR_EVENT_INPUT, source);
+    }
+    else if (rr_mode == RR_RECORD){
+        rr_write_event(RR_EVENT_INPUT, source, value);
+    }
+    rr_events ++;
+    return value;
+}
+
+
+void rr_record(const char *path){
+
+    rr_stop();
+    check_rng();
+
+    rr_file = fopen(path, "wb");
+    if (rr_file == NULL){
+        printf("replay: cannot open %s\n", path);
+        exit(0);
+    }
+    fwrite(RR_MAGIC, 1, 8, rr_file);
+    fwrite(&rng_seed_value, sizeof(uint64_t), 1, rr_file);
+    rr_mode = RR_RECORD;
+    rr_events = 0;
+}
+
+
+void rr_replay(const char *path){
+
+    rr_stop();
+
+    rr_file = fopen(path, "rb");
+    char magic[8];
+    uint64_t seed;
+    if (rr_file == NULL || fread(magic, 1, 8, rr_file) != 8 || memcmp(magic, RR_MAGIC, 8) != 0 ||
+        fread(&seed, sizeof(uint64_t), 1, rr_file) != 1){
+        printf("replay: %s is not a replay log\n", path);
+        exit(0);
+    }
+    // the generators continue from the recorded seed after the log
+    rng_seed(seed);
+    rr_mode = RR_REPLAY;
+    rr_events = 0;
+}
+
+
+uint64_t rr_stop(){
+    if (rr_file != NULL){
+        fclose(rr_file);
+        rr_file = NULL;
+    }
+    rr_mode = RR_OFF;
+    return rr_events;
+}
@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../../header/cpu.h"
+#include "../../header/memory.h"
+#include "../../header/common.h"
+#include "../../header/instruction.h"
+
+
+// branch prediction of jne, jmp, call and ret
+// the direction of jne is predicted by one of the direction predictors
+// the targets of the taken branches come from the BTB, the returns from the RAS
+// the predictor only observes the branches: rip is still set by the handlers
+
+
+// one instruction in each 64-byte slot: drop the zero bits of the PC
+#define BPRED_PC_SHIFT      (6)
+
+// TAGE-lite: the bimodal base predictor and the tagged tables
+// indexed by the PC and geometric lengths of the global history
+#define TAGE_NUM_TABLES     (4)
+#define TAGE_TAG_BITS       (9)
+#define TAGE_CTR_MAX        (3)
+#define TAGE_CTR_MIN        (-4)
+#define TAGE_U_MAX          (3)
+
+static const int tage_history_length[TAGE_NUM_TABLES] = {4, 8, 16, 32};
+
+typedef struct{
+    uint16_t tag;
+    int8_t ctr;         // taken if >= 0
+    uint8_t u;          // useful
+    uint8_t valid;      // 0 - never allocated, the tag 0 must not match it
+} tage_entry_t;
+
+typedef struct{
+    uint64_t pc;
+    uint64_t target;
+} btb_entry_t;
+
+// statistics of each branch
+typedef struct{
+    uint64_t pc;        // 0 - empty
+    uint64_t branches;
+    uint64_t mispredicts;
+} bpred_pc_t;
+
+static bpred_config_t bpred;
+static int bpred_enabled = 0;
+
+static uint64_t table_mask;
+// 2-bit saturating counters, taken if >= 2
+static uint8_t *pht = NULL;
+static tage_entry_t *tage[TAGE_NUM_TABLES];
+// the outcomes of the conditional branches, the latest in bit 0
+static uint64_t global_history = 0;
+
+static btb_entry_t *btb = NULL;
+
+static uint64_t *ras = NULL;
+static uint64_t ras_top = 0;
+static uint64_t ras_count = 0;
+
+// open addressing by the PC
+static bpred_pc_t *pc_table = NULL;
+static uint64_t pc_table_size = 0;
+static uint64_t pc_table_used = 0;
+
+
+static int is_power_of_two(uint64_t n){
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+
+static uint64_t pc_index(uint64_t pc){
+    return pc >> BPRED_PC_SHIFT;
+}
+
+
+static void update_counter(uint8_t *ctr, int taken){
+    if (taken == 1 && *ctr < 3){
+        (*ctr) ++;
+    }
+    else if (taken == 0 && *ctr > 0){
+        (*ctr) --;
+    }
+}
+
+
+/*--------------------------------------*/
+// direction predictors
+
+static int bimodal_predict(uint64_t pc){
+    return pht[pc_index(pc) & table_mask] >= 2;
+}
+
+static void bimodal_update(uint64_t pc, int taken){
+    update_counter(&pht[pc_index(pc) & table_mask], taken);
+}
+
+
+static uint64_t gshare_index(uint64_t pc){
+    uint64_t history = global_history & ((1ull << bpred.history_bits) - 1);
+    return (pc_index(pc) ^ history) & table_mask;
+}
+
+static int gshare_predict(uint64_t pc){
+    return pht[gshare_index(pc)] >= 2;
+}
+
+static void gshare_update(uint64_t pc, int taken){
+    update_counter(&pht[gshare_index(pc)], taken);
+}
+
+
+// xor the lowest length bits of the history into bits
+static uint64_t fold_history(int length, int bits){
+    uint64_t h = length >= 64 ? global_history : global_history & ((1ull << length) - 1);
+    uint64_t folded = 0;
+    while (h != 0){
+        folded ^= h & ((1ull << bits) - 1);
+        h >>= bits;
+    }
+    return folded;
+}
+
+static tage_entry_t *tage_lookup(int i, uint64_t pc, uint16_t *tag){
+    int bits = __builtin_ctzll(table_mask + 1);
+    uint64_t p = pc_index(pc);
+    uint64_t index = (p ^ (p >> bits) ^ fold_history(tage_history_length[i], bits)) & table_mask;
+    *tag = (p ^ (p >> TAGE_TAG_BITS) ^ (fold_history(tage_history_length[i], TAGE_TAG_BITS - 1) << 1))
+        & ((1 << TAGE_TAG_BITS) - 1);
+    return &tage[i][index];
+}
+
+// the longest matching table: provider, the next one: alternate
+// -1 means the base predictor
+static int tage_find(uint64_t pc, int below, tage_entry_t **entry){
+    for (int i = below - 1; i >= 0; -- i){
+        uint16_t tag;
+        tage_entry_t *e = tage_lookup(i, pc, &tag);
+        if (e->valid == 1 && e->tag == tag){
+            *entry = e;
+            return i;
+        }
+    }
+    *entry = NULL;
+    return -1;
+}
+
+static int tage_predict(uint64_t pc){
+    tage_entry_t *provider;
+    if (tage_find(pc, TAGE_NUM_TABLES, &provider) >= 0){
+        return provider->ctr >= 0;
+    }
+    return bimodal_predict(pc);
+}
+
+static void tage_update(uint64_t pc, int taken){
+
+    tage_entry_t *provider, *alt;
+    int p = tage_find(pc, TAGE_NUM_TABLES, &provider);
+    int prediction;
+
+    if (p >= 0){
+        int a = tage_find(pc, p, &alt);
+        int alt_prediction = a >= 0 ? alt->ctr >= 0 : bimodal_predict(pc);
+        prediction = provider->ctr >= 0;
+
+        // the provider is useful if it is right where the alternate is wrong
+        if (prediction != alt_prediction){
+            if (prediction == taken && provider->u < TAGE_U_MAX){
+                provider->u ++;
+            }
+            else if (prediction != taken && provider->u > 0){
+                provider->u --;
+            }
+        }
+        if (taken == 1 && provider->ctr < TAGE_CTR_MAX){
+            provider->ctr ++;
+        }
+        else if (taken == 0 && provider->ctr > TAGE_CTR_MIN){
+            provider->ctr --;
+        }
+    }
+    else {
+        prediction = bimodal_predict(pc);
+        bimodal_update(pc, taken);
+    }
+
+    if (prediction == taken){
+        return;
+    }
+
+    // allocate in a table with longer history
+    for (int i = p + 1; i < TAGE_NUM_TABLES; ++ i){
+        uint16_t tag;
+        tage_entry_t *e = tage_lookup(i, pc, &tag);
+        if (e->u == 0){
+            e->valid = 1;
+            e->tag = tag;
+            e->ctr = taken ? 0 : -1;
+            return;
+        }
+    }
+    // no free entry: age the candidates
+    for (int i = p + 1; i < TAGE_NUM_TABLES; ++ i){
+        uint16_t tag;
+        tage_lookup(i, pc, &tag)->u --;
+    }
+}
+
+
+typedef struct{
+    const char *name;
+    int (*predict)(uint64_t pc);
+    void (*update)(uint64_t pc, int taken);
+} direction_predictor_t;
+
+static direction_predictor_t predictors[NUM_BPRED] = {
+    {"bimodal", bimodal_predict, bimodal_update},
+    {"gshare", gshare_predict, gshare_update},
+    {"TAGE-lite", tage_predict, tage_update},
+};
+
+
+/*--------------------------------------*/
+// BTB and RAS
+
+static int btb_lookup(uint64_t pc, uint64_t *target){
+    btb_entry_t *e = &btb[pc_index(pc) & (bpred.btb_size - 1)];
+    if (e->pc == pc){
+        *target = e->target;
+        return 1;
+    }
+    return 0;
+}
+
+static void btb_update(uint64_t pc, uint64_t target){
+    btb_entry_t *e = &btb[pc_index(pc) & (bpred.btb_size - 1)];
+    e->pc = pc;
+    e->target = target;
+}
+
+// the oldest entry is overwritten when the stack is full
+static void ras_push(uint64_t addr){
+    ras[ras_top] = addr;
+    ras_top = (ras_top + 1) % bpred.ras_size;
+    if (ras_count < bpred.ras_size){
+        ras_count ++;
+    }
+}
+
+static int ras_pop(uint64_t *addr){
+    if (ras_count == 0){
+        return 0;
+    }
+    ras_top = (ras_top + bpred.ras_size - 1) % bpred.ras_size;
+    ras_count --;
+    *addr = ras[ras_top];
+    return 1;
+}
+
+
+/*--------------------------------------*/
+// statistics by PC
+
+static bpred_pc_t *pc_slot(uint64_t pc){
+    uint64_t i = (pc_index(pc) * 0x9e3779b97f4a7c15ull) & (pc_table_size - 1);
+    while (pc_table[i].pc != 0 && pc_table[i].pc != pc){
+        i = (i + 1) & (pc_table_size - 1);
+    }
+    return &pc_table[i];
+}
+
+static bpred_pc_t *pc_record(uint64_t pc){
+
+    if (2 * (pc_table_used + 1) > pc_table_size){
+        bpred_pc_t *old = pc_table;
+        uint64_t old_size = pc_table_size;
+
+        pc_table_size = old_size == 0 ? 64 : old_size * 2;
+        pc_table = calloc(pc_table_size, sizeof(bpred_pc_t));
+        assert(pc_table != NULL);
+        for (uint64_t i = 0; i < old_size; ++ i){
+            if (old[i].pc != 0){
+                *pc_slot(old[i].pc) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    bpred_pc_t *slot = pc_slot(pc);
+    if (slot->pc == 0){
+        slot->pc = pc;
+        pc_table_used ++;
+    }
+    return slot;
+}
+
+int bpred_pc_stats(uint64_t pc, uint64_t *branches, uint64_t *mispredicts){
+    if (pc_table_size == 0 || pc == 0){
+        return 0;
+    }
+    bpred_pc_t *slot = pc_slot(pc);
+    if (slot->pc != pc){
+        return 0;
+    }
+    *branches = slot->branches;
+    *mispredicts = slot->mispredicts;
+    return 1;
+}
+
+
+/*--------------------------------------*/
+
+void bpred_default(bpred_config_t *config){
+    config->type = BPRED_GSHARE;
+    config->table_size = DEFAULT_BPRED_TABLE_SIZE;
+    config->history_bits = DEFAULT_BPRED_HISTORY_BITS;
+    config->btb_size = DEFAULT_BTB_SIZE;
+    config->ras_size = DEFAULT_RAS_SIZE;
+}
+
+
+void bpred_config(const bpred_config_t *config){
+
+    free(pht);
+    free(btb);
+    free(ras);
+    free(pc_table);
+    for (int i = 0; i < TAGE_NUM_TABLES; ++ i){
+        free(tage[i]);
+        tage[i] = NULL;
+    }
+    pht = NULL;
+    btb = NULL;
+    ras = NULL;
+    pc_table = NULL;
+    pc_table_size = 0;
+    pc_table_used = 0;
+    global_history = 0;
+    ras_top = 0;
+    ras_count = 0;
+    memset(&bpred_stats, 0, sizeof(bpred_stats_t));
+
+    if (config == NULL){
+        bpred_enabled = 0;
+        return;
+    }
+
+    assert(0 <= config->type && config->type < NUM_BPRED);
+    assert(is_power_of_two(config->table_size) && is_power_of_two(config->btb_size));
+    assert(config->history_bits < 64 && config->ras_size > 0);
+    bpred = *config;
+    table_mask = config->table_size - 1;
+
+    pht = malloc(config->table_size);
+    btb = calloc(config->btb_size, sizeof(btb_entry_t));
+    ras = calloc(config->ras_size, sizeof(uint64_t));
+    assert(pht != NULL && btb != NULL && ras != NULL);
+    // weakly not taken
+    memset(pht, 1, config->table_size);
+
+    if (config->type == BPRED_TAGE){
+        for (int i = 0; i < TAGE_NUM_TABLES; ++ i){
+            tage[i] = calloc(config->table_size, sizeof(tage_entry_t));
+            assert(tage[i] != NULL);
+        }
+    }
+    bpred_enabled = 1;
+}
+
+
+int bpred_is_enabled(){
+    return bpred_enabled;
+}
+
+
+int bpred_branch(int op, uint64_t pc, uint64_t next_pc){
+
+    if (bpred_enabled == 0){
+        return 0;
+    }
+
+    uint64_t fallthrough = pc + sizeof(char) * MAX_INSTRUCTION_CHAR;
+    uint64_t target;
+    int mispredict = 0;
+
+    switch (op){
+        case INST_JNE:
+        {
+            int taken = next_pc != fallthrough;
+            direction_predictor_t *dp = &predictors[bpred.type];
+
+            int predicted = dp->predict(pc);
+            if (predicted != taken){
+                mispredict = 1;
+                bpred_stats.direction_miss ++;
+            }
+            else if (taken == 1 && (btb_lookup(pc, &target) == 0 || target != next_pc)){
+                mispredict = 1;
+                bpred_stats.btb_miss ++;
+            }
+
+            dp->update(pc, taken);
+            global_history = (global_history << 1) | taken;
+            if (taken == 1){
+                btb_update(pc, next_pc);
+            }
+            bpred_stats.conditional ++;
+            break;
+        }
+        case INST_JMP:
+        case INST_CALL:
+            if (btb_lookup(pc, &target) == 0 || target != next_pc){
+                mispredict = 1;
+                bpred_stats.btb_miss ++;
+            }
+            btb_update(pc, next_pc);
+            if (op == INST_CALL){
+                ras_push(fallthrough);
+            }
+            break;
+        case INST_RET:
+            if (ras_pop(&target) == 0 || target != next_pc){
+                mispredict = 1;
+                bpred_stats.ras_miss ++;
+            }
+            break;
+        default:
+            return 0;
+    }
+
+    bpred_stats.branches ++;
+    bpred_stats.mispredict += mispredict;
+
+    bpred_pc_t *record = pc_record(pc);
+    record->branches ++;
+    record->mispredicts += mispredict;
+    return mispredict;
+}
+
+
+static int compare_mispredicts(const void *a, const void *b){
+    const bpred_pc_t *x = a;
+    const bpred_pc_t *y = b;
+    if (x->mispredicts != y->mispredicts){
+        return x->mispredicts < y->mispredicts ? 1 : -1;
+    }
+    return x->pc < y->pc ? -1 : x->pc > y->pc;
+}
+
+void print_bpred_stats(){
+
+    if (bpred_enabled == 0){
+        return;
+    }
+
+    printf("branch predictor %s: %lu branches\t%lu conditional\t%lu mispredicts\taccuracy %.2f%%\n",
+        predictors[bpred.type].name, bpred_stats.branches, bpred_stats.conditional, bpred_stats.mispredict,
+        bpred_stats.branches == 0 ? 0.0 : 100.0 - 100.0 * bpred_stats.mispredict / bpred_stats.branches);
+    printf("mispredicts: direction %lu\tBTB %lu\tRAS %lu\n",
+        bpred_stats.direction_miss, bpred_stats.btb_miss, bpred_stats.ras_miss);
+
+    // the branches with most mispredicts
+    bpred_pc_t *sorted = calloc(pc_table_used ? pc_table_used : 1, sizeof(bpred_pc_t));
+    assert(sorted != NULL);
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < pc_table_size; ++ i){
+        if (pc_table[i].pc != 0){
+            sorted[n ++] = pc_table[i];
+        }
+    }
+    qsort(sorted, n, sizeof(bpred_pc_t), compare_mispredicts);
+    for (uint64_t i = 0; i < n && i < 10 && sorted[i].mispredicts > 0; ++ i){
+        printf("\t%lx\t%lu branches\t%lu mispredicts\n",
+            sorted[i].pc, sorted[i].branches, sorted[i].mispredicts);
+    }
+    free(sorted);
+}
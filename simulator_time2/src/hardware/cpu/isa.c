@@ -532,7 +532,7 @@ static void mov_handler(od_t *src_od, od_t *dst_od){
         
         //src: register
         //dst: virtual address
-        cpu_write64bits_dram(va2pa(dst), *(uint64_t *)src);
+        cpu_write64bits_dram(va2pa_write(dst), *(uint64_t *)src);
         next_rip();
         cpu_flags.__flag_value = 0;
         return;
@@ -565,7 +565,7 @@ static void push_handler(od_t *src_od, od_t *dst_od){
         // src: register
         // dst: empty
         cpu_reg.rsp = cpu_reg.rsp - 8;
-        cpu_write64bits_dram(va2pa(cpu_reg.rsp), *(uint64_t *)src);
+        cpu_write64bits_dram(va2pa_write(cpu_reg.rsp), *(uint64_t *)src);
         next_rip();
         cpu_flags.__flag_value = 0;
         return;
@@ -618,7 +618,7 @@ static void call_handler(od_t *src_od, od_t *dst_od){
     //push the return value
     cpu_reg.rsp -= 8;
     // 将下一条指令写入栈中
-    cpu_write64bits_dram(va2pa(cpu_reg.rsp), cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
+    cpu_write64bits_dram(va2pa_write(cpu_reg.rsp), cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
     // jump to target functio address
     
     cpu_pc.rip = src;
@@ -773,22 +773,42 @@ void instruction_cycle(){
 
     //正确读的方式
     char inst_str[MAX_INSTRUCTION_CHAR + 10];
-    cpu_readinst_dram(va2pa(cpu_pc.rip), inst_str);
+    if (trace_enabled == 1){
+        trace_begin_instruction(cpu_pc.rip);
+    }
+    cpu_readinst_dram(va2pa_fetch(cpu_pc.rip), inst_str);
 
     debug_printf(DEBUG_INSTRUCTIONCYCLE, "%lx       %s\n", cpu_pc.rip, inst_str);
 
     inst_t inst;
 
     parse_instruction(inst_str, &inst);
+    TRACE_EVENT(TRACE_INSTRUCTION, 0, 0, inst.op, 0);
 
     handler_t handler = handler_table[inst.op];
+    uint64_t pc = cpu_pc.rip;
 
-    handler(&(inst.src), &(inst.dst));
+    if (profile_enabled == 1){
+        profile_begin_instruction();
+    }
+    if (cpu_fast_forward == 1){
+        handler(&(inst.src), &(inst.dst));
+    }
+    else {
+        // the fetch above is not charged: the instruction slots are not real encodings
+        timing_begin_instruction();
+        handler(&(inst.src), &(inst.dst));
+        timing_end_instruction(&inst);
+    }
+    if (profile_enabled == 1){
+        profile_end_instruction(pc, inst.op);
+    }
+    sample_instruction(pc, inst.op);
 
 }
 
 void print_register(){
-    if ((DEBUG_VERBOSE_SET & DEBUG_REGISTERS) == 0X0){
+    if (!DEBUG_ENABLED(DEBUG_REGISTERS)){
         return;
     }
     // reg_t reg = cr->reg;
@@ -801,7 +821,7 @@ void print_register(){
 
 
 void print_stack(){
-    if ((DEBUG_VERBOSE_SET & DEBUG_PRINTSTACK) == 0X0){
+    if (!DEBUG_ENABLED(DEBUG_PRINTSTACK)){
         return;
     }
     
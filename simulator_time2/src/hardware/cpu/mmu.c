@@ -13,8 +13,13 @@
 // -------------------------------------------- //
 #define NUM_TLB_CACHE_LINE_PER_SET (8)
 
+// large page TLBs are small and fully associative
+#define NUM_TLB_2M_CACHE_LINE (32)
+#define NUM_TLB_1G_CACHE_LINE (4)
+
 typedef struct {
     int valid;
+    int dirty;      // the dirty bit in page table entry is already set
     uint64_t tag;
     uint64_t ppn;
 } tlb_cacheline_t;
@@ -29,27 +34,60 @@ typedef struct{
 
 static tlb_cache_t mmu_tlb;
 
+// separate TLB arrays for large pages
+// tag: virtual address without the large page offset
+static tlb_cacheline_t mmu_tlb_2m[NUM_TLB_2M_CACHE_LINE];
+static tlb_cacheline_t mmu_tlb_1g[NUM_TLB_1G_CACHE_LINE];
+
+
+// -------------------------------------------- //
+// paging-structure caches
+// -------------------------------------------- //
+// like the PML4, PDPT and PDE caches of Intel:
+// cache the address of the next level page table,
+// tagged by the VPNs used to index the levels above
+#define DEFAULT_PWC_PGD_SIZE (2)
+#define DEFAULT_PWC_PUD_SIZE (4)
+#define DEFAULT_PWC_PMD_SIZE (32)
+
+typedef struct{
+    int valid;
+    uint64_t tag;
+    uint64_t table;     // address of the next level page table
+    uint64_t time;      // LRU
+} pwc_entry_t;
+
+typedef struct{
+    int size;
+    pwc_entry_t *entries;
+} pwc_t;
 
+// [0]: PGD entries - [1]: PUD entries - [2]: PMD entries
+static pwc_t mmu_pwc[3];
+static int pwc_configured = 0;
+static uint64_t pwc_timer = 0;
 
 
 
-static uint64_t page_walk(uint64_t vaddr_value);
-static void page_fault_handler(pte4_t *pte, address_t vaddr);
 
 
-static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index);
-static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_line_index);
+static uint64_t page_walk(uint64_t vaddr_value, int *level, int write);
 
 
-int swap_in(uint64_t daddr, uint64_t ppn);
-int swap_out(uint64_t daddr, uint64_t ppn);
+static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int write);
+static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int level, int write);
 
+static int read_pagewalk_cache(uint64_t vaddr_value, uint64_t *table);
+static void write_pagewalk_cache(uint64_t vaddr_value, int level, uint64_t table);
+static void flush_pagewalk_cache();
 
 
-uint64_t va2pa(uint64_t vaddr){
+
+static uint64_t translate(uint64_t vaddr, int write){
 
 #ifdef USE_NAVIE_VA2PA
-    return vaddr % PHYSICAL_MEMORY_SPACE;
+    // the physical memory is sized at run time, and the default size before the first access
+    return vaddr % (physical_memory_size != 0 ? physical_memory_size : PHYSICAL_MEMORY_SPACE);
     // return vaddr & (0xffffffffffffffff >> (64 - MAX_NUM_PHYSICAL_PAGE));
 
     //等价于 vaddr & 0xfffff  <=> vaddr % 65536
@@ -57,9 +95,16 @@ uint64_t va2pa(uint64_t vaddr){
 
     uint64_t paddr = 0;
 
+#ifdef USE_PAGETABLE_VA2PA
+    if (cpu_fast_forward == 1){
+        // functional translation by the page table only
+        int level = PAGE_LEVEL_4K;
+        return page_walk(vaddr, &level, write);
+    }
+#endif
+
 #if defined(USE_TLB_HARDWARE) && defined(USE_PAGETABLE_VA2PA)
-    int free_tlb_line_index = -1;
-    int tlb_hit = read_tlb(vaddr, &paddr, &free_tlb_line_index);
+    int tlb_hit = read_tlb(vaddr, &paddr, write);
 
     // TODO: add flag to read tlb failed
     if (tlb_hit){
@@ -73,7 +118,8 @@ uint64_t va2pa(uint64_t vaddr){
 
 #ifdef USE_PAGETABLE_VA2PA
     // assume that page_walk is consuming much time
-    paddr = page_walk(vaddr);
+    int level = PAGE_LEVEL_4K;
+    paddr = page_walk(vaddr, &level, write);
 #endif
 
 
@@ -82,7 +128,7 @@ uint64_t va2pa(uint64_t vaddr){
     // TODO: check if this paddr from page table is a legal address
     if (paddr != 0){
         // TLB write
-        if (write_tlb(vaddr, paddr, free_tlb_line_index) == 1){
+        if (write_tlb(vaddr, paddr, level, write) == 1){
             return paddr;
         }
     }
@@ -93,353 +139,583 @@ uint64_t va2pa(uint64_t vaddr){
 }
 
 
+static uint64_t traced_translate(uint64_t vaddr, int write, int type){
 
+    if (trace_enabled == 0){
+        return translate(vaddr, write);
+    }
 
+    uint64_t tlb_miss = mmu_stats.tlb_miss;
+    uint64_t paddr = translate(vaddr, write);
+    TRACE_EVENT(type, vaddr, paddr, 0, (mmu_stats.tlb_miss != tlb_miss ? TRACE_FLAG_TLB_MISS : 0) |
+        (write == 1 ? TRACE_FLAG_WRITE : 0));
+    return paddr;
+}
 
 
-// input - virtual address
-// output - physical address
+uint64_t va2pa(uint64_t vaddr){
+    return traced_translate(vaddr, 0, TRACE_LOAD);
+}
 
 
+uint64_t va2pa_write(uint64_t vaddr){
+    return traced_translate(vaddr, 1, TRACE_STORE);
+}
+
+
+uint64_t va2pa_fetch(uint64_t vaddr){
+    return traced_translate(vaddr, 0, TRACE_FETCH);
+}
+
+
+
+
+
+
+// page table entries are stored in the simulated physical memory
+// the physical address of entry [index] in the page table at physical page table_ppn
+static inline uint64_t get_pte_paddr(uint64_t table_ppn, int index){
+    return (table_ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + index * sizeof(pte123_t);
+}
+
+
+// MMU reads the page table entry through the memory hierarchy
+static uint64_t read_pte(uint64_t pte_paddr){
+
+    mmu_stats.page_walk_ref ++;
+
+#ifdef USE_SRAM_CACHE
+    uint64_t miss = sram_cache_stats.miss;
+    uint64_t pte_value = cpu_read64bits_dram(pte_paddr);
+    if (sram_cache_stats.miss != miss){
+        // the page table entry is loaded into SRAM cache
+        mmu_stats.page_walk_cache_miss ++;
+    }
+    return pte_value;
+#else
+    return cpu_read64bits_dram(pte_paddr);
+#endif
+}
+
 
 // input - virtual address
+//         write: the access is a memory write
 // output - physical address
-//  static uint64_t page_walk(uint64_t vaddr_value)
-// {
-//     // parse address
-//     address_t vaddr = {
-//         .vaddr_value = vaddr_value
-//     };
-//     int vpns[4] = {
-//         vaddr.vpn1,
-//         vaddr.vpn2,
-//         vaddr.vpn3,
-//         vaddr.vpn4,
-//     };
-//     int vpo = vaddr.vpo;
-
-//     int page_table_size = PAGE_TABLE_ENTRY_NUM * sizeof(pte123_t);
-
-//     // CR3 register's value is malloced on the heap of the simulator
-//     pte123_t *pgd = (pte123_t *)cpu_controls.cr3;
-//     assert(pgd != NULL);
-//     assert(sizeof(pte123_t) == sizeof(pte4_t));
-//     assert(page_table_size == (1 << 12));
-
-//     int level = 0;
-//     pte123_t *tab = pgd;
-//     while (level < 3)
-//     {
-//         int vpn = vpns[level];
-//         if (tab[vpn].present != 1)
-//         {
-//             // page fault
-//             printf("\033[31;1mMMU (%lx): level %d page fault: [%x].present == 0\n\033[0m", vaddr_value, level + 1, vpn);
-//             goto RAISE_PAGE_FAULT;
-//         }
-
-//         // move to next level
-//         tab = (pte123_t *)((uint64_t)tab[vpn].paddr);
-//         level += 1;
-//     }
-
-//     pte4_t *pte = &((pte4_t *)tab)[vaddr.vpn4];
-//     if (pte->present == 1)
-//     {
-//         // find page table entry
-//         address_t paddr = {
-//             .ppn = pte->ppn,
-//             .ppo = vpo    // page offset inside the 4KB page
-//         };
-//         return paddr.paddr_value;
-//     }
-//     else
-//     {
-//         printf("\033[31;1mMMU (%lx): level 4 page fault: [%x].present == 0\n\033[0m", vaddr_value, vaddr.vpn4);
-//     }
-
-// RAISE_PAGE_FAULT:
-//     mmu_vaddr_pagefault = vaddr.vaddr_value;
-//     // This interrupt will not return
-//     interrupt_stack_switching(0x0e);
-//     return 0;
-// }
-
-
-static uint64_t page_walk(uint64_t vaddr_value){
+//          level: the level of the leaf entry, decides the page size
+static uint64_t page_walk(uint64_t vaddr_value, int *level, int write){
     
     address_t vaddr = {
         .vaddr_value = vaddr_value,
     };
+    int vpns[4] = {
+        vaddr.vpn1,
+        vaddr.vpn2,
+        vaddr.vpn3,
+        vaddr.vpn4,
+    };
 
-    int page_table_size = PAGE_TABLE_ENTRY_NUM * sizeof(pte123_t);
-    
-    // CR3 register's value is malloced on the heap of the simulator
-    pte123_t *pgd = (pte123_t *)cpu_controls.cr3;
-    assert(pgd != NULL);
-
-    if (pgd[vaddr.vpn1].present == 1){
-
-        // starting PHYSICAL PAGE NUMBER of the next level page table
-        // aka, high bits starting address of the page table 
-        pte123_t *pud = (pte123_t *)((uint64_t)pgd[vaddr.vpn1].paddr);
-
-
-        if (pud[vaddr.vpn2].present == 1){
-            
-            // find pmd ppn
-            pte123_t *pmd = (pte123_t *)((uint64_t)pud[vaddr.vpn2].paddr);
-
-            if (pmd[vaddr.vpn3].present == 1){
-
-                // find pt ppn
-                
-                pte4_t *pt = (pte4_t *)((uint64_t)pmd[vaddr.vpn3].paddr);
-
-                if (pt[vaddr.vpn4].present == 1){
-                    
-                    address_t paddr = {
-                        .ppn = pt[vaddr.vpn4].ppn,
-                        .ppo = vaddr.ppo, // page offset inside the 4KB page
-                    };
-                    return paddr.paddr_value;
-                }
-                else {
-                    // page table entry not exist
-#ifdef DEBUG_PAGE_WALK
-                    printf("page walk level 4:pt[%lx].present == 0\n\t malloc new page table for it", vaddr.vpn4);
+    // CR3 register's value is the physical page of PGD
+    uint64_t pgd = cpu_controls.cr3;
+    assert(pgd < num_physical_page && page_map[pgd].pinned == 1);
+    assert(sizeof(pte123_t) == sizeof(pte4_t));
+
+    mmu_stats.page_walk ++;
+
+    // PGD, PUD, PMD
+    uint64_t tab = pgd;
+    int start_level = 1;
+#ifdef USE_PAGEWALK_CACHE
+    // skip straight to the lowest cached level
+    uint64_t cached_table = 0;
+    start_level = cpu_fast_forward == 1 ? 1 : read_pagewalk_cache(vaddr_value, &cached_table);
+    if (start_level > 1){
+        tab = cached_table;
+    }
 #endif
-                    
-                   
-                    
-                    //TODO: 缺页异常 调页
-                    
-
-                    exit(0);
 
-                }
+    for (int i = start_level; i < PAGE_LEVEL_4K; ++ i){
 
+        uint64_t pte_paddr = get_pte_paddr(tab, vpns[i - 1]);
+        pte123_t pte = {
+            .pte_value = read_pte(pte_paddr)
+        };
 
-            }
-            else{
-
-                // pt - level 4 not exists
+        if (pte.present != 1){
+            // page table of next level not exists
 #ifdef DEBUG_PAGE_WALK
-                printf("page walk level 3:pmd[%lx].present == 0\n\t malloc new page table for it", vaddr.vpn3);
+            printf("page walk level %d: [%x].present == 0\n", i, vpns[i - 1]);
 #endif
-                
-                pte4_t *pt = malloc(page_table_size);
-                memset(pt, 0, page_table_size);
-                
-
-                // set page table entry
-                pmd[vaddr.vpn3].present = 1;
-                pmd[vaddr.vpn3].paddr = (uint64_t)pt;
-                
-                //TODO: page fault here
-                // map the physical page and the virtual page
+            // first touch of this region: allocate the page table on demand
+            // the page fault of PT maps the page then
+            pte.pte_value = 0;
+            pte.present = 1;
+            pte.ppn = allocate_pagetable();
+            cpu_write64bits_dram(pte_paddr, pte.pte_value);
+        }
 
-                exit(0);
+        if (pte.largepage == 1 && (i == PAGE_LEVEL_1G || i == PAGE_LEVEL_2M)){
+            // PUD or PMD entry maps the large page directly
+            // the remaining VPNs are part of the page offset
+            uint64_t page_size = (i == PAGE_LEVEL_1G) ? LARGE_PAGE_1G_SIZE : LARGE_PAGE_2M_SIZE;
+            if (i == PAGE_LEVEL_1G){
+                mmu_stats.page_walk_1g ++;
+            }
+            else {
+                mmu_stats.page_walk_2m ++;
+            }
 
+            if (pte.reference == 0 || (write == 1 && pte.dirty == 0)){
+                pte.reference = 1;
+                pte.dirty |= write;
+                cpu_write64bits_dram(pte_paddr, pte.pte_value);
             }
+
+            *level = i;
+            return (((uint64_t)pte.ppn) << PHYSICAL_PAGE_OFFSET_LENGTH) + (vaddr_value & (page_size - 1));
         }
-        else {
-                // pmd - level 3 not exists
-#ifdef DEBUG_PAGE_WALK
-            printf("page walk level 2:pud[%lx].present == 0\n\t malloc new page table for it", vaddr.vpn2);
-#endif
-            
-            pte123_t *pmd = malloc(page_table_size);
-            memset(pmd, 0, page_table_size);
-            
-
-            // set page table entry
-            pud[vaddr.vpn2].present = 1;
-            pud[vaddr.vpn2].paddr = (uint64_t)pmd;
-            
-            //TODO: page fault here
-            // map the physical page and the virtual page
-
-            exit(0);
+
+        // physical page of the next level page table
+        tab = pte.ppn;
+#ifdef USE_PAGEWALK_CACHE
+        if (cpu_fast_forward == 0){
+            write_pagewalk_cache(vaddr_value, i, tab);
         }
+#endif
     }
-    else {
-        // pud - level 2 not exists
+
+    // PT
+    uint64_t pte_paddr = get_pte_paddr(tab, vaddr.vpn4);
+    pte4_t pte = {
+        .pte_value = read_pte(pte_paddr)
+    };
+
+    if (pte.present == 0 || (write == 1 && pte.readonly == 1)){
+        // page table entry not exist, or write to the copy-on-write page
 #ifdef DEBUG_PAGE_WALK
-        printf("page walk level 1:pgd[%lx].present == 0\n\t malloc new page table for it", vaddr.vpn1);
+        printf("page walk level 4:pt[%x].present == %d\n", vaddr.vpn4, (int)pte.present);
 #endif
-        
-        pte123_t *pud = malloc(page_table_size);
-        memset(pud, 0, page_table_size);
-        
+        // 缺页异常 调页
+        // then restart the access
+        TRACE_EVENT(TRACE_PAGE_FAULT, vaddr_value, pte_paddr, 0, write == 1 ? TRACE_FLAG_WRITE : 0);
+        page_fault_handler(pte_paddr, vaddr_value, write);
+        pte.pte_value = read_pte(pte_paddr);
+        assert(pte.present == 1 && (write == 0 || pte.readonly == 0));
+    }
+
+    // MMU sets the accessed bit and the dirty bit for the kernel's page replacement
+    if (pte.reference == 0 || (write == 1 && pte.dirty == 0)){
+        pte.reference = 1;
+        pte.dirty |= write;
+        cpu_write64bits_dram(pte_paddr, pte.pte_value);
+    }
+
+    address_t paddr = {
+        .ppn = pte.ppn,
+        .ppo = vaddr.vpo, // page offset inside the 4KB page
+    };
+    *level = PAGE_LEVEL_4K;
+    return paddr.paddr_value;
+}
+
+
+// the physical address of the PT entry of vaddr, 0 if the page table not exists
+static uint64_t find_pte4_paddr(uint64_t vaddr_value){
 
-        // set page table entry
-        pgd[vaddr.vpn1].present = 1;
-        pgd[vaddr.vpn1].paddr = (uint64_t)pud;
-        
-        //TODO: page fault here
-        // map the physical page and the virtual page
+    address_t vaddr = {
+        .vaddr_value = vaddr_value,
+    };
+    int vpns[4] = {
+        vaddr.vpn1,
+        vaddr.vpn2,
+        vaddr.vpn3,
+        vaddr.vpn4,
+    };
 
-        exit(0);
+    uint64_t tab = cpu_controls.cr3;
+    for (int i = 1; i < PAGE_LEVEL_4K; ++ i){
+        pte123_t pte = {
+            .pte_value = cpu_read64bits_dram(get_pte_paddr(tab, vpns[i - 1]))
+        };
+        if (pte.present == 0 || pte.largepage == 1){
+            return 0;
+        }
+        tab = pte.ppn;
     }
-    
+    return get_pte_paddr(tab, vaddr.vpn4);
+}
+
+
+// page tables are pinned: never swapped out
+uint64_t allocate_pagetable(){
+
+    uint64_t ppn = allocate_frame();
+    page_map[ppn].pinned = 1;
 
+    // clear all entries
+    for (int j = 0; j < PAGE_TABLE_ENTRY_NUM; ++ j){
+        cpu_write64bits_dram(get_pte_paddr(ppn, j), 0);
+    }
+    return ppn;
 }
 
 
-static void page_fault_handler(pte4_t *pte, address_t vaddr){
+// kernel builds the page table for the mapping
+// the missing page tables on the way are allocated in physical memory
+void map_page(uint64_t vaddr_value, uint64_t ppn, int level){
+
+    address_t vaddr = {
+        .vaddr_value = vaddr_value,
+    };
+    int vpns[4] = {
+        vaddr.vpn1,
+        vaddr.vpn2,
+        vaddr.vpn3,
+        vaddr.vpn4,
+    };
+
+    assert(PAGE_LEVEL_1G <= level && level <= PAGE_LEVEL_4K);
+    if (level == PAGE_LEVEL_1G){
+        assert((vaddr_value & (LARGE_PAGE_1G_SIZE - 1)) == 0);
+        assert((ppn & ((LARGE_PAGE_1G_SIZE / PAGE_SIZE) - 1)) == 0);
+    }
+    else if (level == PAGE_LEVEL_2M){
+        assert((vaddr_value & (LARGE_PAGE_2M_SIZE - 1)) == 0);
+        assert((ppn & ((LARGE_PAGE_2M_SIZE / PAGE_SIZE) - 1)) == 0);
+    }
+
+    uint64_t tab = cpu_controls.cr3;
+    assert(tab < num_physical_page && page_map[tab].pinned == 1);
 
-    assert(pte->present == 0);
+    for (int i = 1; i < level; ++ i){
 
-    // select one victim physical page to swap to disk
+        uint64_t pte_paddr = get_pte_paddr(tab, vpns[i - 1]);
+        pte123_t pte = {
+            .pte_value = cpu_read64bits_dram(pte_paddr)
+        };
 
-    // this is the selected ppn for vaddr
-    int ppn = -1;
-    pte4_t *victim = NULL;
-    uint64_t daddr = 0xffffffffffffffff;
+        if (pte.present == 0){
+            // allocate new page table for it
+            pte.pte_value = 0;
+            pte.present = 1;
+            pte.ppn = allocate_pagetable();
+            cpu_write64bits_dram(pte_paddr, pte.pte_value);
+        }
+        // cannot map a smaller page inside the large page
+        assert(pte.largepage == 0);
 
-    // 1. try to request one free physical page from DRAM
-    // kernel's responsibility
-    for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++i){
+        tab = pte.ppn;
+    }
 
-        if (page_map[i].pte4->present == 0){
-            printf("PageFault: use free ppn %d\n", i);
+    uint64_t pte_paddr = get_pte_paddr(tab, vpns[level - 1]);
+    if (level == PAGE_LEVEL_4K){
+        assert(ppn < num_physical_page && page_map[ppn].pinned == 0);
 
-            // found i as free ppn
-            ppn = i;
-            page_map[ppn].allocated = 1;// allocate for vaddr
-            page_map[ppn].dirty = 0;    // allocated as clean
-            page_map[ppn].time = 0;     // most recently used physical page
-            page_map[ppn].pte4 = pte;
+        pte4_t pte = {
+            .pte_value = 0
+        };
+        pte.present = 1;
+        pte.ppn = ppn;
+        cpu_write64bits_dram(pte_paddr, pte.pte_value);
 
-            pte->present = 1;
-            pte->ppn = ppn;
-            pte->dirty = 0;
-            
-            return;
+        // reversed mapping
+        // the frame is taken out of the free frame list lazily
+        page_map[ppn].allocated = 1;
+        page_map[ppn].daddr = 0;
+        page_add_rmap(ppn, pte_paddr, vaddr_value);
+    }
+    else {
+        // PUD or PMD
+        pte123_t pte = {
+            .pte_value = cpu_read64bits_dram(pte_paddr)
+        };
+        if (pte.present == 1 && pte.largepage == 0){
+            // the page table below is replaced by the large page
+            flush_pagewalk_cache();
         }
+        pte.pte_value = 0;
+        pte.present = 1;
+        pte.largepage = 1;
+        pte.ppn = ppn;
+        cpu_write64bits_dram(pte_paddr, pte.pte_value);
+    }
+}
+
+
+// remove the mapping of the 4KB virtual page
+// release its physical page or its swap slot
+void unmap_page(uint64_t vaddr_value){
+
+    uint64_t pte_paddr = find_pte4_paddr(vaddr_value);
+    if (pte_paddr == 0){
+        return;
     }
 
-    // 2. no free physical page: select one clean page (LRU) and overwrite
-    // in this case, there is no DRAM - DISK transaction
-    int lru_ppn = -1;
-    int lru_time = -1;
-    for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++ i){
-        if (page_map[i].dirty == 0 && lru_time < page_map[i].time){
-            lru_time = page_map[i].time;
-            lru_ppn = i;
+    pte4_t pte = {
+        .pte_value = cpu_read64bits_dram(pte_paddr)
+    };
+    cpu_write64bits_dram(pte_paddr, 0);
+
+    if (pte.present == 1){
+        invalidate_tlb(vaddr_value);
+        put_frame(pte.ppn, pte_paddr);
+    }
+    else if (pte.saddr != 0){
+        release_swap_entry(pte.saddr);
+    }
+}
+
+
+// copy the page table at level for the child process
+// vaddr: the first virtual address mapped by this page table
+static uint64_t fork_table(uint64_t tab, int level, uint64_t vaddr_value){
+
+    uint64_t child = allocate_pagetable();
+
+    for (int j = 0; j < PAGE_TABLE_ENTRY_NUM; ++ j){
+
+        uint64_t pte_paddr = get_pte_paddr(tab, j);
+        uint64_t pte_value = cpu_read64bits_dram(pte_paddr);
+        if (pte_value == 0){
+            continue;
+        }
+
+        if (level < PAGE_LEVEL_4K){
+            pte123_t pte = {
+                .pte_value = pte_value
+            };
+            if (pte.present == 1 && pte.largepage == 0){
+                uint64_t shift = VIRTUAL_PAGE_OFFSET_LENGTH + (PAGE_LEVEL_4K - level) * VIRTUAL_PAGE_NUMBER_LENGTH;
+                pte.ppn = fork_table(pte.ppn, level + 1, vaddr_value + ((uint64_t)j << shift));
+            }
+            // the large page is shared, not copied on write
+            cpu_write64bits_dram(get_pte_paddr(child, j), pte.pte_value);
+            continue;
         }
+
+        pte4_t pte = {
+            .pte_value = pte_value
+        };
+        if (pte.present == 1){
+            if (pte.readonly == 0){
+                // both the parent and the child copy it on the first write
+                pte.readonly = 1;
+                pte.cow = 1;
+                cpu_write64bits_dram(pte_paddr, pte.pte_value);
+            }
+            if (page_map[pte.ppn].pinned == 0){
+                // not the zero page
+                page_add_rmap(pte.ppn, get_pte_paddr(child, j), vaddr_value + ((uint64_t)j << VIRTUAL_PAGE_OFFSET_LENGTH));
+            }
+        }
+        else {
+            // the swap slot is shared until swapped in
+            swap_dup_slot(pte.saddr);
+        }
+        cpu_write64bits_dram(get_pte_paddr(child, j), pte.pte_value);
     }
+    return child;
+}
 
-    if (lru_ppn != -1 && lru_ppn < MAX_NUM_PHYSICAL_PAGE){
-        ppn = lru_ppn;
-        
-        //reversed mapping
-        victim = page_map[ppn].pte4;
-        victim->pte_value = 0;
-        victim->present = 0;
-        victim->saddr = page_map[ppn].daddr;
-        
-        //Load page from disk to physical memory first
-        daddr = pte->saddr;
-        swap_in(pte->saddr, ppn);
-        
 
-        pte->pte_value = 0;
-        pte->present = 1;
-        pte->ppn = ppn;
-        pte->dirty = 0;
+uint64_t fork_pagetable(){
 
+    uint64_t pgd = cpu_controls.cr3;
+    assert(pgd < num_physical_page && page_map[pgd].pinned == 1);
 
-        page_map[ppn].allocated = 1;
-        page_map[ppn].dirty = 0;
-        page_map[ppn].time = 0;
-        page_map[ppn].pte4 = pte;
-        page_map[ppn].daddr = daddr;
+    uint64_t child = fork_table(pgd, 1, 0);
+    vma_fork(pgd, child);
+
+    // the writable translations of the parent are readonly now
+    flush_tlb();
+    return child;
+}
+
+
+// tag of the paging-structure cache of level (1 - PGD, 2 - PUD, 3 - PMD):
+// the VPNs from VPN1 to VPN<level>
+static inline uint64_t pagewalk_cache_tag(uint64_t vaddr_value, int level){
+    return (vaddr_value & ((1ul << VIRTUAL_ADDRESS_LENGTH) - 1)) >>
+        (VIRTUAL_PAGE_OFFSET_LENGTH + (PAGE_LEVEL_4K - level) * VIRTUAL_PAGE_NUMBER_LENGTH);
+}
+
+
+static void init_pagewalk_cache(pwc_t *pwc, int size){
+    if (pwc->entries != NULL){
+        free(pwc->entries);
+    }
+    pwc->size = size;
+    pwc->entries = NULL;
+    if (size > 0){
+        pwc->entries = malloc(size * sizeof(pwc_entry_t));
+        memset(pwc->entries, 0, size * sizeof(pwc_entry_t));
+    }
+}
+
+
+void pagewalk_cache_config(int pgd_size, int pud_size, int pmd_size){
+    assert(pgd_size >= 0 && pud_size >= 0 && pmd_size >= 0);
+    pwc_configured = 1;
+    init_pagewalk_cache(&mmu_pwc[0], pgd_size);
+    init_pagewalk_cache(&mmu_pwc[1], pud_size);
+    init_pagewalk_cache(&mmu_pwc[2], pmd_size);
+}
 
+
+// lazy configuration with the default sizes
+static void check_pagewalk_cache(){
+    if (pwc_configured == 0){
+        pagewalk_cache_config(DEFAULT_PWC_PGD_SIZE, DEFAULT_PWC_PUD_SIZE, DEFAULT_PWC_PMD_SIZE);
+    }
+}
+
+
+// all levels are searched in parallel by hardware
+// return the level of the first page table to read: 1 if all miss
+static int read_pagewalk_cache(uint64_t vaddr_value, uint64_t *table){
+
+    check_pagewalk_cache();
+    pwc_timer ++;
+
+    int start_level = 1;
+    for (int i = 0; i < 3; ++ i){
+        pwc_t *pwc = &mmu_pwc[i];
+        uint64_t tag = pagewalk_cache_tag(vaddr_value, i + 1);
+        int hit = 0;
+
+        for (int j = 0; j < pwc->size; ++ j){
+            pwc_entry_t *e = &pwc->entries[j];
+            if (e->valid == 1 && e->tag == tag){
+                hit = 1;
+                e->time = pwc_timer;
+                // the lower level wins
+                start_level = i + 2;
+                *table = e->table;
+                break;
+            }
+        }
+
+        if (hit == 1){
+            mmu_stats.pwc_hit[i] ++;
+        }
+        else {
+            mmu_stats.pwc_miss[i] ++;
+        }
+    }
+    return start_level;
+}
+
+
+// cache the page table pointed by the entry of this level
+static void write_pagewalk_cache(uint64_t vaddr_value, int level, uint64_t table){
+
+    pwc_t *pwc = &mmu_pwc[level - 1];
+    if (pwc->size == 0){
         return;
     }
 
-    // 3. no free nor clean physical page: select one LRU victim
-    // write back(swap out) the DIRTY victim to disk
-    lru_ppn = -1;
-    lru_time = -1;
-    for (int i = 0; i < MAX_NUM_PHYSICAL_PAGE; ++ i){
-        if (lru_time < page_map[i].time){
-            lru_time = page_map[i].time;
-            lru_ppn = i;
+    uint64_t tag = pagewalk_cache_tag(vaddr_value, level);
+    pwc_entry_t *victim = &pwc->entries[0];
+    for (int j = 0; j < pwc->size; ++ j){
+        pwc_entry_t *e = &pwc->entries[j];
+        if (e->valid == 1 && e->tag == tag){
+            victim = e;
+            break;
+        }
+        // invalid entry first, then LRU
+        if (e->valid == 0 || (victim->valid == 1 && e->time < victim->time)){
+            victim = e;
         }
     }
 
+    victim->valid = 1;
+    victim->tag = tag;
+    victim->table = table;
+    victim->time = pwc_timer;
+}
 
-    assert(0 <= lru_ppn && lru_ppn <= MAX_NUM_PHYSICAL_PAGE);
 
-    
-    ppn = lru_ppn;
-    
-    swap_out(page_map[ppn].daddr, ppn);
+static void flush_pagewalk_cache(){
+    for (int i = 0; i < 3; ++ i){
+        for (int j = 0; j < mmu_pwc[i].size; ++ j){
+            mmu_pwc[i].entries[j].valid = 0;
+        }
+    }
+}
 
 
-    //reversed mapping
-    victim = page_map[ppn].pte4;
-    victim->pte_value = 0;
-    victim->present = 0;
-    victim->saddr = page_map[ppn].daddr;
-    
-    //Load page from disk to physical memory first
-    daddr = pte->saddr;
-    swap_in(pte->saddr, ppn);
-    
+// search the lines for the tag
+static tlb_cacheline_t *lookup_tlb_lines(tlb_cacheline_t *lines, int num_lines, uint64_t tag){
+
+    for (int i = 0; i < num_lines; ++ i){
+        if (lines[i].valid == 1 && lines[i].tag == tag){
+            return &lines[i];
+        }
+    }
+    return NULL;
+}
 
-    pte->pte_value = 0;
-    pte->present = 1;
-    pte->ppn = ppn;
-    pte->dirty = 0;
 
+// fill the tag into its own line, one free line, or one RANDOM victim if no free line
+static void fill_tlb_lines(tlb_cacheline_t *lines, int num_lines, uint64_t tag, uint64_t ppn, int dirty){
 
-    page_map[ppn].allocated = 1;
-    page_map[ppn].dirty = 0;
-    page_map[ppn].time = 0;
-    page_map[ppn].pte4 = pte;
-    page_map[ppn].daddr = daddr;
+    tlb_cacheline_t *line = lookup_tlb_lines(lines, num_lines, tag);
+    for (int i = 0; i < num_lines && line == NULL; ++ i){
+        if (lines[i].valid == 0){
+            line = &lines[i];
+            break;
+        }
+    }
 
-    return;
+    if (line == NULL){
+        // no free TLB cache line, select one RANDOM victim
+        line = &lines[rng_below(RNG_TLB, num_lines)];
+    }
 
+    line->valid = 1;
+    line->dirty = dirty;
+    line->ppn = ppn;
+    line->tag = tag;
 }
 
 
-static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index){
+// the first write to a clean page misses TLB:
+// the page walk sets the dirty bit in page table entry
+static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int write){
     address_t vaddr = {
         .address_value = vaddr_value
     };
 
-    tlb_cacheset_t *set = &mmu_tlb.sets[vaddr.tlbi];
-    *free_tlb_line_index = -1;
-
-
-    for (int i = 0; i < NUM_TLB_CACHE_LINE_PER_SET; ++ i){
-        
-        tlb_cacheline_t *line = &set->lines[i];
+    // all TLB arrays are searched in parallel by hardware
+    tlb_cacheline_t *line = lookup_tlb_lines(mmu_tlb.sets[vaddr.tlbi].lines,
+        NUM_TLB_CACHE_LINE_PER_SET, vaddr.tlbt);
+    if (line != NULL && line->dirty >= write){
+        // TLB read hit
+        *paddr_value_ptr = (line->ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + vaddr.vpo;
+        mmu_stats.tlb_hit_4k ++;
+        return 1;
+    }
 
-        if (line->valid == 0){
-            *free_tlb_line_index = i;
-        }
+    line = lookup_tlb_lines(mmu_tlb_2m, NUM_TLB_2M_CACHE_LINE, vaddr.vaddr_value / LARGE_PAGE_2M_SIZE);
+    if (line != NULL && line->dirty >= write){
+        *paddr_value_ptr = (line->ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + (vaddr.vaddr_value & (LARGE_PAGE_2M_SIZE - 1));
+        mmu_stats.tlb_hit_2m ++;
+        return 1;
+    }
 
-        if (line->tag == vaddr.tlbt &&
-            line->valid == 1){
-            // TLB read hit
-            *paddr_value_ptr = line->ppn;
-            return 1;
-        }
+    line = lookup_tlb_lines(mmu_tlb_1g, NUM_TLB_1G_CACHE_LINE, vaddr.vaddr_value / LARGE_PAGE_1G_SIZE);
+    if (line != NULL && line->dirty >= write){
+        *paddr_value_ptr = (line->ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + (vaddr.vaddr_value & (LARGE_PAGE_1G_SIZE - 1));
+        mmu_stats.tlb_hit_1g ++;
+        return 1;
     }
 
     // TLB read miss
-    paddr_value_ptr = NULL;
+    mmu_stats.tlb_miss ++;
     return 0;
 }
 
 
-static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_line_index){
+static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int level, int write){
     address_t vaddr = {
         .address_value = vaddr_value
     };
@@ -448,29 +724,121 @@ static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_li
         .address_value = paddr_value
     };
 
-    tlb_cacheset_t *set = &mmu_tlb.sets[vaddr.tlbi];
+    if (level == PAGE_LEVEL_1G){
+        fill_tlb_lines(mmu_tlb_1g, NUM_TLB_1G_CACHE_LINE, vaddr.vaddr_value / LARGE_PAGE_1G_SIZE,
+            (paddr_value & ~((uint64_t)LARGE_PAGE_1G_SIZE - 1)) >> PHYSICAL_PAGE_OFFSET_LENGTH, write);
+    }
+    else if (level == PAGE_LEVEL_2M){
+        fill_tlb_lines(mmu_tlb_2m, NUM_TLB_2M_CACHE_LINE, vaddr.vaddr_value / LARGE_PAGE_2M_SIZE,
+            (paddr_value & ~((uint64_t)LARGE_PAGE_2M_SIZE - 1)) >> PHYSICAL_PAGE_OFFSET_LENGTH, write);
+    }
+    else {
+        fill_tlb_lines(mmu_tlb.sets[vaddr.tlbi].lines, NUM_TLB_CACHE_LINE_PER_SET, vaddr.tlbt, paddr.ppn, write);
+    }
+
+    return 1;
+}
 
-    if (0 <= free_tlb_line_index && free_tlb_line_index < NUM_TLB_CACHE_LINE_PER_SET)
-    {
-        tlb_cacheline_t *line = &set->lines[free_tlb_line_index];
 
-        line->valid = 1;
-        line->ppn = paddr.ppn;
-        line->tag = vaddr.tlbt;
+void flush_tlb(){
 
-        return 1;
+    for (int i = 0; i < (1 << TLB_CACHE_INDEX_LENGTH); ++ i){
+        for (int j = 0; j < NUM_TLB_CACHE_LINE_PER_SET; ++ j){
+            mmu_tlb.sets[i].lines[j].valid = 0;
+        }
     }
+    for (int i = 0; i < NUM_TLB_2M_CACHE_LINE; ++ i){
+        mmu_tlb_2m[i].valid = 0;
+    }
+    for (int i = 0; i < NUM_TLB_1G_CACHE_LINE; ++ i){
+        mmu_tlb_1g[i].valid = 0;
+    }
+    flush_pagewalk_cache();
+}
 
-    // no free TLB cache line, select one RANDOM victim
-    int random_victim_index = random() % NUM_TLB_CACHE_LINE_PER_SET;
 
-    tlb_cacheline_t *line = &set->lines[random_victim_index];
+void invalidate_tlb(uint64_t vaddr_value){
+    address_t vaddr = {
+        .address_value = vaddr_value
+    };
 
-    line->valid = 1;
-    line->ppn = paddr.ppn;
-    line->tag = vaddr.tlbt;
+    tlb_cacheline_t *line = lookup_tlb_lines(mmu_tlb.sets[vaddr.tlbi].lines,
+        NUM_TLB_CACHE_LINE_PER_SET, vaddr.tlbt);
+    if (line != NULL){
+        line->valid = 0;
+    }
+}
 
-    return 1;
+
+static uint64_t count_valid_tlb_lines(tlb_cacheline_t *lines, int num_lines){
+    uint64_t count = 0;
+    for (int i = 0; i < num_lines; ++ i){
+        count += lines[i].valid;
+    }
+    return count;
 }
 
 
+void mmu_save_state(FILE *fp){
+
+    checkpoint_write(fp, &mmu_tlb, sizeof(mmu_tlb));
+    checkpoint_write(fp, mmu_tlb_2m, sizeof(mmu_tlb_2m));
+    checkpoint_write(fp, mmu_tlb_1g, sizeof(mmu_tlb_1g));
+
+    check_pagewalk_cache();
+    checkpoint_write(fp, &pwc_timer, sizeof(pwc_timer));
+    for (int i = 0; i < 3; ++ i){
+        checkpoint_write(fp, &mmu_pwc[i].size, sizeof(int));
+        checkpoint_write(fp, mmu_pwc[i].entries, mmu_pwc[i].size * sizeof(pwc_entry_t));
+    }
+}
+
+
+void mmu_load_state(FILE *fp){
+
+    checkpoint_read(fp, &mmu_tlb, sizeof(mmu_tlb));
+    checkpoint_read(fp, mmu_tlb_2m, sizeof(mmu_tlb_2m));
+    checkpoint_read(fp, mmu_tlb_1g, sizeof(mmu_tlb_1g));
+
+    pwc_configured = 1;
+    checkpoint_read(fp, &pwc_timer, sizeof(pwc_timer));
+    for (int i = 0; i < 3; ++ i){
+        int size;
+        checkpoint_read(fp, &size, sizeof(int));
+        init_pagewalk_cache(&mmu_pwc[i], size);
+        checkpoint_read(fp, mmu_pwc[i].entries, size * sizeof(pwc_entry_t));
+    }
+}
+
+
+void print_mmu_stats(){
+
+    uint64_t valid_4k = 0;
+    for (int i = 0; i < (1 << TLB_CACHE_INDEX_LENGTH); ++ i){
+        valid_4k += count_valid_tlb_lines(mmu_tlb.sets[i].lines, NUM_TLB_CACHE_LINE_PER_SET);
+    }
+    uint64_t valid_2m = count_valid_tlb_lines(mmu_tlb_2m, NUM_TLB_2M_CACHE_LINE);
+    uint64_t valid_1g = count_valid_tlb_lines(mmu_tlb_1g, NUM_TLB_1G_CACHE_LINE);
+
+    uint64_t hit = mmu_stats.tlb_hit_4k + mmu_stats.tlb_hit_2m + mmu_stats.tlb_hit_1g;
+    uint64_t total = hit + mmu_stats.tlb_miss;
+
+    printf("TLB hit: 4K %lu\t2M %lu\t1G %lu\tmiss %lu\thit rate %.2f%%\n",
+        mmu_stats.tlb_hit_4k, mmu_stats.tlb_hit_2m, mmu_stats.tlb_hit_1g, mmu_stats.tlb_miss,
+        total == 0 ? 0.0 : 100.0 * hit / total);
+    // TLB reach: the memory covered by the valid TLB entries
+    printf("TLB reach: 4K %lu KB\t2M %lu KB\t1G %lu KB\n",
+        valid_4k * (PAGE_SIZE >> 10), valid_2m * (LARGE_PAGE_2M_SIZE >> 10), valid_1g * (LARGE_PAGE_1G_SIZE >> 10));
+    printf("page walk: %lu\t(2M %lu\t1G %lu)\tentries read %lu\n",
+        mmu_stats.page_walk, mmu_stats.page_walk_2m, mmu_stats.page_walk_1g, mmu_stats.page_walk_ref);
+#ifdef USE_SRAM_CACHE
+    // page table entries compete with the data for the SRAM cache
+    printf("page walk SRAM cache miss: %lu\n", mmu_stats.page_walk_cache_miss);
+#endif
+
+    const char *pwc_name[3] = {"PGD", "PUD", "PMD"};
+    for (int i = 0; i < 3; ++ i){
+        printf("page walk cache %s (%d entries): hit %lu\tmiss %lu\n",
+            pwc_name[i], mmu_pwc[i].size, mmu_stats.pwc_hit[i], mmu_stats.pwc_miss[i]);
+    }
+}
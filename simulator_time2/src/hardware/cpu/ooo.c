@@ -0,0 +1,446 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../../header/cpu.h"
+#include "../../header/memory.h"
+#include "../../header/common.h"
+#include "../../header/instruction.h"
+
+
+// out-of-order timing model
+// the simulator executes the instructions in program order, this model only
+// computes when each instruction would dispatch, issue, complete and retire:
+//  dispatch:   in order, limited by width, free ROB, issue queue and LSQ entries
+//  issue:      when the renamed sources are ready and a functional unit is free
+//  complete:   issue + latency; the misses overlap up to the number of MSHRs
+//  retire:     in order, limited by width
+// renaming removes the WAR and WAW hazards, so only RAW is tracked
+
+
+// the architectural registers and the flags
+#define OOO_NUM_REGS    (sizeof(cpu_reg_t) / sizeof(uint64_t) + 1)
+#define OOO_FLAGS       (OOO_NUM_REGS - 1)
+
+// the issue slots are booked in this window of cycles
+#define OOO_SCHED_WINDOW    (4096)
+
+enum{
+    FU_ALU,
+    FU_BRANCH,
+    FU_MEM,
+    NUM_FU,
+};
+
+typedef struct{
+    uint64_t cycle;     // the cycle booked in this slot
+    uint32_t issued;
+    uint32_t fu[NUM_FU];
+} sched_slot_t;
+
+typedef struct{
+    // the cycle each register is written by the youngest producer
+    uint64_t reg_ready[OOO_NUM_REGS];
+
+    uint64_t *rob;      // retire cycles of the last rob_size instructions
+    uint64_t *iq;       // issue cycles of the issue queue entries
+    uint64_t *lsq;      // release cycles of the last lsq_size memory operations
+    uint64_t *mshr;     // release cycles of the miss handling registers
+
+    uint64_t seq;
+    uint64_t mem_seq;
+
+    uint64_t dispatch_cycle;
+    uint32_t dispatch_count;
+    uint64_t retire_cycle;
+    uint32_t retire_count;
+
+    // the page fault drains the pipeline
+    uint64_t barrier;
+    // the end of the latest miss, to count the cycles with misses outstanding
+    uint64_t miss_busy_until;
+
+    sched_slot_t sched[OOO_SCHED_WINDOW];
+} ooo_core_t;
+
+static ooo_config_t ooo;
+static int ooo_enabled = 0;
+static ooo_core_t ooo_cores[NUM_CORES];
+
+
+void ooo_default(ooo_config_t *config){
+    config->width = DEFAULT_OOO_WIDTH;
+    config->rob_size = DEFAULT_OOO_ROB_SIZE;
+    config->iq_size = DEFAULT_OOO_IQ_SIZE;
+    config->lsq_size = DEFAULT_OOO_LSQ_SIZE;
+    config->alu_units = DEFAULT_OOO_ALU_UNITS;
+    config->branch_units = DEFAULT_OOO_BRANCH_UNITS;
+    config->mem_units = DEFAULT_OOO_MEM_UNITS;
+    config->mshr = DEFAULT_OOO_MSHR;
+}
+
+
+void ooo_config(const ooo_config_t *config){
+
+    for (int c = 0; c < NUM_CORES; ++ c){
+        ooo_core_t *core = &ooo_cores[c];
+        free(core->rob);
+        free(core->iq);
+        free(core->lsq);
+        free(core->mshr);
+        memset(core, 0, sizeof(ooo_core_t));
+    }
+    memset(&ooo_stats, 0, sizeof(ooo_stats));
+
+    if (config == NULL){
+        ooo_enabled = 0;
+        return;
+    }
+
+    assert(config->width > 0 && config->rob_size > 0 && config->iq_size > 0);
+    assert(config->lsq_size > 0 && config->mshr > 0);
+    assert(config->alu_units > 0 && config->branch_units > 0 && config->mem_units > 0);
+    ooo = *config;
+
+    for (int c = 0; c < NUM_CORES; ++ c){
+        ooo_core_t *core = &ooo_cores[c];
+        core->rob = calloc(ooo.rob_size, sizeof(uint64_t));
+        core->iq = calloc(ooo.iq_size, sizeof(uint64_t));
+        core->lsq = calloc(ooo.lsq_size, sizeof(uint64_t));
+        core->mshr = calloc(ooo.mshr, sizeof(uint64_t));
+        assert(core->rob != NULL && core->iq != NULL && core->lsq != NULL && core->mshr != NULL);
+    }
+    ooo_enabled = 1;
+}
+
+
+int ooo_is_enabled(){
+    return ooo_enabled;
+}
+
+
+/*--------------------------------------*/
+// register dependencies
+
+// the operands keep the address of the register in cpu_reg
+static int register_index(uint64_t reg){
+    uint64_t base = (uint64_t)&cpu_reg;
+    if (base <= reg && reg < base + sizeof(cpu_reg_t)){
+        return (reg - base) / sizeof(uint64_t);
+    }
+    return -1;
+}
+
+#define REG_INDEX(r) ((uint64_t)&cpu_reg.r - (uint64_t)&cpu_reg) / sizeof(uint64_t)
+
+static void add_register(int *regs, int *n, int index){
+    if (index >= 0){
+        regs[(*n) ++] = index;
+    }
+}
+
+static int is_memory(const od_t *od){
+    return od->type >= MEM_IMM;
+}
+
+// the registers read to get the value or the address of the operand
+static void operand_sources(const od_t *od, int *regs, int *n){
+    if (od->type == REG){
+        add_register(regs, n, register_index(od->reg1));
+    }
+    else if (is_memory(od)){
+        add_register(regs, n, register_index(od->reg1));
+        add_register(regs, n, register_index(od->reg2));
+    }
+}
+
+static void operand_address(const od_t *od, int *regs, int *n){
+    if (is_memory(od)){
+        add_register(regs, n, register_index(od->reg1));
+        add_register(regs, n, register_index(od->reg2));
+    }
+}
+
+static void operand_dest(const od_t *od, int *regs, int *n){
+    if (od->type == REG){
+        add_register(regs, n, register_index(od->reg1));
+    }
+}
+
+
+typedef struct{
+    int srcs[8];
+    int num_srcs;
+    int dsts[4];
+    int num_dsts;
+    int fu;
+    int load;
+    int store;
+} inst_class_t;
+
+static void classify(const inst_t *inst, inst_class_t *ic){
+
+    memset(ic, 0, sizeof(inst_class_t));
+    ic->fu = FU_ALU;
+
+    const od_t *src = &inst->src;
+    const od_t *dst = &inst->dst;
+
+    switch (inst->op){
+        case INST_MOV:
+            operand_sources(src, ic->srcs, &ic->num_srcs);
+            operand_address(dst, ic->srcs, &ic->num_srcs);
+            operand_dest(dst, ic->dsts, &ic->num_dsts);
+            ic->load = is_memory(src);
+            ic->store = is_memory(dst);
+            break;
+        case INST_PUSH:
+            operand_sources(src, ic->srcs, &ic->num_srcs);
+            add_register(ic->srcs, &ic->num_srcs, REG_INDEX(rsp));
+            add_register(ic->dsts, &ic->num_dsts, REG_INDEX(rsp));
+            ic->load = is_memory(src);
+            ic->store = 1;
+            break;
+        case INST_POP:
+            operand_address(src, ic->srcs, &ic->num_srcs);
+            add_register(ic->srcs, &ic->num_srcs, REG_INDEX(rsp));
+            operand_dest(src, ic->dsts, &ic->num_dsts);
+            add_register(ic->dsts, &ic->num_dsts, REG_INDEX(rsp));
+            ic->load = 1;
+            ic->store = is_memory(src);
+            break;
+        case INST_LEAVE:
+            add_register(ic->srcs, &ic->num_srcs, REG_INDEX(rbp));
+            add_register(ic->dsts, &ic->num_dsts, REG_INDEX(rsp));
+            add_register(ic->dsts, &ic->num_dsts, REG_INDEX(rbp));
+            ic->load = 1;
+            break;
+        case INST_CALL:
+            add_register(ic->srcs, &ic->num_srcs, REG_INDEX(rsp));
+            add_register(ic->dsts, &ic->num_dsts, REG_INDEX(rsp));
+            ic->fu = FU_BRANCH;
+            ic->store = 1;
+            break;
+        case INST_RET:
+            add_register(ic->srcs, &ic->num_srcs, REG_INDEX(rsp));
+            add_register(ic->dsts, &ic->num_dsts, REG_INDEX(rsp));
+            ic->fu = FU_BRANCH;
+            ic->load = 1;
+            break;
+        case INST_ADD:
+        case INST_SUB:
+            operand_sources(src, ic->srcs, &ic->num_srcs);
+            operand_sources(dst, ic->srcs, &ic->num_srcs);
+            operand_dest(dst, ic->dsts, &ic->num_dsts);
+            add_register(ic->dsts, &ic->num_dsts, OOO_FLAGS);
+            ic->load = is_memory(src) || is_memory(dst);
+            ic->store = is_memory(dst);
+            break;
+        case INST_CMP:
+            operand_sources(src, ic->srcs, &ic->num_srcs);
+            operand_sources(dst, ic->srcs, &ic->num_srcs);
+            add_register(ic->dsts, &ic->num_dsts, OOO_FLAGS);
+            ic->load = is_memory(src) || is_memory(dst);
+            break;
+        case INST_JNE:
+            add_register(ic->srcs, &ic->num_srcs, OOO_FLAGS);
+            ic->fu = FU_BRANCH;
+            break;
+        case INST_JMP:
+            ic->fu = FU_BRANCH;
+            break;
+        default:
+            break;
+    }
+
+    if (ic->fu == FU_ALU && (ic->load || ic->store)){
+        ic->fu = FU_MEM;
+    }
+}
+
+
+/*--------------------------------------*/
+// scheduling
+
+static sched_slot_t *sched_slot(ooo_core_t *core, uint64_t cycle){
+    sched_slot_t *slot = &core->sched[cycle % OOO_SCHED_WINDOW];
+    if (slot->cycle != cycle){
+        // the slot of an older cycle is reused
+        memset(slot, 0, sizeof(sched_slot_t));
+        slot->cycle = cycle;
+    }
+    return slot;
+}
+
+// the first cycle from ready with an issue slot and a free functional unit
+static uint64_t book_issue(ooo_core_t *core, uint64_t ready, int fu){
+
+    uint32_t units[NUM_FU] = {ooo.alu_units, ooo.branch_units, ooo.mem_units};
+
+    uint64_t cycle = ready;
+    while (1){
+        sched_slot_t *slot = sched_slot(core, cycle);
+        if (slot->issued < ooo.width && slot->fu[fu] < units[fu]){
+            slot->issued ++;
+            slot->fu[fu] ++;
+            return cycle;
+        }
+        cycle ++;
+    }
+}
+
+// the entry released earliest
+static uint64_t min_entry(uint64_t *entries, uint64_t n, uint64_t *index){
+    uint64_t m = 0;
+    for (uint64_t i = 1; i < n; ++ i){
+        if (entries[i] < entries[m]){
+            m = i;
+        }
+    }
+    *index = m;
+    return entries[m];
+}
+
+
+void ooo_instruction(const inst_t *inst, uint64_t latency, uint64_t mem_cycles,
+    uint64_t fault_cycles, uint64_t mispredict_cycles){
+
+    if (ooo_enabled == 0){
+        return;
+    }
+    assert(ACTIVE_CORE < NUM_CORES);
+
+    ooo_core_t *core = &ooo_cores[ACTIVE_CORE];
+    ooo_stats_t *os = &ooo_stats[ACTIVE_CORE];
+
+    inst_class_t ic;
+    classify(inst, &ic);
+    int mem = ic.load || ic.store;
+
+    // dispatch
+    uint64_t t = core->dispatch_cycle > core->barrier ? core->dispatch_cycle : core->barrier;
+    if (core->seq >= ooo.rob_size && core->rob[core->seq % ooo.rob_size] > t){
+        t = core->rob[core->seq % ooo.rob_size];
+        os->rob_full ++;
+    }
+    uint64_t iq_index;
+    uint64_t iq_free = min_entry(core->iq, ooo.iq_size, &iq_index);
+    if (iq_free > t){
+        t = iq_free;
+        os->iq_full ++;
+    }
+    if (mem == 1 && core->lsq[core->mem_seq % ooo.lsq_size] > t){
+        t = core->lsq[core->mem_seq % ooo.lsq_size];
+        os->lsq_full ++;
+    }
+    if (t == core->dispatch_cycle && core->dispatch_count == ooo.width){
+        t ++;
+    }
+    if (t != core->dispatch_cycle){
+        core->dispatch_cycle = t;
+        core->dispatch_count = 0;
+    }
+    core->dispatch_count ++;
+
+    // issue
+    uint64_t ready = t + 1;
+    for (int i = 0; i < ic.num_srcs; ++ i){
+        if (core->reg_ready[ic.srcs[i]] > ready){
+            ready = core->reg_ready[ic.srcs[i]];
+        }
+    }
+    if (fault_cycles > 0 && core->retire_cycle > ready){
+        // the fault is taken when all older instructions are retired
+        ready = core->retire_cycle;
+    }
+    uint64_t issue = book_issue(core, ready, ic.fu);
+    core->iq[iq_index] = issue;
+
+    // execute
+    uint64_t complete = issue + latency;
+    uint64_t mem_done = issue;
+    if (mem_cycles > 0){
+        uint64_t mshr_index;
+        uint64_t start = min_entry(core->mshr, ooo.mshr, &mshr_index);
+        if (start > issue){
+            os->mshr_full ++;
+        }
+        else {
+            start = issue;
+        }
+        mem_done = start + mem_cycles;
+        core->mshr[mshr_index] = mem_done;
+
+        // the cycles with at least one miss outstanding
+        if (start >= core->miss_busy_until){
+            os->miss_busy_cycles += mem_cycles;
+        }
+        else if (mem_done > core->miss_busy_until){
+            os->miss_busy_cycles += mem_done - core->miss_busy_until;
+        }
+        if (mem_done > core->miss_busy_until){
+            core->miss_busy_until = mem_done;
+        }
+        os->misses ++;
+        os->miss_cycles += mem_cycles;
+
+        if (ic.load == 1){
+            complete = mem_done + latency;
+        }
+    }
+    if (fault_cycles > 0){
+        complete += fault_cycles;
+        core->barrier = complete;
+    }
+    if (mispredict_cycles > 0 && complete + mispredict_cycles > core->barrier){
+        // the wrong path is squashed, the correct path is fetched after the branch resolves
+        core->barrier = complete + mispredict_cycles;
+        os->mispredicts ++;
+    }
+    for (int i = 0; i < ic.num_dsts; ++ i){
+        core->reg_ready[ic.dsts[i]] = complete;
+    }
+
+    // retire
+    uint64_t r = complete > core->retire_cycle ? complete : core->retire_cycle;
+    if (r == core->retire_cycle && core->retire_count == ooo.width){
+        r ++;
+    }
+    if (r != core->retire_cycle){
+        core->retire_cycle = r;
+        core->retire_count = 0;
+    }
+    core->retire_count ++;
+
+    core->rob[core->seq % ooo.rob_size] = r;
+    core->seq ++;
+    if (mem == 1){
+        // the store leaves the queue when it is written
+        core->lsq[core->mem_seq % ooo.lsq_size] = (ic.store == 1 && mem_done > r) ? mem_done : r;
+        core->mem_seq ++;
+    }
+
+    os->instructions ++;
+    os->cycles = core->retire_cycle;
+}
+
+
+void print_ooo_stats(){
+
+    if (ooo_enabled == 0){
+        return;
+    }
+
+    printf("out-of-order: width %u\tROB %u\tIQ %u\tLSQ %u\tMSHR %u\n",
+        ooo.width, ooo.rob_size, ooo.iq_size, ooo.lsq_size, ooo.mshr);
+    for (int c = 0; c < NUM_CORES; ++ c){
+        ooo_stats_t *os = &ooo_stats[c];
+        printf("core %d: %lu instructions\t%lu cycles\tIPC %.2f\n", c,
+            os->instructions, os->cycles,
+            os->cycles == 0 ? 0.0 : (double)os->instructions / os->cycles);
+        printf("stalls: ROB %lu\tIQ %lu\tLSQ %lu\tMSHR %lu\n",
+            os->rob_full, os->iq_full, os->lsq_full, os->mshr_full);
+        printf("mispredicts %lu\tmisses %lu\tMLP %.2f\n", os->mispredicts, os->misses,
+            os->miss_busy_cycles == 0 ? 0.0 : (double)os->miss_cycles / os->miss_busy_cycles);
+    }
+}
@@ -0,0 +1,464 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../../header/cpu.h"
+#include "../../header/memory.h"
+#include "../../header/common.h"
+#include "../../header/linker.h"
+#include "../../header/instruction.h"
+
+
+// guest profiler
+// the counters of the MMU, SRAM cache and timing model are sampled around
+// each instruction, the difference is the cost of the instruction
+
+
+#define MAX_PROFILE_DEPTH   (1024)
+
+typedef struct{
+    char name[MAX_CHAR_SYMBOL_NAME];
+    uint64_t addr;
+    uint64_t size;
+} profile_symbol_t;
+
+typedef struct{
+    uint64_t pc;
+    profile_count_t count;
+} profile_pc_t;
+
+// the calling context tree: one node for each distinct stack
+typedef struct PROFILE_NODE_STRUCT{
+    uint64_t entry;         // the address of the called function
+    uint64_t depth;
+    uint64_t instructions;
+    uint64_t cycles;
+    struct PROFILE_NODE_STRUCT *parent;
+    struct PROFILE_NODE_STRUCT *child;
+    struct PROFILE_NODE_STRUCT *sibling;
+} profile_node_t;
+
+static profile_config_t profile;
+
+// sorted by address
+static profile_symbol_t *symbols = NULL;
+static uint64_t num_symbols = 0;
+
+// open addressing by pc
+static profile_pc_t *pc_table = NULL;
+static uint64_t pc_table_size = 0;
+static uint64_t pc_table_used = 0;
+
+// the root has no function: its children are the bottom frames
+static profile_node_t *root = NULL;
+static profile_node_t *current = NULL;
+// the calls deeper than MAX_PROFILE_DEPTH, not in the tree
+static uint64_t overflow_calls = 0;
+
+static uint64_t countdown = 0;
+
+// the counters before the instruction
+static uint64_t begin_cycles = 0;
+static uint64_t begin_cache_misses = 0;
+static uint64_t begin_tlb_misses = 0;
+
+
+/*--------------------------------------*/
+// symbols
+
+static const profile_symbol_t *find_symbol(uint64_t pc){
+    // the last symbol starting at or before pc
+    uint64_t low = 0, high = num_symbols;
+    while (low < high){
+        uint64_t mid = (low + high) / 2;
+        if (symbols[mid].addr <= pc){
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    if (low > 0 && pc < symbols[low - 1].addr + symbols[low - 1].size){
+        return &symbols[low - 1];
+    }
+    return NULL;
+}
+
+
+void profile_add_symbol(const char *name, uint64_t addr, uint64_t size){
+
+    symbols = realloc(symbols, (num_symbols + 1) * sizeof(profile_symbol_t));
+    assert(symbols != NULL);
+
+    // keep the order by address
+    uint64_t i = num_symbols;
+    while (i > 0 && symbols[i - 1].addr > addr){
+        symbols[i] = symbols[i - 1];
+        i --;
+    }
+    strncpy(symbols[i].name, name, MAX_CHAR_SYMBOL_NAME - 1);
+    symbols[i].name[MAX_CHAR_SYMBOL_NAME - 1] = '\0';
+    symbols[i].addr = addr;
+    symbols[i].size = size;
+    num_symbols ++;
+}
+
+
+void profile_elf_symbols(const elf_t *elf){
+
+    uint64_t text_addr = 0;
+    for (int i = 0; i < elf->sht_count; ++ i){
+        if (strcmp(elf->sht[i].sh_name, ".text") == 0){
+            text_addr = elf->sht[i].sh_addr;
+        }
+    }
+
+    // one instruction of each line in .text
+    for (int i = 0; i < elf->symt_count; ++ i){
+        const st_entry_t *sym = &elf->symt[i];
+        if (sym->type == STT_FUNC && strcmp(sym->st_shndx, ".text") == 0){
+            profile_add_symbol(sym->st_name,
+                text_addr + sym->st_value * MAX_INSTRUCTION_CHAR,
+                sym->st_size * MAX_INSTRUCTION_CHAR);
+        }
+    }
+}
+
+
+static void node_name(const profile_node_t *node, char *buf){
+    const profile_symbol_t *sym = find_symbol(node->entry);
+    if (sym != NULL){
+        strcpy(buf, sym->name);
+    }
+    else {
+        sprintf(buf, "0x%lx", node->entry);
+    }
+}
+
+
+/*--------------------------------------*/
+// counts by PC
+
+static profile_pc_t *pc_slot(uint64_t pc){
+    uint64_t i = (pc * 0x9e3779b97f4a7c15ull) & (pc_table_size - 1);
+    while (pc_table[i].pc != 0 && pc_table[i].pc != pc){
+        i = (i + 1) & (pc_table_size - 1);
+    }
+    return &pc_table[i];
+}
+
+static profile_pc_t *pc_record(uint64_t pc){
+
+    if (2 * (pc_table_used + 1) > pc_table_size){
+        profile_pc_t *old = pc_table;
+        uint64_t old_size = pc_table_size;
+
+        pc_table_size = old_size == 0 ? 64 : old_size * 2;
+        pc_table = calloc(pc_table_size, sizeof(profile_pc_t));
+        assert(pc_table != NULL);
+        for (uint64_t i = 0; i < old_size; ++ i){
+            if (old[i].pc != 0){
+                *pc_slot(old[i].pc) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    profile_pc_t *slot = pc_slot(pc);
+    if (slot->pc == 0){
+        slot->pc = pc;
+        pc_table_used ++;
+    }
+    return slot;
+}
+
+
+int profile_pc_count(uint64_t pc, profile_count_t *count){
+    if (pc_table_size == 0 || pc == 0){
+        return 0;
+    }
+    profile_pc_t *slot = pc_slot(pc);
+    if (slot->pc != pc){
+        return 0;
+    }
+    *count = slot->count;
+    return 1;
+}
+
+
+static void add_count(profile_count_t *total, const profile_count_t *count){
+    total->instructions += count->instructions;
+    total->cycles += count->cycles;
+    total->cache_misses += count->cache_misses;
+    total->tlb_misses += count->tlb_misses;
+}
+
+
+int profile_symbol_count(const char *name, profile_count_t *count){
+
+    const profile_symbol_t *sym = NULL;
+    for (uint64_t i = 0; i < num_symbols; ++ i){
+        if (strcmp(symbols[i].name, name) == 0){
+            sym = &symbols[i];
+            break;
+        }
+    }
+    if (sym == NULL){
+        return 0;
+    }
+
+    memset(count, 0, sizeof(profile_count_t));
+    for (uint64_t i = 0; i < pc_table_size; ++ i){
+        if (pc_table[i].pc != 0 && find_symbol(pc_table[i].pc) == sym){
+            add_count(count, &pc_table[i].count);
+        }
+    }
+    return 1;
+}
+
+
+/*--------------------------------------*/
+// calling context tree
+
+static profile_node_t *node_child(profile_node_t *parent, uint64_t entry){
+
+    for (profile_node_t *node = parent->child; node != NULL; node = node->sibling){
+        if (node->entry == entry){
+            return node;
+        }
+    }
+
+    profile_node_t *node = calloc(1, sizeof(profile_node_t));
+    assert(node != NULL);
+    node->entry = entry;
+    node->depth = parent->depth + 1;
+    node->parent = parent;
+    node->sibling = parent->child;
+    parent->child = node;
+    return node;
+}
+
+
+static void free_tree(profile_node_t *node){
+    while (node != NULL){
+        profile_node_t *sibling = node->sibling;
+        free_tree(node->child);
+        free(node);
+        node = sibling;
+    }
+}
+
+
+/*--------------------------------------*/
+
+void profile_default(profile_config_t *config){
+    config->period = DEFAULT_PROFILE_PERIOD;
+}
+
+
+void profile_config(const profile_config_t *config){
+
+    free(symbols);
+    symbols = NULL;
+    num_symbols = 0;
+
+    free(pc_table);
+    pc_table = NULL;
+    pc_table_size = 0;
+    pc_table_used = 0;
+
+    free_tree(root);
+    root = NULL;
+    current = NULL;
+    overflow_calls = 0;
+
+    if (config == NULL){
+        profile_enabled = 0;
+        return;
+    }
+
+    assert(config->period > 0);
+    profile = *config;
+    countdown = profile.period;
+
+    root = calloc(1, sizeof(profile_node_t));
+    assert(root != NULL);
+    profile_enabled = 1;
+}
+
+
+void profile_begin_instruction(){
+    begin_cycles = timing_stats[ACTIVE_CORE].cycles;
+    begin_cache_misses = sram_cache_stats.miss;
+    begin_tlb_misses = mmu_stats.tlb_miss;
+}
+
+
+void profile_end_instruction(uint64_t pc, int op){
+
+    if (current == NULL){
+        // the bottom frame is the function of the first instruction
+        const profile_symbol_t *sym = find_symbol(pc);
+        current = node_child(root, sym != NULL ? sym->addr : pc);
+    }
+
+    countdown --;
+    if (countdown == 0){
+        countdown = profile.period;
+
+        profile_count_t count = {
+            .instructions = profile.period,
+            .cycles = (timing_stats[ACTIVE_CORE].cycles - begin_cycles) * profile.period,
+            .cache_misses = (sram_cache_stats.miss - begin_cache_misses) * profile.period,
+            .tlb_misses = (mmu_stats.tlb_miss - begin_tlb_misses) * profile.period,
+        };
+        add_count(&pc_record(pc)->count, &count);
+        current->instructions += count.instructions;
+        current->cycles += count.cycles;
+    }
+
+    // the instruction belongs to the caller, the next one to the callee
+    // calls past the depth limit stay in the deepest node, their rets must not pop
+    if (op == INST_CALL){
+        if (current->depth < MAX_PROFILE_DEPTH){
+            current = node_child(current, cpu_pc.rip);
+        }
+        else {
+            overflow_calls ++;
+        }
+    }
+    else if (op == INST_RET){
+        if (overflow_calls > 0){
+            overflow_calls --;
+        }
+        else if (current->parent != root){
+            current = current->parent;
+        }
+    }
+}
+
+
+/*--------------------------------------*/
+// output
+
+typedef struct{
+    uint64_t pc;
+    const profile_symbol_t *sym;
+    profile_count_t count;
+} profile_row_t;
+
+static int compare_rows(const void *a, const void *b){
+    const profile_row_t *x = a, *y = b;
+    if (x->count.cycles != y->count.cycles){
+        return x->count.cycles < y->count.cycles ? 1 : -1;
+    }
+    if (x->count.instructions != y->count.instructions){
+        return x->count.instructions < y->count.instructions ? 1 : -1;
+    }
+    return 0;
+}
+
+static void print_row(const char *name, const profile_count_t *count, const profile_count_t *total){
+    printf("%6.2f%%\t%lu cycles\t%lu instructions\t%lu cache misses\t%lu TLB misses\t%s\n",
+        total->cycles == 0 ? 0.0 : 100.0 * count->cycles / total->cycles,
+        count->cycles, count->instructions, count->cache_misses, count->tlb_misses, name);
+}
+
+
+void print_profile(){
+
+    if (profile_enabled == 0){
+        return;
+    }
+
+    // the last row for the PCs out of any symbol
+    profile_row_t *rows = calloc(num_symbols + 1, sizeof(profile_row_t));
+    profile_row_t *pcs = calloc(pc_table_used ? pc_table_used : 1, sizeof(profile_row_t));
+    assert(rows != NULL && pcs != NULL);
+    for (uint64_t i = 0; i < num_symbols; ++ i){
+        rows[i].sym = &symbols[i];
+    }
+
+    profile_count_t total = {0};
+    uint64_t n = 0;
+    for (uint64_t i = 0; i < pc_table_size; ++ i){
+        if (pc_table[i].pc != 0){
+            const profile_symbol_t *sym = find_symbol(pc_table[i].pc);
+            add_count(&rows[sym != NULL ? sym - symbols : num_symbols].count, &pc_table[i].count);
+            add_count(&total, &pc_table[i].count);
+
+            pcs[n].pc = pc_table[i].pc;
+            pcs[n].sym = sym;
+            pcs[n].count = pc_table[i].count;
+            n ++;
+        }
+    }
+
+    printf("flat profile: %lu instructions\t%lu cycles\n", total.instructions, total.cycles);
+    qsort(rows, num_symbols + 1, sizeof(profile_row_t), compare_rows);
+    for (uint64_t i = 0; i < num_symbols + 1; ++ i){
+        if (rows[i].count.instructions > 0){
+            print_row(rows[i].sym != NULL ? rows[i].sym->name : "[unknown]", &rows[i].count, &total);
+        }
+    }
+
+    // the hottest PCs
+    printf("hot PCs:\n");
+    qsort(pcs, n, sizeof(profile_row_t), compare_rows);
+    for (uint64_t i = 0; i < n && i < 10; ++ i){
+        char name[MAX_CHAR_SYMBOL_NAME + 32];
+        sprintf(name, "%lx %s", pcs[i].pc, pcs[i].sym != NULL ? pcs[i].sym->name : "");
+        print_row(name, &pcs[i].count, &total);
+    }
+
+    free(pcs);
+    free(rows);
+}
+
+
+static uint64_t write_node(FILE *fp, const profile_node_t *node, char *path, uint64_t len){
+
+    uint64_t stacks = 0;
+    for (; node != NULL; node = node->sibling){
+        char name[MAX_CHAR_SYMBOL_NAME];
+        node_name(node, name);
+
+        uint64_t n = len;
+        if (n > 0){
+            path[n ++] = ';';
+        }
+        strcpy(&path[n], name);
+        n += strlen(name);
+
+        if (node->instructions > 0){
+            fprintf(fp, "%s %lu\n", path, node->cycles);
+            stacks ++;
+        }
+        stacks += write_node(fp, node->child, path, n);
+        path[len] = '\0';
+    }
+    return stacks;
+}
+
+
+uint64_t profile_write_stacks(const char *path){
+
+    if (root == NULL){
+        return 0;
+    }
+
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL){
+        printf("profile: cannot open %s\n", path);
+        exit(0);
+    }
+
+    char *stack = malloc((MAX_PROFILE_DEPTH + 1) * (MAX_CHAR_SYMBOL_NAME + 1));
+    assert(stack != NULL);
+    stack[0] = '\0';
+    uint64_t stacks = write_node(fp, root->child, stack, 0);
+
+    free(stack);
+    fclose(fp);
+    return stacks;
+}
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../../header/cpu.h"
+#include "../../header/memory.h"
+#include "../../header/common.h"
+#include "../../header/algorithm.h"
+#include "../../header/instruction.h"
+
+
+// sampled simulation in the SimPoint style
+// the CPI of the detailed windows estimates the CPI of the whole run
+// the basic-block vectors are in the format of the SimPoint .bb file:
+//  T:id:count :id:count ...
+// one line for each interval, id of the basic block from 1,
+// count - the instructions executed in that basic block
+
+
+typedef enum{
+    SAMPLE_FAST_FORWARD,
+    SAMPLE_WARMUP,
+    SAMPLE_DETAIL,
+} sample_phase_t;
+
+static sample_config_t sample;
+static int sample_configured = 0;
+
+static sample_phase_t phase = SAMPLE_FAST_FORWARD;
+static uint64_t phase_left = 0;
+// the cycles at the beginning of the detail window
+static uint64_t window_cycles = 0;
+
+// basic-block vectors
+static FILE *bbv_file = NULL;
+// the PC of the first instruction -> id of the basic block
+static hashtable_t *block_ids = NULL;
+// bbv_count[id]: the instructions of the basic block in this interval
+static uint64_t *bbv_count = NULL;
+static uint64_t bbv_count_size = 0;
+// the ids counted in this interval
+static array_t *bbv_touched = NULL;
+static uint64_t interval_left = 0;
+
+// the current basic block
+static int in_block = 0;
+static uint64_t block_pc = 0;
+static uint64_t block_count = 0;
+
+
+void sample_default(sample_config_t *config){
+    config->fast_forward = DEFAULT_SAMPLE_FAST_FORWARD;
+    config->warmup = DEFAULT_SAMPLE_WARMUP;
+    config->detail = DEFAULT_SAMPLE_DETAIL;
+    config->interval = DEFAULT_SAMPLE_INTERVAL;
+    config->bbv_path = DEFAULT_BBV_PATH;
+}
+
+
+void sample_config(const sample_config_t *config){
+
+    sample_finish();
+
+    hashtable_free(block_ids);
+    block_ids = NULL;
+    free(bbv_count);
+    bbv_count = NULL;
+    bbv_count_size = 0;
+    if (bbv_touched != NULL){
+        array_free(bbv_touched);
+        bbv_touched = NULL;
+    }
+    in_block = 0;
+    block_count = 0;
+
+    sample = *config;
+    sample_configured = 1;
+    memset(&sample_stats, 0, sizeof(sample_stats_t));
+
+    phase = SAMPLE_FAST_FORWARD;
+    phase_left = 0;
+
+    if (sample.interval > 0){
+        block_ids = hashtable_construct(16);
+        bbv_touched = array_construct(64);
+        interval_left = sample.interval;
+
+        if (sample.bbv_path != NULL){
+            bbv_file = fopen(sample.bbv_path, "w");
+            if (bbv_file == NULL){
+                printf("sample: cannot open %s\n", sample.bbv_path);
+                exit(0);
+            }
+        }
+    }
+}
+
+
+static void check_sample(){
+    if (sample_configured == 0){
+        sample_config_t config;
+        sample_default(&config);
+        sample_config(&config);
+    }
+}
+
+
+/*--------------------------------------*/
+// basic-block vectors
+
+static uint64_t block_id(uint64_t pc){
+
+    char key[32];
+    sprintf(key, "%lx", pc);
+
+    uint64_t id;
+    if (hashtable_get(block_ids, key, &id) == 1){
+        return id;
+    }
+
+    id = ++ sample_stats.basic_blocks;
+    block_ids = hashtable_insert(block_ids, key, id);
+
+    if (id >= bbv_count_size){
+        uint64_t size = bbv_count_size == 0 ? 64 : bbv_count_size * 2;
+        bbv_count = realloc(bbv_count, size * sizeof(uint64_t));
+        assert(bbv_count != NULL);
+        memset(bbv_count + bbv_count_size, 0, (size - bbv_count_size) * sizeof(uint64_t));
+        bbv_count_size = size;
+    }
+    return id;
+}
+
+static void count_block(){
+
+    if (block_count == 0){
+        return;
+    }
+    uint64_t id = block_id(block_pc);
+    if (bbv_count[id] == 0){
+        bbv_touched = array_insert(bbv_touched, id);
+    }
+    bbv_count[id] += block_count;
+    block_count = 0;
+}
+
+static void write_vector(){
+
+    if (bbv_touched->count == 0){
+        return;
+    }
+
+    if (bbv_file != NULL){
+        fprintf(bbv_file, "T");
+        for (int i = 0; i < bbv_touched->count; ++ i){
+            uint64_t id = bbv_touched->table[i];
+            fprintf(bbv_file, ":%lu:%lu ", id, bbv_count[id]);
+        }
+        fprintf(bbv_file, "\n");
+    }
+
+    for (int i = 0; i < bbv_touched->count; ++ i){
+        bbv_count[bbv_touched->table[i]] = 0;
+    }
+    bbv_touched->count = 0;
+    sample_stats.intervals ++;
+}
+
+
+void sample_instruction(uint64_t pc, int op){
+
+    if (sample_configured == 0 || sample.interval == 0){
+        return;
+    }
+
+    if (in_block == 0){
+        in_block = 1;
+        block_pc = pc;
+    }
+    block_count ++;
+
+    if (op == INST_JNE || op == INST_JMP || op == INST_CALL || op == INST_RET){
+        // the end of the basic block
+        count_block();
+        in_block = 0;
+    }
+
+    interval_left --;
+    if (interval_left == 0){
+        // the rest of the block is counted in the next interval with the same id
+        count_block();
+        write_vector();
+        interval_left = sample.interval;
+    }
+}
+
+
+void sample_finish(){
+
+    if (sample_configured == 0){
+        return;
+    }
+
+    if (phase == SAMPLE_DETAIL){
+        // the partial window
+        sample_stats.detail_cycles += timing_stats[ACTIVE_CORE].cycles - window_cycles;
+        window_cycles = timing_stats[ACTIVE_CORE].cycles;
+    }
+
+    if (bbv_touched != NULL){
+        count_block();
+        write_vector();
+        interval_left = sample.interval;
+    }
+    if (bbv_file != NULL){
+        fclose(bbv_file);
+        bbv_file = NULL;
+    }
+
+    // back to the detailed simulation
+    cpu_fast_forward = 0;
+}
+
+
+/*--------------------------------------*/
+// phases
+
+static void enter_phase(sample_phase_t next){
+
+    if (phase == SAMPLE_DETAIL && next != SAMPLE_DETAIL){
+        sample_stats.detail_cycles += timing_stats[ACTIVE_CORE].cycles - window_cycles;
+        sample_stats.windows ++;
+    }
+
+    switch (next){
+        case SAMPLE_FAST_FORWARD:
+#ifdef USE_SRAM_CACHE
+            // the fast-forward accesses the DRAM directly
+            sram_cache_flush();
+#endif
+            cpu_fast_forward = 1;
+            phase_left = sample.fast_forward;
+            break;
+        case SAMPLE_WARMUP:
+            cpu_fast_forward = 0;
+            phase_left = sample.warmup;
+            break;
+        case SAMPLE_DETAIL:
+            cpu_fast_forward = 0;
+            phase_left = sample.detail;
+            window_cycles = timing_stats[ACTIVE_CORE].cycles;
+            break;
+    }
+    phase = next;
+}
+
+
+// the empty phases are skipped
+static void next_phase(){
+    while (phase_left == 0){
+        enter_phase(phase == SAMPLE_DETAIL ? SAMPLE_FAST_FORWARD : phase + 1);
+    }
+}
+
+
+void sample_run(uint64_t num_instructions){
+
+    check_sample();
+    assert(sample.detail > 0);
+
+    if (sample_stats.instructions == 0){
+        enter_phase(SAMPLE_FAST_FORWARD);
+        next_phase();
+    }
+    else if (phase == SAMPLE_FAST_FORWARD){
+        // continue after sample_finish
+#ifdef USE_SRAM_CACHE
+        sram_cache_flush();
+#endif
+        cpu_fast_forward = 1;
+    }
+
+    for (uint64_t i = 0; i < num_instructions; ++ i){
+
+        instruction_cycle();
+        phase_left --;
+
+        sample_stats.instructions ++;
+        if (phase == SAMPLE_FAST_FORWARD){
+            sample_stats.fast_forward ++;
+        }
+        else if (phase == SAMPLE_WARMUP){
+            sample_stats.warmup ++;
+        }
+        else {
+            sample_stats.detail ++;
+        }
+
+        // the window is closed as soon as it is complete
+        next_phase();
+    }
+}
+
+
+void print_sample_stats(){
+
+    double cpi = sample_stats.detail == 0 ? 0.0 : (double)sample_stats.detail_cycles / sample_stats.detail;
+
+    printf("sampling: %lu instructions\tfast-forward %lu\twarm-up %lu\tdetail %lu in %lu windows\n",
+        sample_stats.instructions, sample_stats.fast_forward, sample_stats.warmup,
+        sample_stats.detail, sample_stats.windows);
+    printf("estimated CPI %.2f\testimated cycles %.0f\n", cpi, cpi * sample_stats.instructions);
+    if (sample.interval > 0){
+        printf("basic-block vectors: %lu intervals of %lu instructions\t%lu basic blocks\n",
+            sample_stats.intervals, sample.interval, sample_stats.basic_blocks);
+    }
+}
@@ -84,6 +84,7 @@ uint8_t sram_cache_read(uint64_t paddr_value){
         if (line->state != CACHE_LINE_INVALID && line->tag == paddr.ct){
 
             // cache hit
+            sram_cache_stats.hit ++;
             // update LRU time
             line->time = 0;
             // find the byte
@@ -92,6 +93,8 @@ uint8_t sram_cache_read(uint64_t paddr_value){
     }
 
     // cache miss: load from memory
+    sram_cache_stats.miss ++;
+    TRACE_EVENT(TRACE_CACHE_MISS, 0, paddr_value, 0, 0);
 
 
     //try to find one free cache line
@@ -113,7 +116,14 @@ uint8_t sram_cache_read(uint64_t paddr_value){
     // no free cache line, use LRU policy
     if (victim->state == CACHE_LINE_DIRTY){
         // write back the dirty line to dram
-        bus_write_cacheline(paddr.paddr_value, victim->block);
+        // to the address of the victim, not the requested address
+        address_t victim_addr = {
+            .address_value = 0,
+        };
+        victim_addr.ct = victim->tag;
+        victim_addr.ci = paddr.ci;
+        bus_write_cacheline(victim_addr.paddr_value, victim->block);
+        sram_cache_stats.writeback ++;
 
         // update state
         victim->state = CACHE_LINE_INVALID;
@@ -173,6 +183,7 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
         if (line->state != CACHE_LINE_INVALID && line->tag == paddr.ct){
 
             // cache hit
+            sram_cache_stats.hit ++;
 
             // update LRU time
             line->time = 0;
@@ -187,6 +198,8 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
     }
 
     // cache miss: load from memory
+    sram_cache_stats.miss ++;
+    TRACE_EVENT(TRACE_CACHE_MISS, 0, paddr_value, 0, TRACE_FLAG_WRITE);
 
     //write-allocate
 
@@ -212,7 +225,14 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
     // no free cache line, use LRU policy
     if (victim->state == CACHE_LINE_DIRTY){
         // write back the dirty line to dram
-        bus_write_cacheline(paddr.paddr_value, victim->block);
+        // to the address of the victim, not the requested address
+        address_t victim_addr = {
+            .address_value = 0,
+        };
+        victim_addr.ct = victim->tag;
+        victim_addr.ci = paddr.ci;
+        bus_write_cacheline(victim_addr.paddr_value, victim->block);
+        sram_cache_stats.writeback ++;
 
         // update state
         victim->state = CACHE_LINE_INVALID;
@@ -240,6 +260,58 @@ void sram_cache_write(uint64_t paddr_value, uint8_t data){
 
 }
 
+void sram_cache_flush_page(uint64_t ppn){
+
+    for (uint64_t offset = 0; offset < PAGE_SIZE; offset += (1 << SRAM_CACHE_OFFSET_LENGTH)){
+
+        address_t paddr = {
+            .paddr_value = (ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + offset,
+        };
+        sram_cacheset_t *set = &cache.sets[paddr.ci];
+
+        for (int i = 0; i < NUM_CACHE_LINE_PER_SET; ++i){
+            sram_cacheline_t *line = &(set->lines[i]);
+
+            if (line->state != CACHE_LINE_INVALID && line->tag == paddr.ct){
+                if (line->state == CACHE_LINE_DIRTY){
+                    bus_write_cacheline(paddr.paddr_value, line->block);
+                    sram_cache_stats.writeback ++;
+                }
+                line->state = CACHE_LINE_INVALID;
+            }
+        }
+    }
+}
+
+void sram_cache_flush(){
+
+    for (int i = 0; i < (1 << SRAM_CACHE_INDEX_LENGTH); ++ i){
+        for (int j = 0; j < NUM_CACHE_LINE_PER_SET; ++ j){
+            sram_cacheline_t *line = &cache.sets[i].lines[j];
+
+            if (line->state == CACHE_LINE_DIRTY){
+                address_t paddr = {
+                    .ct = line->tag,
+                    .ci = i,
+                    .co = 0,
+                };
+                bus_write_cacheline(paddr.paddr_value, line->block);
+                sram_cache_stats.writeback ++;
+            }
+            line->state = CACHE_LINE_INVALID;
+        }
+    }
+}
+
+void sram_save_state(FILE *fp){
+    checkpoint_write(fp, &cache, sizeof(cache));
+}
+
+
+void sram_load_state(FILE *fp){
+    checkpoint_read(fp, &cache, sizeof(cache));
+}
+
 void print_cache()
 {
     for (int i = 0; i < (1 << SRAM_CACHE_INDEX_LENGTH); ++ i)
@@ -276,4 +348,10 @@ void print_cache()
     }
 }
 
-
+void print_cache_stats()
+{
+    uint64_t total = sram_cache_stats.hit + sram_cache_stats.miss;
+    printf("SRAM cache: hit %lu, miss %lu, writeback %lu, hit rate %.2f%%\n",
+        sram_cache_stats.hit, sram_cache_stats.miss, sram_cache_stats.writeback,
+        total == 0 ? 0.0 : 100.0 * sram_cache_stats.hit / total);
+}
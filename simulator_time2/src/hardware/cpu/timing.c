@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../../header/cpu.h"
+#include "../../header/memory.h"
+#include "../../header/common.h"
+#include "../../header/instruction.h"
+
+
+// the latencies of the memory path are not passed through the call chain
+// the counters of MMU, SRAM cache, DRAM and page fault are sampled
+// before and after each instruction, the differences are charged to it
+
+static timing_config_t timing;
+static int timing_configured = 0;
+
+// the counters at the beginning of the current instruction
+typedef struct{
+    uint64_t tlb_miss;
+    uint64_t page_walk_ref;
+    uint64_t sram_miss;
+    uint64_t dram_latency;
+    uint64_t dram_untimed;
+    uint64_t page_fault;
+    uint64_t swap_in;
+} timing_sample_t;
+
+static timing_sample_t sample;
+// the rip of the current instruction
+static uint64_t instruction_pc;
+
+
+void timing_default(timing_config_t *config){
+
+    for (int i = 0; i < NUM_INSTRTYPE; ++ i){
+        config->op_latency[i] = DEFAULT_OP_LATENCY;
+    }
+    config->op_latency[INST_CALL] = DEFAULT_BRANCH_LATENCY;
+    config->op_latency[INST_RET] = DEFAULT_BRANCH_LATENCY;
+    config->op_latency[INST_JNE] = DEFAULT_BRANCH_LATENCY;
+    config->op_latency[INST_JMP] = DEFAULT_BRANCH_LATENCY;
+
+    config->tlb_miss = DEFAULT_TLB_MISS_LATENCY;
+    config->page_walk_ref = DEFAULT_PTE_LATENCY;
+    config->sram_miss = DEFAULT_SRAM_MISS_LATENCY;
+    config->dram_access = DEFAULT_DRAM_ACCESS_LATENCY;
+    config->page_fault = DEFAULT_PAGE_FAULT_LATENCY;
+    config->swap_in = DEFAULT_SWAP_IN_LATENCY;
+    config->branch_mispredict = DEFAULT_MISPREDICT_LATENCY;
+}
+
+
+void timing_config(const timing_config_t *config){
+    timing = *config;
+    timing_configured = 1;
+    memset(&timing_stats, 0, sizeof(timing_stats));
+}
+
+
+static void check_timing(){
+    if (timing_configured == 0){
+        timing_default(&timing);
+        timing_configured = 1;
+    }
+}
+
+
+static void take_sample(timing_sample_t *s){
+    s->tlb_miss = mmu_stats.tlb_miss;
+    s->page_walk_ref = mmu_stats.page_walk_ref;
+    s->sram_miss = sram_cache_stats.miss;
+    s->dram_latency = dram_stats.latency;
+    s->dram_untimed = dram_stats.untimed;
+    s->page_fault = pagefault_stats.page_fault;
+    s->swap_in = swap_stats.page_in;
+}
+
+
+void timing_begin_instruction(){
+    check_timing();
+    take_sample(&sample);
+    instruction_pc = cpu_pc.rip;
+}
+
+
+void timing_end_instruction(const inst_t *inst){
+
+    int op = inst->op;
+    assert(0 <= op && op < NUM_INSTRTYPE);
+    assert(ACTIVE_CORE < NUM_CORES);
+
+    timing_sample_t now;
+    take_sample(&now);
+
+    // the statistics may be reset inside the instruction
+    uint64_t tlb_miss = now.tlb_miss >= sample.tlb_miss ? now.tlb_miss - sample.tlb_miss : 0;
+    uint64_t pte = now.page_walk_ref >= sample.page_walk_ref ? now.page_walk_ref - sample.page_walk_ref : 0;
+    uint64_t sram_miss = now.sram_miss >= sample.sram_miss ? now.sram_miss - sample.sram_miss : 0;
+    uint64_t dram = now.dram_latency >= sample.dram_latency ? now.dram_latency - sample.dram_latency : 0;
+    uint64_t untimed = now.dram_untimed >= sample.dram_untimed ? now.dram_untimed - sample.dram_untimed : 0;
+    uint64_t fault = now.page_fault >= sample.page_fault ? now.page_fault - sample.page_fault : 0;
+    uint64_t swap_in = now.swap_in >= sample.swap_in ? now.swap_in - sample.swap_in : 0;
+
+    timing_stats_t *ts = &timing_stats[ACTIVE_CORE];
+
+    uint64_t tlb_cycles = tlb_miss * timing.tlb_miss + pte * timing.page_walk_ref;
+    uint64_t cache_cycles = sram_miss * timing.sram_miss;
+    dram += untimed * timing.dram_access;
+    uint64_t fault_cycles = fault * timing.page_fault + swap_in * timing.swap_in;
+    uint64_t branch_cycles = 0;
+    if (bpred_branch(op, instruction_pc, cpu_pc.rip) == 1){
+        branch_cycles = timing.branch_mispredict;
+    }
+    uint64_t cycles = timing.op_latency[op] + tlb_cycles + cache_cycles + dram + fault_cycles + branch_cycles;
+
+    ts->instructions ++;
+    ts->cycles += cycles;
+    ts->op_count[op] ++;
+    ts->op_cycles[op] += cycles;
+    ts->tlb_cycles += tlb_cycles;
+    ts->cache_cycles += cache_cycles;
+    ts->dram_cycles += dram;
+    ts->fault_cycles += fault_cycles;
+    ts->branch_cycles += branch_cycles;
+
+    ooo_instruction(inst, timing.op_latency[op], tlb_cycles + cache_cycles + dram, fault_cycles, branch_cycles);
+}
+
+
+void print_timing_stats(){
+
+    static const char *op_names[] = {
+        "mov", "push", "pop", "leave", "call", "ret", "add", "sub", "cmp", "jne", "jmp",
+    };
+
+    for (int c = 0; c < NUM_CORES; ++ c){
+        timing_stats_t *ts = &timing_stats[c];
+        printf("core %d: %lu instructions\t%lu cycles\tCPI %.2f\n", c,
+            ts->instructions, ts->cycles,
+            ts->instructions == 0 ? 0.0 : (double)ts->cycles / ts->instructions);
+        printf("stall cycles: TLB %lu\tcache %lu\tDRAM %lu\tpage fault %lu\tbranch mispredict %lu\n",
+            ts->tlb_cycles, ts->cache_cycles, ts->dram_cycles, ts->fault_cycles, ts->branch_cycles);
+
+        for (int i = 0; i < NUM_INSTRTYPE && i < sizeof(op_names) / sizeof(op_names[0]); ++ i){
+            if (ts->op_count[i] != 0){
+                printf("\t%-6s %lu\t%lu cycles\tCPI %.2f\n", op_names[i],
+                    ts->op_count[i], ts->op_cycles[i], (double)ts->op_cycles[i] / ts->op_count[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "../../header/cpu.h"
+#include "../../header/common.h"
+
+
+// binary execution trace
+// each ring has one producer - the core, and one consumer - the drain thread,
+// so the head and tail indexes are enough without any lock:
+//  the core writes the record, then publishes the head with release
+//  the drain thread copies the record, then publishes the tail with release
+// when the ring is full the core waits for the drain thread, no record is dropped
+
+
+#define TRACE_MAGIC     "CSAPPTRC"
+#define TRACE_VERSION   (1)
+
+typedef struct{
+    // written by the core only
+    uint64_t head;
+    uint64_t time;
+    uint64_t pc;
+    // keep the tail in another cache line: no false sharing with the core
+    uint8_t pad[64 - 3 * sizeof(uint64_t)];
+    // written by the drain thread only
+    uint64_t tail;
+    trace_record_t *records;
+} __attribute__((aligned(64))) trace_ring_t;
+
+static trace_ring_t rings[NUM_CORES];
+
+static FILE *trace_file = NULL;
+static pthread_t drain_tid;
+static int drain_running = 0;
+
+// the chunk being filled by the drain thread
+static trace_record_t chunk[TRACE_CHUNK_RECORDS];
+static uint64_t chunk_count = 0;
+
+
+static void write_chunk(){
+
+    if (chunk_count == 0){
+        return;
+    }
+
+    uint32_t raw_size = chunk_count * sizeof(trace_record_t);
+    uint8_t buf[TRACE_CHUNK_RECORDS * sizeof(trace_record_t)];
+
+    // the compressed data must be smaller: stored_size == raw_size means stored raw
+    uint32_t stored_size = lz_compress((uint8_t *)chunk, raw_size, buf, raw_size - 1);
+    const uint8_t *data = buf;
+    if (stored_size == 0){
+        // not compressible
+        stored_size = raw_size;
+        data = (uint8_t *)chunk;
+    }
+
+    if (fwrite(&raw_size, sizeof(uint32_t), 1, trace_file) != 1 ||
+        fwrite(&stored_size, sizeof(uint32_t), 1, trace_file) != 1 ||
+        fwrite(data, 1, stored_size, trace_file) != stored_size){
+        printf("trace: write failed\n");
+        exit(0);
+    }
+
+    trace_stats.chunks ++;
+    trace_stats.raw_bytes += raw_size;
+    trace_stats.file_bytes += 2 * sizeof(uint32_t) + stored_size;
+    chunk_count = 0;
+}
+
+
+// return the number of records drained
+static uint64_t drain_rings(){
+
+    uint64_t drained = 0;
+    for (int c = 0; c < NUM_CORES; ++ c){
+        trace_ring_t *ring = &rings[c];
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+
+        while (tail < head){
+            chunk[chunk_count ++] = ring->records[tail & (TRACE_RING_SIZE - 1)];
+            tail ++;
+            drained ++;
+            if (chunk_count == TRACE_CHUNK_RECORDS){
+                // free the slots before the slow write
+                __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+                write_chunk();
+            }
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return drained;
+}
+
+
+static void *drain_thread(void *arg){
+
+    while (1){
+        // read the flag before draining: all records of a stopped core are visible
+        int running = __atomic_load_n(&drain_running, __ATOMIC_ACQUIRE);
+        if (drain_rings() == 0){
+            if (running == 0){
+                break;
+            }
+            usleep(100);
+        }
+    }
+    write_chunk();
+    return NULL;
+}
+
+
+void trace_start(const char *path){
+
+    trace_stop();
+
+    trace_file = fopen(path, "wb");
+    if (trace_file == NULL){
+        printf("trace: cannot open %s\n", path);
+        exit(0);
+    }
+    uint32_t header[3] = {TRACE_VERSION, sizeof(trace_record_t), NUM_CORES};
+    fwrite(TRACE_MAGIC, 1, 8, trace_file);
+    fwrite(header, sizeof(uint32_t), 3, trace_file);
+
+    memset(&trace_stats, 0, sizeof(trace_stats_t));
+    trace_stats.file_bytes = 8 + sizeof(header);
+
+    for (int c = 0; c < NUM_CORES; ++ c){
+        trace_ring_t *ring = &rings[c];
+        if (ring->records == NULL){
+            ring->records = malloc(TRACE_RING_SIZE * sizeof(trace_record_t));
+            assert(ring->records != NULL);
+        }
+        ring->head = 0;
+        ring->tail = 0;
+        ring->time = 0;
+        ring->pc = 0;
+    }
+    chunk_count = 0;
+
+    drain_running = 1;
+    if (pthread_create(&drain_tid, NULL, drain_thread, NULL) != 0){
+        printf("trace: cannot create the drain thread\n");
+        exit(0);
+    }
+    trace_enabled = 1;
+}
+
+
+void trace_stop(){
+
+    if (trace_file == NULL){
+        return;
+    }
+    trace_enabled = 0;
+
+    __atomic_store_n(&drain_running, 0, __ATOMIC_RELEASE);
+    pthread_join(drain_tid, NULL);
+
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+
+void trace_begin_instruction(uint64_t pc){
+    trace_ring_t *ring = &rings[ACTIVE_CORE];
+    ring->time ++;
+    ring->pc = pc;
+}
+
+
+void trace_emit(int type, uint64_t vaddr, uint64_t paddr, int op, int flags){
+
+    trace_ring_t *ring = &rings[ACTIVE_CORE];
+    uint64_t head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE){
+        trace_stats.stalls ++;
+        while (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_SIZE){
+            sched_yield();
+        }
+    }
+
+    trace_record_t *record = &ring->records[head & (TRACE_RING_SIZE - 1)];
+    record->time = ring->time;
+    record->pc = ring->pc;
+    record->vaddr = vaddr;
+    record->paddr = paddr;
+    record->type = type;
+    record->core = ACTIVE_CORE;
+    record->op = op;
+    record->flags = flags;
+    record->reserved = 0;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    trace_stats.records ++;
+}
+
+
+void print_trace_stats(){
+    printf("trace: %lu records in %lu chunks\tstalls %lu\t%lu bytes -> %lu bytes\tratio %.2f\n",
+        trace_stats.records, trace_stats.chunks, trace_stats.stalls,
+        trace_stats.raw_bytes, trace_stats.file_bytes,
+        trace_stats.file_bytes == 0 ? 0.0 : (double)trace_stats.raw_bytes / trace_stats.file_bytes);
+}
+
+
+/*--------------------------------------*/
+// reader
+
+int trace_reader_open(trace_reader_t *reader, const char *path){
+
+    memset(reader, 0, sizeof(trace_reader_t));
+
+    FILE *fp = fopen(path, "rb");
+    char magic[8];
+    uint32_t header[3];
+    if (fp == NULL){
+        return 0;
+    }
+    if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0 ||
+        fread(header, sizeof(uint32_t), 3, fp) != 3 ||
+        header[0] != TRACE_VERSION || header[1] != sizeof(trace_record_t)){
+        fclose(fp);
+        return 0;
+    }
+
+    reader->fp = fp;
+    reader->num_cores = header[2];
+    reader->chunk = malloc(TRACE_CHUNK_RECORDS * sizeof(trace_record_t));
+    assert(reader->chunk != NULL);
+    return 1;
+}
+
+
+static int read_chunk(trace_reader_t *reader){
+
+    uint32_t raw_size, stored_size;
+    if (fread(&raw_size, sizeof(uint32_t), 1, reader->fp) != 1 ||
+        fread(&stored_size, sizeof(uint32_t), 1, reader->fp) != 1){
+        return 0;
+    }
+
+    uint64_t capacity = TRACE_CHUNK_RECORDS * sizeof(trace_record_t);
+    if (raw_size == 0 || raw_size > capacity || raw_size % sizeof(trace_record_t) != 0 || stored_size > raw_size){
+        printf("trace: bad chunk\n");
+        return 0;
+    }
+
+    uint8_t buf[TRACE_CHUNK_RECORDS * sizeof(trace_record_t)];
+    if (fread(buf, 1, stored_size, reader->fp) != stored_size){
+        printf("trace: truncated chunk\n");
+        return 0;
+    }
+
+    if (stored_size == raw_size){
+        memcpy(reader->chunk, buf, raw_size);
+    }
+    else if (lz_decompress(buf, stored_size, (uint8_t *)reader->chunk, capacity) != raw_size){
+        printf("trace: bad chunk\n");
+        return 0;
+    }
+
+    reader->num_records = raw_size / sizeof(trace_record_t);
+    reader->next = 0;
+    return 1;
+}
+
+
+int trace_reader_next(trace_reader_t *reader, trace_record_t *record){
+    if (reader->next == reader->num_records && read_chunk(reader) == 0){
+        return 0;
+    }
+    *record = reader->chunk[reader->next ++];
+    return 1;
+}
+
+
+void trace_reader_close(trace_reader_t *reader){
+    if (reader->fp != NULL){
+        fclose(reader->fp);
+    }
+    free(reader->chunk);
+    memset(reader, 0, sizeof(trace_reader_t));
+}
+
+
+static const char *op_names[] = {
+    "mov", "push", "pop", "leave", "call", "ret", "add", "sub", "cmp", "jne", "jmp",
+};
+
+static const char *type_names[NUM_TRACE_TYPE] = {
+    "inst", "fetch", "load", "store", "cache_miss", "page_fault",
+};
+
+
+static const char *op_name(int op){
+    if (op < sizeof(op_names) / sizeof(op_names[0])){
+        return op_names[op];
+    }
+    return "?";
+}
+
+
+void trace_print_text(FILE *fp, const trace_record_t *record){
+
+    if (record->type >= NUM_TRACE_TYPE){
+        fprintf(fp, "%lu\tcore %d\tunknown type %d\n", record->time, record->core, record->type);
+        return;
+    }
+
+    fprintf(fp, "%lu\tcore %d\t%-10s\tpc %lx", record->time, record->core,
+        type_names[record->type], record->pc);
+    if (record->type == TRACE_INSTRUCTION){
+        fprintf(fp, "\t%s\n", op_name(record->op));
+        return;
+    }
+    if (record->type != TRACE_CACHE_MISS){
+        fprintf(fp, "\tvaddr %lx", record->vaddr);
+    }
+    fprintf(fp, "\tpaddr %lx", record->paddr);
+    if (record->flags & TRACE_FLAG_TLB_MISS){
+        fprintf(fp, "\ttlb miss");
+    }
+    if (record->flags & TRACE_FLAG_WRITE){
+        fprintf(fp, "\twrite");
+    }
+    fprintf(fp, "\n");
+}
+
+
+// the instruction count is the timestamp: one instruction, one microsecond
+void trace_print_json(FILE *fp, const trace_record_t *record, int first){
+
+    if (first == 0){
+        fprintf(fp, ",\n");
+    }
+
+    if (record->type == TRACE_INSTRUCTION){
+        fprintf(fp, "{\"name\":\"%s\",\"cat\":\"inst\",\"ph\":\"X\",\"ts\":%lu,\"dur\":1,"
+            "\"pid\":0,\"tid\":%d,\"args\":{\"pc\":\"0x%lx\"}}",
+            op_name(record->op), record->time, record->core, record->pc);
+        return;
+    }
+
+    fprintf(fp, "{\"name\":\"%s\",\"cat\":\"mem\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lu,"
+        "\"pid\":0,\"tid\":%d,\"args\":{\"pc\":\"0x%lx\",\"vaddr\":\"0x%lx\",\"paddr\":\"0x%lx\","
+        "\"tlb_miss\":%d,\"write\":%d}}",
+        record->type < NUM_TRACE_TYPE ? type_names[record->type] : "unknown",
+        record->time, record->core, record->pc, record->vaddr, record->paddr,
+        (record->flags & TRACE_FLAG_TLB_MISS) != 0, (record->flags & TRACE_FLAG_WRITE) != 0);
+}
@@ -1,6 +1,8 @@
 // DRAM : Dynamic Random Access Memory
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/mman.h>
 #include "../../header/cpu.h"
 #include "../../header/memory.h"
 #include "../../header/common.h"
@@ -8,10 +10,155 @@
 
 uint8_t sram_cache_read(uint64_t paddr);
 void sram_cache_write(uint64_t paddr, uint8_t data);
+static dram_access_t dram_access(uint64_t paddr);
 
 // #define SRAM_CACHE_SETTING 0  //  开关cashe功能，cache功能以后写
 
 
+void physical_memory_init(uint64_t size){
+
+    assert(size > 0 && size <= (1ul << PHYSICAL_ADDRESS_LENGTH));
+    size = (size + PAGE_SIZE - 1) & ~((uint64_t)PAGE_SIZE - 1);
+
+    if (pm != NULL){
+#ifdef USE_SRAM_CACHE
+        // the cached lines belong to the old memory: written back before it is gone
+        sram_cache_flush();
+#endif
+        munmap(pm, physical_memory_size);
+    }
+
+    // demand paged by the host: reads of the untouched pages see zero
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED){
+        printf("DRAM: cannot map %lu bytes of physical memory\n", size);
+        exit(0);
+    }
+
+    pm = addr;
+    physical_memory_size = size;
+}
+
+
+void physical_memory_map_file(int fd, uint64_t offset, uint64_t size){
+
+    assert(size > 0 && size % PAGE_SIZE == 0);
+
+    if (pm != NULL){
+        munmap(pm, physical_memory_size);
+    }
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, fd, offset);
+    if (addr == MAP_FAILED){
+        printf("DRAM: cannot map %lu bytes of physical memory from file\n", size);
+        exit(0);
+    }
+
+    pm = addr;
+    physical_memory_size = size;
+}
+
+
+static inline void check_physical_memory(){
+    if (pm == NULL){
+        physical_memory_init(PHYSICAL_MEMORY_SPACE);
+    }
+}
+
+
+// raw DRAM access of size bytes, little-endian
+// on the little-endian host the fixed-size memcpy is one unaligned load or store
+static inline uint64_t load_le(uint64_t paddr, int size){
+    assert(paddr + size <= physical_memory_size);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t val = 0;
+    memcpy(&val, &pm[paddr], size);
+    return val;
+#else
+    uint64_t val = 0;
+    for (int i = 0; i < size; ++ i){
+        val |= ((uint64_t)pm[paddr + i]) << (i * 8);
+    }
+    return val;
+#endif
+}
+
+
+static inline void store_le(uint64_t paddr, uint64_t data, int size){
+    assert(paddr + size <= physical_memory_size);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&pm[paddr], &data, size);
+#else
+    for (int i = 0; i < size; ++ i){
+        pm[paddr + i] = (data >> (i * 8)) & 0xff;
+    }
+#endif
+}
+
+
+uint8_t dram_read8(uint64_t paddr){
+    check_physical_memory();
+    return load_le(paddr, 1);
+}
+
+uint16_t dram_read16(uint64_t paddr){
+    check_physical_memory();
+    return load_le(paddr, 2);
+}
+
+uint32_t dram_read32(uint64_t paddr){
+    check_physical_memory();
+    return load_le(paddr, 4);
+}
+
+uint64_t dram_read64(uint64_t paddr){
+    check_physical_memory();
+    return load_le(paddr, 8);
+}
+
+void dram_write8(uint64_t paddr, uint8_t data){
+    check_physical_memory();
+    store_le(paddr, data, 1);
+}
+
+void dram_write16(uint64_t paddr, uint16_t data){
+    check_physical_memory();
+    store_le(paddr, data, 2);
+}
+
+void dram_write32(uint64_t paddr, uint32_t data){
+    check_physical_memory();
+    store_le(paddr, data, 4);
+}
+
+void dram_write64(uint64_t paddr, uint64_t data){
+    check_physical_memory();
+    store_le(paddr, data, 8);
+}
+
+
+void dram_read(uint64_t paddr, void *buf, uint64_t size){
+    check_physical_memory();
+    assert(paddr + size <= physical_memory_size);
+    memcpy(buf, &pm[paddr], size);
+}
+
+
+void dram_write(uint64_t paddr, const void *buf, uint64_t size){
+    check_physical_memory();
+    assert(paddr + size <= physical_memory_size);
+    memcpy(&pm[paddr], buf, size);
+}
+
+
+void dram_fill(uint64_t paddr, uint8_t value, uint64_t size){
+    check_physical_memory();
+    assert(paddr + size <= physical_memory_size);
+    memset(&pm[paddr], value, size);
+}
+
+
 /*
     Be careful with the x86 little endian integer encoding
     e.g. write 0x00007fd357a02ae0 to cache, the memory lapping should be:
@@ -22,29 +169,31 @@ void sram_cache_write(uint64_t paddr, uint8_t data);
 uint64_t cpu_read64bits_dram(uint64_t paddr){
 
     uint64_t val = 0x0;
+    check_physical_memory();
 #ifdef USE_SRAM_CACHE
+    if (cpu_fast_forward == 1){
+        // the cache is flushed before the fast-forward
+        return load_le(paddr, 8);
+    }
     
     //try to load uint64_t from SRAM cache
     // little-endian
     
     
     for (int i = 0; i < 8; ++i){
-        val += (sram_cache_read(paddr + i) << (i * 8));
+        val += (((uint64_t)sram_cache_read(paddr + i)) << (i * 8));
     }
     
 #else
         
     // read from DRAM directly
     // little-endian
-
-    val += (((uint64_t)pm[paddr + 0]) << 0);
-    val += (((uint64_t)pm[paddr + 1]) << 8);
-    val += (((uint64_t)pm[paddr + 2]) << 16);
-    val += (((uint64_t)pm[paddr + 3]) << 24);
-    val += (((uint64_t)pm[paddr + 4]) << 32);
-    val += (((uint64_t)pm[paddr + 5]) << 40);
-    val += (((uint64_t)pm[paddr + 6]) << 48);
-    val += (((uint64_t)pm[paddr + 7]) << 56);
+    val = load_le(paddr, 8);
+    if (cpu_fast_forward == 0){
+        // no cache in between: each access is charged as a DRAM access
+        dram_stats.read ++;
+        dram_access(paddr);
+    }
 #endif
     
     return val;
@@ -55,7 +204,12 @@ uint64_t cpu_read64bits_dram(uint64_t paddr){
 
 void cpu_write64bits_dram(uint64_t paddr, uint64_t data){
 
+    check_physical_memory();
 #ifdef USE_SRAM_CACHE
+    if (cpu_fast_forward == 1){
+        store_le(paddr, data, 8);
+        return;
+    }
         
     // try to write uint64_t to SRAM cache
     // little-endian
@@ -68,14 +222,11 @@ void cpu_write64bits_dram(uint64_t paddr, uint64_t data){
 #else
     // write to DRAM diretly
     // little-endian
-    pm[paddr + 0] = (data >> 0) & 0xff;
-    pm[paddr + 1] = (data >> 8) & 0xff;
-    pm[paddr + 2] = (data >> 16) & 0xff;
-    pm[paddr + 3] = (data >> 24) & 0xff;
-    pm[paddr + 4] = (data >> 32) & 0xff;
-    pm[paddr + 5] = (data >> 40) & 0xff;
-    pm[paddr + 6] = (data >> 48) & 0xff;
-    pm[paddr + 7] = (data >> 56) & 0xff;
+    store_le(paddr, data, 8);
+    if (cpu_fast_forward == 0){
+        dram_stats.write ++;
+        dram_access(paddr);
+    }
 #endif
     
     
@@ -83,10 +234,7 @@ void cpu_write64bits_dram(uint64_t paddr, uint64_t data){
 
 void cpu_readinst_dram(uint64_t paddr, char *buf){
 
-    for (int i = 0; i < MAX_INSTRUCTION_CHAR; ++i){
-        buf[i] = (char)pm[paddr + i];
-    }
-
+    dram_read(paddr, buf, MAX_INSTRUCTION_CHAR);
 }
 
 void cpu_writeinst_dram(uint64_t paddr, const char *str){
@@ -94,45 +242,165 @@ void cpu_writeinst_dram(uint64_t paddr, const char *str){
     int len = strlen(str);
     assert(len < MAX_INSTRUCTION_CHAR);
 
-    for (int i = 0; i < MAX_INSTRUCTION_CHAR; ++i){
-        
-        if (i < len){
-            pm[paddr + i] = (uint8_t)str[i];
-        }
-        else {
-            pm[paddr + i] = 0;
-        }
+    // the rest of the instruction slot is zero
+    dram_write(paddr, str, len);
+    dram_fill(paddr + len, 0, MAX_INSTRUCTION_CHAR - len);
+}
+
+
+// -------------------------------------------- //
+// DRAM timing
+// -------------------------------------------- //
+
+static int dram_timing_enabled = 0;
+static dram_timing_config_t dram_timing;
+
+// log2 of the field widths for the address mapping
+static int column_bits = 0;
+static int channel_bits = 0;
+static int bank_bits = 0;
+static int rank_bits = 0;
+
+// open_rows[bank id]: 1 + the row in the row buffer, 0 - precharged
+static uint64_t *open_rows = NULL;
+
+
+static int log2_exact(uint64_t n){
+    assert(n > 0 && (n & (n - 1)) == 0);
+    return __builtin_ctzll(n);
+}
+
+
+void dram_timing_default(dram_timing_config_t *config){
+    config->num_channels = DEFAULT_DRAM_NUM_CHANNELS;
+    config->num_ranks = DEFAULT_DRAM_NUM_RANKS;
+    config->num_banks = DEFAULT_DRAM_NUM_BANKS;
+    config->row_size = DEFAULT_DRAM_ROW_SIZE;
+    config->tRCD = DEFAULT_DRAM_TRCD;
+    config->tCAS = DEFAULT_DRAM_TCAS;
+    config->tRP = DEFAULT_DRAM_TRP;
+    config->tBURST = DEFAULT_DRAM_TBURST;
+    config->policy = DRAM_OPEN_PAGE;
+}
+
+
+void dram_timing_config(const dram_timing_config_t *config){
+
+    free(open_rows);
+    open_rows = NULL;
+    memset(&dram_stats, 0, sizeof(dram_stats_t));
+
+    if (config == NULL){
+        dram_timing_enabled = 0;
+        return;
     }
 
+    dram_timing = *config;
+    column_bits = log2_exact(config->row_size);
+    channel_bits = log2_exact(config->num_channels);
+    bank_bits = log2_exact(config->num_banks);
+    rank_bits = log2_exact(config->num_ranks);
+    assert(column_bits >= SRAM_CACHE_OFFSET_LENGTH);
+
+    open_rows = calloc(config->num_channels * config->num_ranks * config->num_banks, sizeof(uint64_t));
+    assert(open_rows != NULL);
+    dram_timing_enabled = 1;
 }
 
 
-/* interface of I/O Bus: read and write between the SRAM cache and DRAM memory
- */
+dram_address_t dram_map_address(uint64_t paddr){
 
-void bus_read_cacheline(uint64_t paddr, uint8_t *block){
+    dram_address_t addr;
+    uint64_t a = paddr;
 
+    addr.column = a & ((1ul << column_bits) - 1);
+    a >>= column_bits;
+    addr.channel = a & ((1ul << channel_bits) - 1);
+    a >>= channel_bits;
+    addr.bank = a & ((1ul << bank_bits) - 1);
+    a >>= bank_bits;
+    addr.rank = a & ((1ul << rank_bits) - 1);
+    a >>= rank_bits;
+    addr.row = a;
+    return addr;
+}
 
-    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_TAG_LENGTH);
 
-    for (int i = 0; i < (1 << SRAM_CACHE_OFFSET_LENGTH); ++i){
+// the row buffer of the bank decides the latency
+static dram_access_t dram_access(uint64_t paddr){
 
-        block[i] = pm[dram_base + i];
+    dram_access_t access = {
+        .latency = 0,
+        .row_status = DRAM_ROW_HIT,
+    };
+    if (dram_timing_enabled == 0){
+        dram_stats.untimed ++;
+        return access;
     }
 
-} 
+    dram_address_t addr = dram_map_address(paddr);
+    uint64_t bank = (addr.channel * dram_timing.num_ranks + addr.rank) * dram_timing.num_banks + addr.bank;
 
+    if (open_rows[bank] == addr.row + 1){
+        access.row_status = DRAM_ROW_HIT;
+        access.latency = dram_timing.tCAS;
+        dram_stats.row_hit ++;
+    }
+    else if (open_rows[bank] == 0){
+        access.row_status = DRAM_ROW_EMPTY;
+        access.latency = dram_timing.tRCD + dram_timing.tCAS;
+        dram_stats.row_empty ++;
+    }
+    else {
+        access.row_status = DRAM_ROW_CONFLICT;
+        access.latency = dram_timing.tRP + dram_timing.tRCD + dram_timing.tCAS;
+        dram_stats.row_conflict ++;
+    }
+    access.latency += dram_timing.tBURST;
 
-void bus_write_cacheline(uint64_t paddr, uint8_t *block){
+    if (dram_timing.policy == DRAM_OPEN_PAGE){
+        open_rows[bank] = addr.row + 1;
+    }
+    else {
+        // the precharge is hidden before the next access
+        open_rows[bank] = 0;
+    }
 
-    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_TAG_LENGTH);
+    dram_stats.latency += access.latency;
+    return access;
+}
 
-    for (int i = 0; i < (1 << SRAM_CACHE_OFFSET_LENGTH); ++i){
 
-        pm[dram_base + i] = block[i];
-    }
+void print_dram_stats(){
 
+    uint64_t total = dram_stats.row_hit + dram_stats.row_empty + dram_stats.row_conflict;
+    printf("DRAM: read %lu\twrite %lu\trow hit %lu\tempty %lu\tconflict %lu\n",
+        dram_stats.read, dram_stats.write,
+        dram_stats.row_hit, dram_stats.row_empty, dram_stats.row_conflict);
+    printf("DRAM row hit rate %.2f%%\taverage latency %.2f cycles\n",
+        total == 0 ? 0.0 : 100.0 * dram_stats.row_hit / total,
+        total == 0 ? 0.0 : (double)dram_stats.latency / total);
 }
 
 
+/* interface of I/O Bus: read and write between the SRAM cache and DRAM memory
+ */
+
+dram_access_t bus_read_cacheline(uint64_t paddr, uint8_t *block){
+
+    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH);
+    dram_read(dram_base, block, 1 << SRAM_CACHE_OFFSET_LENGTH);
 
+    dram_stats.read ++;
+    return dram_access(dram_base);
+} 
+
+
+dram_access_t bus_write_cacheline(uint64_t paddr, uint8_t *block){
+
+    uint64_t dram_base = ((paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH);
+    dram_write(dram_base, block, 1 << SRAM_CACHE_OFFSET_LENGTH);
+
+    dram_stats.write ++;
+    return dram_access(dram_base);
+}
@@ -2,56 +2,391 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
 #include "../../header/cpu.h"
 #include "../../header/memory.h"
 #include "../../header/common.h"
 #include "../../header/address.h"
 
 
-// each swap file is swap page
-// each line of this swap page is one uint64
-#define SWAP_PAGE_FILE_LINES (512)
+// the swap device is one preallocated binary file
+// slot i holds the raw 4KB page at file offset i * PAGE_SIZE
+// slot 0 is reserved: saddr = 0 in PTE means the page is not in swap space
+#define SWAP_FILE_PATH "./files/swap/swap.img"
 
-// disk address counter
-// static uint64_t internal_swap_daddr = 0;
+static int swap_fd = -1;
+static uint64_t swap_num_slots = 0;
+
+// free-slot bitmap: bit = 1 - slot in use
+static uint64_t *swap_bitmap = NULL;
+// search for free slot from here
+static uint64_t swap_next_slot = 1;
+// number of PTEs referring to each slot in use
+static uint16_t *swap_count = NULL;
+
+
+// writeback daemon: the page fault never waits for swap out
+// the frames are copied into this ring, then written by the daemon thread
+// in batches: one pwritev for each run of consecutive slots
+#define SWAP_WRITEBACK_QUEUE_SIZE (64)
+
+typedef struct{
+    uint64_t daddr;
+    uint8_t page[PAGE_SIZE];
+} swap_writeback_t;
+
+static swap_writeback_t writeback_queue[SWAP_WRITEBACK_QUEUE_SIZE];
+// [head, tail) are pending, the daemon writes from head
+static uint64_t writeback_head = 0;
+static uint64_t writeback_tail = 0;
+
+static pthread_t writeback_daemon;
+static int writeback_daemon_running = 0;
+static pthread_mutex_t writeback_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writeback_pending = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t writeback_done = PTHREAD_COND_INITIALIZER;
+
+
+void swap_init(uint64_t num_slots){
+
+    assert(num_slots > 1);
+
+    if (swap_fd >= 0){
+        swap_sync();
+        close(swap_fd);
+        free(swap_bitmap);
+        free(swap_count);
+    }
+
+    swap_fd = open(SWAP_FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (swap_fd < 0){
+        printf("swap: cannot open %s\n", SWAP_FILE_PATH);
+        exit(0);
+    }
+    // sparse file: the host allocates the blocks on write
+    if (ftruncate(swap_fd, num_slots * PAGE_SIZE) != 0){
+        printf("swap: cannot allocate %lu slots\n", num_slots);
+        exit(0);
+    }
+
+    swap_num_slots = num_slots;
+    swap_bitmap = calloc((num_slots + 63) / 64, sizeof(uint64_t));
+    swap_count = calloc(num_slots, sizeof(uint16_t));
+    assert(swap_bitmap != NULL && swap_count != NULL);
+    swap_bitmap[0] = 1;
+    swap_next_slot = 1;
+    memset(&swap_stats, 0, sizeof(swap_stats_t));
+}
+
+
+static void check_swap(){
+    if (swap_fd < 0){
+        swap_init(DEFAULT_SWAP_NUM_SLOTS);
+    }
+}
+
+
+uint64_t swap_alloc_slot(){
+
+    check_swap();
+
+    // next fit: scan the bitmap 64 slots at a time
+    uint64_t num_words = (swap_num_slots + 63) / 64;
+    uint64_t word = swap_next_slot / 64;
+    for (uint64_t i = 0; i <= num_words; ++ i){
+
+        uint64_t w = (word + i) % num_words;
+        if (swap_bitmap[w] == 0xffffffffffffffff){
+            continue;
+        }
+
+        uint64_t slot = w * 64 + __builtin_ctzll(~swap_bitmap[w]);
+        if (slot >= swap_num_slots){
+            // the tail bits after the last slot
+            continue;
+        }
+
+        swap_bitmap[w] |= (1ull << (slot % 64));
+        swap_count[slot] = 1;
+        swap_next_slot = slot + 1;
+        swap_stats.slot_used ++;
+        return slot;
+    }
+
+    printf("swap: no free swap slot\n");
+    exit(0);
+}
+
+
+void swap_free_slot(uint64_t daddr){
+
+    assert(0 < daddr && daddr < swap_num_slots);
+    assert((swap_bitmap[daddr / 64] >> (daddr % 64)) & 1);
+
+    swap_count[daddr] --;
+    if (swap_count[daddr] == 0){
+        swap_bitmap[daddr / 64] &= ~(1ull << (daddr % 64));
+        swap_stats.slot_used --;
+    }
+}
+
+
+void swap_dup_slot(uint64_t daddr){
+
+    assert(0 < daddr && daddr < swap_num_slots);
+    assert(swap_count[daddr] > 0 && swap_count[daddr] < UINT16_MAX);
+
+    swap_count[daddr] ++;
+}
+
+
+uint64_t swap_slot_count(uint64_t daddr){
+
+    assert(0 < daddr && daddr < swap_num_slots);
+    return swap_count[daddr];
+}
 
 
 int swap_in(uint64_t daddr, uint64_t ppn){
 
-    FILE *fr = NULL;
-    char filename[128];
-    sprintf(filename, "../files/swap/page-%ld.txt", daddr);
-    fr = fopen(filename, "r");
-    assert(fr != NULL);
+    check_swap();
+    assert(0 < daddr && daddr < swap_num_slots);
+
+#ifdef USE_SRAM_CACHE
+    // drop the stale cache lines of the previous page
+    sram_cache_flush_page(ppn);
+#endif
 
-    uint64_t ppn_ppo = ppn << PHYSICAL_PAGE_NUMBER_LENGTH;
-    char buf[64] = {'0'};
-    for (int i = 0; i < SWAP_PAGE_FILE_LINES; ++i){
-        // 每次从swap文件读一行（一行为8字节），将一行转化为二进制写入内存
-        char *str = fgets(buf, 64, fr);
-        *((uint64_t *)(&pm[ppn_ppo + i * 8])) = string2uint(str);
+    uint64_t ppn_ppo = ppn << PHYSICAL_PAGE_OFFSET_LENGTH;
+    swap_stats.page_in ++;
+
+    // the latest copy may be still waiting for the writeback
+    pthread_mutex_lock(&writeback_lock);
+    for (uint64_t i = writeback_tail; i > writeback_head; -- i){
+        swap_writeback_t *wb = &writeback_queue[(i - 1) % SWAP_WRITEBACK_QUEUE_SIZE];
+        if (wb->daddr == daddr){
+            memcpy(&pm[ppn_ppo], wb->page, PAGE_SIZE);
+            pthread_mutex_unlock(&writeback_lock);
+            swap_stats.writeback_hit ++;
+            return 0;
+        }
     }
-    fclose(fr);
+    pthread_mutex_unlock(&writeback_lock);
+
+    ssize_t n = pread(swap_fd, &pm[ppn_ppo], PAGE_SIZE, daddr * PAGE_SIZE);
+    assert(n == PAGE_SIZE);
+    swap_stats.read_batch ++;
     return 0;
 }
 
 
-int swap_out(uint64_t daddr, uint64_t ppn){
-    
-    FILE *fw = NULL;
-    char filename[128];
-    sprintf(filename, "../files/swap/page-%ld.txt", daddr);
-    fw = fopen(filename, "w");
-    assert(fw != NULL);
+int swap_in_batch(uint64_t daddr, uint64_t *ppns, uint64_t n){
 
-    uint64_t ppn_ppo = ppn << PHYSICAL_PAGE_NUMBER_LENGTH;
-    for (int i = 0; i < SWAP_PAGE_FILE_LINES; ++i){
-        // 每次写8个字节,也就是说swap文件每一行写64位，就是8个字节
-        fprintf(fw, "0x16%lx\n", *((uint64_t *)(&pm[ppn_ppo + i * 8])));
+    check_swap();
+    assert(0 < daddr && daddr + n <= swap_num_slots);
+    assert(n <= MAX_SWAP_BATCH);
 
+    // any slot waiting in the writeback queue: read them one by one
+    int queued = 0;
+    pthread_mutex_lock(&writeback_lock);
+    for (uint64_t i = writeback_head; i < writeback_tail && queued == 0; ++ i){
+        uint64_t d = writeback_queue[i % SWAP_WRITEBACK_QUEUE_SIZE].daddr;
+        queued = (daddr <= d && d < daddr + n);
     }
-    fclose(fw);
+    pthread_mutex_unlock(&writeback_lock);
+
+    if (queued == 1){
+        for (uint64_t i = 0; i < n; ++ i){
+            swap_in(daddr + i, ppns[i]);
+        }
+        return 0;
+    }
+
+    struct iovec iov[MAX_SWAP_BATCH];
+    for (uint64_t i = 0; i < n; ++ i){
+#ifdef USE_SRAM_CACHE
+        sram_cache_flush_page(ppns[i]);
+#endif
+        iov[i].iov_base = &pm[ppns[i] << PHYSICAL_PAGE_OFFSET_LENGTH];
+        iov[i].iov_len = PAGE_SIZE;
+    }
+
+    ssize_t size = preadv(swap_fd, iov, n, daddr * PAGE_SIZE);
+    assert(size == n * PAGE_SIZE);
+
+    swap_stats.page_in += n;
+    swap_stats.read_batch ++;
     return 0;
+}
+
+
+int swap_out(uint64_t daddr, uint64_t ppn){
+
+    check_swap();
+    assert(0 < daddr && daddr < swap_num_slots);
+
+#ifdef USE_SRAM_CACHE
+    // the latest data may be still in the cache
+    sram_cache_flush_page(ppn);
+#endif
+
+    // the older copy in the writeback queue must not overwrite this one
+    swap_sync();
+
+    uint64_t ppn_ppo = ppn << PHYSICAL_PAGE_OFFSET_LENGTH;
+    ssize_t n = pwrite(swap_fd, &pm[ppn_ppo], PAGE_SIZE, daddr * PAGE_SIZE);
+    assert(n == PAGE_SIZE);
+
+    swap_stats.page_out ++;
+    return 0;
+}
+
+
+static void *writeback_daemon_loop(void *arg){
+
+    struct iovec iov[SWAP_WRITEBACK_QUEUE_SIZE];
 
+    pthread_mutex_lock(&writeback_lock);
+    while (1){
+        while (writeback_head == writeback_tail){
+            pthread_cond_wait(&writeback_pending, &writeback_lock);
+        }
+
+        // the pending pages are not touched by the simulator until they are written
+        uint64_t head = writeback_head;
+        uint64_t tail = writeback_tail;
+        int fd = swap_fd;
+        pthread_mutex_unlock(&writeback_lock);
+
+        uint64_t i = head;
+        while (i < tail){
+            // gather the run of consecutive slots
+            swap_writeback_t *first = &writeback_queue[i % SWAP_WRITEBACK_QUEUE_SIZE];
+            int n = 0;
+            while (i + n < tail && writeback_queue[(i + n) % SWAP_WRITEBACK_QUEUE_SIZE].daddr == first->daddr + n){
+                iov[n].iov_base = writeback_queue[(i + n) % SWAP_WRITEBACK_QUEUE_SIZE].page;
+                iov[n].iov_len = PAGE_SIZE;
+                n ++;
+            }
+            ssize_t written = pwritev(fd, iov, n, first->daddr * PAGE_SIZE);
+            assert(written == n * PAGE_SIZE);
+
+            pthread_mutex_lock(&writeback_lock);
+            swap_stats.write_batch ++;
+            pthread_mutex_unlock(&writeback_lock);
+            i += n;
+        }
+
+        pthread_mutex_lock(&writeback_lock);
+        writeback_head = tail;
+        pthread_cond_broadcast(&writeback_done);
+    }
+    return NULL;
+}
+
+
+void swap_out_async(uint64_t daddr, uint64_t ppn){
+
+#ifdef USE_SRAM_CACHE
+    sram_cache_flush_page(ppn);
+#endif
+
+    swap_write_async(daddr, &pm[ppn << PHYSICAL_PAGE_OFFSET_LENGTH]);
 }
 
+
+void swap_write_async(uint64_t daddr, const uint8_t *page){
+
+    check_swap();
+    assert(0 < daddr && daddr < swap_num_slots);
+
+    pthread_mutex_lock(&writeback_lock);
+    if (writeback_daemon_running == 0){
+        int rc = pthread_create(&writeback_daemon, NULL, writeback_daemon_loop, NULL);
+        assert(rc == 0);
+        pthread_detach(writeback_daemon);
+        writeback_daemon_running = 1;
+    }
+
+    // the queue is full: wait for the daemon
+    while (writeback_tail - writeback_head == SWAP_WRITEBACK_QUEUE_SIZE){
+        swap_stats.writeback_stall ++;
+        pthread_cond_wait(&writeback_done, &writeback_lock);
+    }
+
+    // snapshot of the page: the frame can be reused right now
+    swap_writeback_t *wb = &writeback_queue[writeback_tail % SWAP_WRITEBACK_QUEUE_SIZE];
+    wb->daddr = daddr;
+    memcpy(wb->page, page, PAGE_SIZE);
+    writeback_tail ++;
+    swap_stats.page_out ++;
+
+    pthread_cond_signal(&writeback_pending);
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+
+void swap_sync(){
+
+    pthread_mutex_lock(&writeback_lock);
+    while (writeback_head != writeback_tail){
+        pthread_cond_wait(&writeback_done, &writeback_lock);
+    }
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+
+void swap_save_state(FILE *fp){
+
+    check_swap();
+    // the pages of the writeback queue are in the file after that
+    swap_sync();
+
+    checkpoint_write(fp, &swap_num_slots, sizeof(uint64_t));
+    checkpoint_write(fp, &swap_next_slot, sizeof(uint64_t));
+    checkpoint_write(fp, swap_bitmap, (swap_num_slots + 63) / 64 * sizeof(uint64_t));
+    checkpoint_write(fp, swap_count, swap_num_slots * sizeof(uint16_t));
+
+    uint8_t page[PAGE_SIZE];
+    for (uint64_t daddr = 1; daddr < swap_num_slots; ++ daddr){
+        if ((swap_bitmap[daddr / 64] >> (daddr % 64)) & 1){
+            ssize_t n = pread(swap_fd, page, PAGE_SIZE, daddr * PAGE_SIZE);
+            assert(n == PAGE_SIZE);
+            checkpoint_write(fp, page, PAGE_SIZE);
+        }
+    }
+}
+
+
+void swap_load_state(FILE *fp){
+
+    uint64_t num_slots;
+    checkpoint_read(fp, &num_slots, sizeof(uint64_t));
+    swap_init(num_slots);
+
+    checkpoint_read(fp, &swap_next_slot, sizeof(uint64_t));
+    checkpoint_read(fp, swap_bitmap, (swap_num_slots + 63) / 64 * sizeof(uint64_t));
+    checkpoint_read(fp, swap_count, swap_num_slots * sizeof(uint16_t));
+
+    uint8_t page[PAGE_SIZE];
+    for (uint64_t daddr = 1; daddr < swap_num_slots; ++ daddr){
+        if ((swap_bitmap[daddr / 64] >> (daddr % 64)) & 1){
+            checkpoint_read(fp, page, PAGE_SIZE);
+            ssize_t n = pwrite(swap_fd, page, PAGE_SIZE, daddr * PAGE_SIZE);
+            assert(n == PAGE_SIZE);
+            swap_stats.slot_used ++;
+        }
+    }
+}
+
+
+void print_swap_stats(){
+    printf("swap: %lu slots used of %lu\tpage in %lu\tpage out %lu\n",
+        swap_stats.slot_used, swap_num_slots, swap_stats.page_in, swap_stats.page_out);
+    printf("swap read: %lu batches\n", swap_stats.read_batch);
+    printf("swap writeback: %lu batches\t%lu stalls\t%lu page in from the queue\n",
+        swap_stats.write_batch, swap_stats.writeback_stall, swap_stats.writeback_hit);
+}
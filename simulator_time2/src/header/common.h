@@ -26,8 +26,28 @@
 // use sram cache for memory access
 #define DEBUG_ENABLE_SRAM_CACHE 0
 
-// printf wrapper
-uint64_t debug_printf(uint64_t open_set, const char *format, ...);
+// the categories compiled in
+// release build: -DDEBUG_COMPILE_SET=0 removes all debug output at compile time
+#ifndef DEBUG_COMPILE_SET
+#define DEBUG_COMPILE_SET      0xffffffffffffffff
+#endif
+
+// the categories printed at runtime, DEBUG_VERBOSE_SET by default
+uint64_t debug_mask;
+
+#define DEBUG_ENABLED(open_set) \
+    ((((open_set) & DEBUG_COMPILE_SET) != 0x0) && (((open_set) & debug_mask) != 0x0))
+
+// printf wrapper to stderr
+// the mask is checked before the arguments are evaluated
+#define debug_printf(open_set, ...) \
+    do { \
+        if (DEBUG_ENABLED(open_set)){ \
+            debug_print(__VA_ARGS__); \
+        } \
+    } while (0)
+
+uint64_t debug_print(const char *format, ...);
 
 
 // type converter
@@ -40,6 +60,61 @@ uint64_t string2uint(const char *str);
 uint64_t string2uint_range(const char *str, int start, int end);
 
 
+// compression
+// LZ77 codec in LZ4 block format
+// return the size of output, 0 if the output exceeds the capacity
+uint64_t lz_compress(const uint8_t *src, uint64_t size, uint8_t *dst, uint64_t capacity);
+// return the size of output, 0 if the input is corrupted
+uint64_t lz_decompress(const uint8_t *src, uint64_t size, uint8_t *dst, uint64_t capacity);
+
+// all the uint64 words of src are the same value
+int same_filled(const uint8_t *src, uint64_t size, uint64_t *value);
+
+
+// deterministic random numbers
+// each component draws from its own generator, seeded from one seed
+typedef enum{
+    RNG_TLB,            // TLB victim
+    RNG_SCHEDULE,       // interleaving of the cores
+    RNG_WORKLOAD,       // the random operations of the tests
+    NUM_RNG,
+} rng_component_t;
+
+#define DEFAULT_RNG_SEED (123456)
+
+// called lazily with DEFAULT_RNG_SEED if not called before use
+void rng_seed(uint64_t seed);
+uint64_t rng_next(rng_component_t component);
+// in [0, n)
+uint64_t rng_below(rng_component_t component, uint64_t n);
+
+// the seed and the generators, saved in the checkpoint
+typedef struct{
+    uint64_t seed;
+    uint64_t s[NUM_RNG][4];
+} rng_snapshot_t;
+
+void rng_save_state(rng_snapshot_t *snapshot);
+void rng_load_state(const rng_snapshot_t *snapshot);
+
+// record/replay of every random draw and external input
+// a replayed run gets the same values in the same order, else it stops at the divergence
+#define RR_OFF      (0)
+#define RR_RECORD   (1)
+#define RR_REPLAY   (2)
+
+#define RR_EVENT_RNG    (0)
+#define RR_EVENT_INPUT  (1)
+
+void rr_record(const char *path);
+void rr_replay(const char *path);
+// return the number of events recorded or replayed
+uint64_t rr_stop();
+// the value read from outside the simulator, e.g. the host clock
+// record: logged and returned, replay: the logged value is returned
+uint64_t rr_input(int source, uint64_t value);
+
+
 
 
 
@@ -5,6 +5,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <stdio.h>
 
 
 /*======================================*/
@@ -226,9 +227,7 @@ typedef struct{
     uint64_t cr0;
     uint64_t cr1;
     uint64_t cr2;
-    uint64_t cr3;   // should be a 40-bit PPN for PGD in DRAM
-                    // but we are using 48-bit virutal address on simulator's heap
-                    // (by malloc())
+    uint64_t cr3;   // 40-bit PPN for PGD in DRAM
 } cpu_cr_t;
 cpu_cr_t cpu_controls;
 
@@ -293,6 +292,8 @@ cpu_cr_t cpu_controls;
 // #define NUM_CORES 1
 // core_t cores[NUM_CORES];
 
+#define NUM_CORES (1)
+
 //active core for current task
 uint64_t ACTIVE_CORE;
 
@@ -302,6 +303,10 @@ uint64_t ACTIVE_CORE;
 // CPU's instruction cycle: execution of instructions
 void instruction_cycle();
 
+// 1 - functional simulation only
+// no TLB, paging-structure caches, SRAM cache, timing or branch prediction
+int cpu_fast_forward;
+
 /*--------------------------------------*/
 // place the functions here because they requires the core_t type
 
@@ -313,6 +318,400 @@ uint64_t mmu_vaddr_pagefault;
 // translate the virtual address to physical address in MMU
 // each MMU is owned by each core
 uint64_t va2pa(uint64_t vaddr);
+// translate for the memory write: set the dirty bit in page table entry
+uint64_t va2pa_write(uint64_t vaddr);
+// translate for the instruction fetch: the same as va2pa, traced as the fetch
+uint64_t va2pa_fetch(uint64_t vaddr);
+
+// remove the 4KB page translation of vaddr from TLB
+void invalidate_tlb(uint64_t vaddr);
+// remove all translations and the paging-structure caches
+// required after switching cr3 to another address space
+void flush_tlb();
+
+// statistics of the address translation
+typedef struct{
+    uint64_t tlb_hit_4k;
+    uint64_t tlb_hit_2m;
+    uint64_t tlb_hit_1g;
+    uint64_t tlb_miss;
+
+    uint64_t page_walk;         // number of page walks
+    uint64_t page_walk_ref;     // page table entries read by the page walks
+    uint64_t page_walk_2m;      // page walks stopped at PMD
+    uint64_t page_walk_1g;      // page walks stopped at PUD
+    uint64_t page_walk_cache_miss;  // page table entries missed in SRAM cache
+
+    // paging-structure caches of PGD, PUD, PMD entries
+    uint64_t pwc_hit[3];
+    uint64_t pwc_miss[3];
+} mmu_stats_t;
+mmu_stats_t mmu_stats;
+
+void print_mmu_stats();
+
+// set the number of entries of the paging-structure caches
+// 0 disables the cache of that level
+void pagewalk_cache_config(int pgd_size, int pud_size, int pmd_size);
+
+// the TLB and the paging-structure caches in the checkpoint
+void mmu_save_state(FILE *fp);
+void mmu_load_state(FILE *fp);
+
+/*--------------------------------------*/
+// cycle-approximate timing
+
+// each instruction is charged the base latency of its opcode,
+// plus the latencies of the events on its memory path
+// the DRAM latency comes from the DRAM timing model,
+// or is the fixed dram_access latency when the model is disabled
+typedef struct{
+    uint64_t op_latency[NUM_INSTRTYPE];     // indexed by op_t
+
+    uint64_t tlb_miss;          // each TLB miss
+    uint64_t page_walk_ref;     // each page table entry read by the page walk
+    uint64_t sram_miss;         // each SRAM cache miss, before the DRAM access
+    uint64_t dram_access;       // each DRAM access without the DRAM timing model
+    uint64_t page_fault;        // the kernel handler of each page fault
+    uint64_t swap_in;           // each page read from the swap device
+    uint64_t branch_mispredict; // the pipeline refill after each misprediction
+} timing_config_t;
+
+#define DEFAULT_OP_LATENCY          (1)
+#define DEFAULT_BRANCH_LATENCY      (2)     // call, ret, jne, jmp
+#define DEFAULT_TLB_MISS_LATENCY    (10)
+#define DEFAULT_PTE_LATENCY         (4)
+#define DEFAULT_SRAM_MISS_LATENCY   (10)
+#define DEFAULT_DRAM_ACCESS_LATENCY (100)
+#define DEFAULT_PAGE_FAULT_LATENCY  (2000)
+#define DEFAULT_SWAP_IN_LATENCY     (30000)
+#define DEFAULT_MISPREDICT_LATENCY  (14)
+
+// fill the config with the default values above
+void timing_default(timing_config_t *config);
+// the config is used by all cores; the default is used if not called
+void timing_config(const timing_config_t *config);
+
+typedef struct{
+    uint64_t instructions;
+    uint64_t cycles;
+
+    uint64_t op_count[NUM_INSTRTYPE];
+    uint64_t op_cycles[NUM_INSTRTYPE];  // including the memory cycles
+
+    // the memory cycles by the source
+    uint64_t tlb_cycles;
+    uint64_t cache_cycles;
+    uint64_t dram_cycles;
+    uint64_t fault_cycles;
+    // the misprediction penalty
+    uint64_t branch_cycles;
+} timing_stats_t;
+timing_stats_t timing_stats[NUM_CORES];
+
+struct INST_STRUCT;
+
+// called by instruction_cycle around each instruction of ACTIVE_CORE
+void timing_begin_instruction();
+void timing_end_instruction(const struct INST_STRUCT *inst);
+
+void print_timing_stats();
+
+/*--------------------------------------*/
+// out-of-order timing model
+
+// optional: the timing layer feeds every instruction with its latencies
+// the in-order cycles in timing_stats are still counted
+typedef struct{
+    uint32_t width;         // dispatch, issue and retire width
+    uint32_t rob_size;
+    uint32_t iq_size;
+    uint32_t lsq_size;
+    uint32_t alu_units;
+    uint32_t branch_units;
+    uint32_t mem_units;
+    uint32_t mshr;          // misses outstanding at the same time
+} ooo_config_t;
+
+#define DEFAULT_OOO_WIDTH           (4)
+#define DEFAULT_OOO_ROB_SIZE        (192)
+#define DEFAULT_OOO_IQ_SIZE         (64)
+#define DEFAULT_OOO_LSQ_SIZE        (72)
+#define DEFAULT_OOO_ALU_UNITS       (4)
+#define DEFAULT_OOO_BRANCH_UNITS    (1)
+#define DEFAULT_OOO_MEM_UNITS       (2)
+#define DEFAULT_OOO_MSHR            (10)
+
+void ooo_default(ooo_config_t *config);
+// NULL disables the model; the state and statistics are reset
+void ooo_config(const ooo_config_t *config);
+int ooo_is_enabled();
+
+// latency: the base latency of the opcode
+// mem_cycles: the TLB, cache and DRAM cycles, overlapped with other misses
+// fault_cycles: the page fault, serialized with the whole pipeline
+// mispredict_cycles: the fetch restarts this long after the branch completes
+void ooo_instruction(const struct INST_STRUCT *inst, uint64_t latency, uint64_t mem_cycles,
+    uint64_t fault_cycles, uint64_t mispredict_cycles);
+
+typedef struct{
+    uint64_t instructions;
+    uint64_t cycles;            // the retire cycle of the last instruction
+
+    // dispatch stalls on a full structure
+    uint64_t rob_full;
+    uint64_t iq_full;
+    uint64_t lsq_full;
+    // misses waiting for a free MSHR
+    uint64_t mshr_full;
+    // fetch redirected by the mispredicted branches
+    uint64_t mispredicts;
+
+    uint64_t misses;
+    uint64_t miss_cycles;       // sum of the miss latencies
+    uint64_t miss_busy_cycles;  // cycles with at least one miss outstanding
+} ooo_stats_t;
+ooo_stats_t ooo_stats[NUM_CORES];
+
+void print_ooo_stats();
+
+/*--------------------------------------*/
+// branch predictor
+
+// direction predictors of the conditional branches
+typedef enum{
+    BPRED_BIMODAL,
+    BPRED_GSHARE,
+    BPRED_TAGE,         // TAGE-lite
+    NUM_BPRED,
+} bpred_type_t;
+
+typedef struct{
+    bpred_type_t type;
+    uint32_t table_size;    // entries of the counter table and each TAGE table, power of 2
+    uint32_t history_bits;  // global history used by gshare
+    uint32_t btb_size;      // entries of the direct-mapped BTB, power of 2
+    uint32_t ras_size;
+} bpred_config_t;
+
+#define DEFAULT_BPRED_TABLE_SIZE    (4096)
+#define DEFAULT_BPRED_HISTORY_BITS  (12)
+#define DEFAULT_BTB_SIZE            (512)
+#define DEFAULT_RAS_SIZE            (16)
+
+void bpred_default(bpred_config_t *config);
+// NULL disables the prediction; the tables and statistics are reset
+void bpred_config(const bpred_config_t *config);
+int bpred_is_enabled();
+
+// the branch op at pc has been executed and the next rip is next_pc
+// return 1 if it was mispredicted
+int bpred_branch(int op, uint64_t pc, uint64_t next_pc);
+
+typedef struct{
+    uint64_t branches;
+    uint64_t conditional;
+    uint64_t mispredict;
+
+    uint64_t direction_miss;    // jne
+    uint64_t btb_miss;          // target of jne, jmp, call
+    uint64_t ras_miss;          // ret
+} bpred_stats_t;
+bpred_stats_t bpred_stats;
+
+// the statistics of the branch at pc, return 0 if it is not executed
+int bpred_pc_stats(uint64_t pc, uint64_t *branches, uint64_t *mispredicts);
+void print_bpred_stats();
+
+/*--------------------------------------*/
+// sampled simulation
+
+// the run alternates the fast-forward and the detailed windows:
+//  fast-forward:   functional only
+//  warm-up:        detailed, to warm the caches, TLB and predictors, not measured
+//  detail:         detailed and measured
+// the basic-block vectors of each interval are written for the offline SimPoint
+typedef struct{
+    uint64_t fast_forward;      // instructions of each phase
+    uint64_t warmup;
+    uint64_t detail;
+
+    uint64_t interval;          // instructions of each basic-block vector, 0 - no vectors
+    const char *bbv_path;       // the SimPoint .bb file
+} sample_config_t;
+
+#define DEFAULT_SAMPLE_FAST_FORWARD (1000000)
+#define DEFAULT_SAMPLE_WARMUP       (10000)
+#define DEFAULT_SAMPLE_DETAIL       (10000)
+#define DEFAULT_SAMPLE_INTERVAL     (100000)
+#define DEFAULT_BBV_PATH            "./files/simpoint/sample.bb"
+
+void sample_default(sample_config_t *config);
+// the statistics and the basic-block vectors are reset
+void sample_config(const sample_config_t *config);
+
+// run the instructions with sampling, starting in fast-forward
+void sample_run(uint64_t num_instructions);
+// called by instruction_cycle for the basic-block vectors
+void sample_instruction(uint64_t pc, int op);
+// write the vector of the last partial interval and close the file
+void sample_finish();
+
+typedef struct{
+    uint64_t instructions;
+    uint64_t fast_forward;
+    uint64_t warmup;
+    uint64_t detail;
+
+    uint64_t windows;
+    uint64_t detail_cycles;     // the cycles of the measured instructions
+
+    uint64_t intervals;         // basic-block vectors written
+    uint64_t basic_blocks;      // distinct basic blocks
+} sample_stats_t;
+sample_stats_t sample_stats;
+
+void print_sample_stats();
+
+
+/*--------------------------------------*/
+// execution trace
+
+// the binary trace of the instructions and memory events
+// each core writes fixed-size records into its own ring buffer,
+// a background thread drains the rings into the compressed file
+//
+// trace file:
+//  header:     magic, version, record size, number of cores
+//  chunks:     4 bytes raw size, 4 bytes stored size, data
+// the data is compressed by lz_compress, stored raw if it does not shrink
+
+typedef enum{
+    TRACE_INSTRUCTION,      // pc, op
+    TRACE_FETCH,            // the instruction fetch: vaddr, paddr
+    TRACE_LOAD,             // vaddr, paddr
+    TRACE_STORE,            // vaddr, paddr
+    TRACE_CACHE_MISS,       // paddr of the SRAM cache miss
+    TRACE_PAGE_FAULT,       // vaddr, paddr of the page table entry
+    NUM_TRACE_TYPE,
+} trace_type_t;
+
+#define TRACE_FLAG_TLB_MISS     (0x1)
+#define TRACE_FLAG_WRITE        (0x2)
+
+typedef struct{
+    uint64_t time;      // the instruction count of the core
+    uint64_t pc;
+    uint64_t vaddr;
+    uint64_t paddr;
+    uint8_t type;
+    uint8_t core;
+    uint8_t op;
+    uint8_t flags;
+    uint32_t reserved;
+} trace_record_t;
+
+#define TRACE_RING_SIZE         (1 << 14)   // records of each core
+#define TRACE_CHUNK_RECORDS     (1024)      // records of each compressed chunk
+#define DEFAULT_TRACE_PATH      "./files/trace/sim.trace"
+
+// 1 - the events are recorded
+int trace_enabled;
+
+// start the drain thread and write the header
+void trace_start(const char *path);
+// drain all rings and close the file
+void trace_stop();
+// called by the simulator of ACTIVE_CORE before the instruction is fetched
+void trace_begin_instruction(uint64_t pc);
+void trace_emit(int type, uint64_t vaddr, uint64_t paddr, int op, int flags);
+
+// the event costs only the check when the trace is off
+#define TRACE_EVENT(type, vaddr, paddr, op, flags) \
+    do { \
+        if (trace_enabled == 1){ \
+            trace_emit((type), (vaddr), (paddr), (op), (flags)); \
+        } \
+    } while (0)
+
+typedef struct{
+    uint64_t records;
+    uint64_t stalls;            // the ring was full and the core waited
+    uint64_t chunks;
+    uint64_t raw_bytes;
+    uint64_t file_bytes;
+} trace_stats_t;
+trace_stats_t trace_stats;
+
+void print_trace_stats();
+
+// read the records back in the order of the file
+typedef struct{
+    FILE *fp;
+    uint32_t num_cores;
+    trace_record_t *chunk;
+    uint64_t num_records;
+    uint64_t next;
+} trace_reader_t;
+
+// return 0 if the file is not a trace
+int trace_reader_open(trace_reader_t *reader, const char *path);
+// return 0 at the end of the trace
+int trace_reader_next(trace_reader_t *reader, trace_record_t *record);
+void trace_reader_close(trace_reader_t *reader);
+
+// one line of text, or one event of the Chrome trace JSON
+void trace_print_text(FILE *fp, const trace_record_t *record);
+void trace_print_json(FILE *fp, const trace_record_t *record, int first);
+
+
+/*--------------------------------------*/
+// guest profiler
+
+// the counts of each guest PC, attributed to the symbols for the flat profile
+// the call and ret build the calling context tree for the collapsed stacks:
+//  main;sum;sum 1234
+// one line for each stack, the estimated cycles of its own instructions,
+// the input of flamegraph.pl
+
+typedef struct{
+    // 1 - count every instruction
+    // N - count every N-th instruction, weighted by N
+    uint64_t period;
+} profile_config_t;
+
+#define DEFAULT_PROFILE_PERIOD      (1)
+#define DEFAULT_PROFILE_STACKS_PATH "./files/profile/stacks.txt"
+
+void profile_default(profile_config_t *config);
+// NULL disables the profiler; the counts, stacks and symbols are reset
+void profile_config(const profile_config_t *config);
+
+// 1 - the instructions are profiled
+int profile_enabled;
+
+// the function of guest code: [addr, addr + size)
+void profile_add_symbol(const char *name, uint64_t addr, uint64_t size);
+
+// called by instruction_cycle around each instruction of ACTIVE_CORE
+void profile_begin_instruction();
+void profile_end_instruction(uint64_t pc, int op);
+
+typedef struct{
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t cache_misses;
+    uint64_t tlb_misses;
+} profile_count_t;
+
+// return 0 if the pc or the symbol is not profiled
+int profile_pc_count(uint64_t pc, profile_count_t *count);
+int profile_symbol_count(const char *name, profile_count_t *count);
+
+// the flat profile of the symbols and the hottest PCs
+void print_profile();
+// return the number of stacks written
+uint64_t profile_write_stacks(const char *path);
 
 
 
@@ -78,12 +78,13 @@ typedef struct{
 
 
 
-#define MAX_ELF_FILE_LENGTH (64)    // max 64 effective lines
 #define MAX_ELF_FILE_WIDTH (128)    // max 128 chars per line
 
+typedef char elf_line_t[MAX_ELF_FILE_WIDTH];
+
 typedef struct
 {
-    char buffer[MAX_ELF_FILE_LENGTH][MAX_ELF_FILE_WIDTH];
+    elf_line_t *buffer;     // line_count effective lines, on the heap
     uint64_t line_count;
 
     uint64_t sht_count;
@@ -102,8 +103,19 @@ typedef struct
 
 
 void parse_elf(const char *filename, elf_t *elf);
+// reset the elf and allocate line_count zero lines for the buffer
+void alloc_elf(elf_t *elf, uint64_t line_count);
 void free_elf(elf_t *elf);
 void link_elf(elf_t **src, int num_srcs, elf_t *dst);
 void write_eof(const char *filename, elf_t *eof);
 
+// the functions of the executable for the guest profiler
+void profile_elf_symbols(const elf_t *elf);
+
+// create a new address space for the linked EOF, switch cr3 to it
+// .text, .rodata and .data are mapped lazily from their images
+// the stack is set up with the return address 0, rip at the entry symbol
+// return the new cr3
+uint64_t load_eof(const elf_t *eof, const char *entry);
+
 #endif
\ No newline at end of file
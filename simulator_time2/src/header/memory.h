@@ -13,21 +13,40 @@
 
 
 // physical memory space is decided by the physical address
-// in this simulator, there are 4 + 6 + 6 = 16 bit physical adderss
+// the simulated DRAM is sized at runtime, up to (1 << PHYSICAL_ADDRESS_LENGTH)
+// by default, there are 4 + 6 + 6 = 16 bit physical adderss
 // then the physical space is (1 << 16) = 65536
 // total 16 physical memory
 
 
-#define PHYSICAL_MEMORY_SPACE (65536)
+#define PHYSICAL_MEMORY_SPACE (65536)   // default size
 #define MAX_NUM_PHYSICAL_PAGE (16)    // 1 + MAX_INDEX_PHYSICAL_PAGE
 
 #define PAGE_TABLE_ENTRY_NUM    (512)
 #define PAGE_SIZE    (4096)
+#define LARGE_PAGE_2M_SIZE  (1 << 21)   // mapped by one PMD entry
+#define LARGE_PAGE_1G_SIZE  (1 << 30)   // mapped by one PUD entry
+
+// the level of the leaf page table entry decides the page size
+#define PAGE_LEVEL_1G   (2)     // PUD
+#define PAGE_LEVEL_2M   (3)     // PMD
+#define PAGE_LEVEL_4K   (4)     // PT
 
 // physical memory
-// 16 physical memory pages
 // used only for user process
-uint8_t pm[PHYSICAL_MEMORY_SPACE];
+// anonymous mapping without swap reservation: the host allocates
+// the pages touched by the guest only, so a 64GB space is cheap
+uint8_t *pm;
+uint64_t physical_memory_size;
+
+// map size bytes of physical memory, all zero
+// the old contents are dropped
+// called lazily with PHYSICAL_MEMORY_SPACE if not called before use
+void physical_memory_init(uint64_t size);
+
+// map the physical memory from the file at offset, private and lazily:
+// the pages are read on the first touch, the writes never reach the file
+void physical_memory_map_file(int fd, uint64_t offset, uint64_t size);
 
 
 
@@ -45,17 +64,13 @@ typedef union{
         uint64_t writethough        : 1;
         uint64_t cachedisabled      : 1;
         uint64_t reference          : 1;
-        uint64_t unused6            : 1;
-        uint64_t smallpage          : 1;
+        uint64_t dirty              : 1;    // large page only
+        uint64_t largepage          : 1;    // PS bit - 1: PUD/PMD entry maps a 1GB/2MB page directly
         uint64_t global             : 1;
         uint64_t unused9_11         : 3;
-        /*
-        uint64_t paddr              : 40;
+        uint64_t ppn                : 40;   // physical page of the next level page table
+                                            // large page: the first 4KB physical page of it
         uint64_t unused52_62        : 10;
-        for malloc, a virtual address on heap is 48 bits
-        for real world, a physical page number is 40 bits
-        */
-        uint64_t paddr              : 50;   // virtual address (48 bits) on simulator's heap
         uint64_t xdisabled          : 1;
     };
 
@@ -81,7 +96,8 @@ typedef union{
         uint64_t dirty              : 1;    // dirty bit - 1: dirty; 0: clean
         uint64_t zero7              : 1;
         uint64_t global             : 1;
-        uint64_t unused9_11         : 3;
+        uint64_t cow                : 1;    // copy on write: readonly until the first write
+        uint64_t unused10_11        : 2;
         uint64_t ppn                : 40;
         uint64_t unused52_62        : 10;
         uint64_t xdisabled          : 1;
@@ -94,24 +110,34 @@ typedef union{
 } pte4_t;   // PT
 
 
+// reversed mapping: one node for each PT entry mapping the physical page
+// real world: the anon_vma chain of the page
+typedef struct RMAP_STRUCT{
+    uint64_t pte4;  // the physical address of page table entry
+    uint64_t vaddr; // the virtual page mapped by it, for TLB shootdown
+    struct RMAP_STRUCT *next;
+} rmap_t;
+
 // physical page descriptor
 typedef struct{
     
     int allocated;
-    int dirty;
-    int time; // LRU cache
-
-
-    // real world： mapping to anon_vma or address_space
-    // we simply the simulator here
-    // T0DO: if multiple processes are using this page? E.g shared Library
-    pte4_t *pte4; // the reversed mapping: from PPN to page table entry
+    int pinned; // page table pages are never swapped out
+    int listed; // in the free frame list
+    int readahead;  // read ahead from swap space, not mapped yet
+    int mapcount;   // number of nodes in rmap, > 1 when shared after fork
+    int file;       // read from the image of a file-backed area, dropped when clean
+
+    // the page is unmapped from all the page tables when evicted
+    rmap_t *rmap;
     uint64_t daddr;   // binding the revesed mapping with mapping to disk
 }pd_t;
 
 // for each pagable (swappable) physical page
 // create one reversed mapping
-pd_t page_map[MAX_NUM_PHYSICAL_PAGE];
+// runtime size: num_physical_page descriptors
+pd_t *page_map;
+uint64_t num_physical_page;
 
 
 /*======================================*/
@@ -125,8 +151,371 @@ void cpu_readinst_dram(uint64_t paddr, char *buf);
 void cpu_writeinst_dram(uint64_t paddr, const char *str);
 
 
-void bus_read_cacheline(uint64_t paddr, uint8_t *block);
-void bus_write_cacheline(uint64_t paddr, uint8_t *block);
+// raw DRAM access bypassing the SRAM cache, little-endian, any alignment
+uint8_t dram_read8(uint64_t paddr);
+uint16_t dram_read16(uint64_t paddr);
+uint32_t dram_read32(uint64_t paddr);
+uint64_t dram_read64(uint64_t paddr);
+void dram_write8(uint64_t paddr, uint8_t data);
+void dram_write16(uint64_t paddr, uint16_t data);
+void dram_write32(uint64_t paddr, uint32_t data);
+void dram_write64(uint64_t paddr, uint64_t data);
+
+// bulk transfer for the loaders and the kernel
+void dram_read(uint64_t paddr, void *buf, uint64_t size);
+void dram_write(uint64_t paddr, const void *buf, uint64_t size);
+void dram_fill(uint64_t paddr, uint8_t value, uint64_t size);
+
+
+/*======================================*/
+/*      DRAM timing                     */
+/*======================================*/
+
+// the state of the row buffer of the bank accessed
+typedef enum
+{
+    DRAM_ROW_HIT,       // the row is open: column access only
+    DRAM_ROW_EMPTY,     // no row is open: activate, then column access
+    DRAM_ROW_CONFLICT,  // another row is open: precharge, activate, column access
+} dram_row_status_t;
+
+typedef enum
+{
+    DRAM_OPEN_PAGE,     // keep the row open for the next access
+    DRAM_CLOSED_PAGE,   // precharge right after each access
+} dram_page_policy_t;
+
+// latencies are counted in CPU cycles
+// the numbers of channels, ranks, banks and the row size are powers of 2
+typedef struct{
+    int num_channels;
+    int num_ranks;          // ranks per channel
+    int num_banks;          // banks per rank
+    uint64_t row_size;      // bytes in one row of one bank
+
+    uint64_t tRCD;          // activate: row to column delay
+    uint64_t tCAS;          // column access strobe latency
+    uint64_t tRP;           // precharge
+    uint64_t tBURST;        // transfer of one cache line on the bus
+
+    dram_page_policy_t policy;
+} dram_timing_config_t;
+
+// about DDR4-2400 with a 3GHz CPU
+#define DEFAULT_DRAM_NUM_CHANNELS   (2)
+#define DEFAULT_DRAM_NUM_RANKS      (2)
+#define DEFAULT_DRAM_NUM_BANKS      (16)
+#define DEFAULT_DRAM_ROW_SIZE       (8192)
+#define DEFAULT_DRAM_TRCD           (42)
+#define DEFAULT_DRAM_TCAS           (42)
+#define DEFAULT_DRAM_TRP            (42)
+#define DEFAULT_DRAM_TBURST         (10)
+
+// fill the config with the default values above, open-page policy
+void dram_timing_default(dram_timing_config_t *config);
+// enable the timing model with the config, NULL disables it
+// all the rows are closed
+void dram_timing_config(const dram_timing_config_t *config);
+
+// the location of the physical address in the DRAM chips
+// address mapping, from the high bits: row | rank | bank | channel | column
+// the consecutive lines share one row, the consecutive rows are
+// interleaved across the channels, then the banks and ranks
+typedef struct{
+    uint64_t channel;
+    uint64_t rank;
+    uint64_t bank;
+    uint64_t row;
+    uint64_t column;
+} dram_address_t;
+
+dram_address_t dram_map_address(uint64_t paddr);
+
+// the timing of one cache line transfer
+// latency is 0 when the timing model is disabled
+typedef struct{
+    uint64_t latency;
+    dram_row_status_t row_status;
+} dram_access_t;
+
+typedef struct{
+    uint64_t read;
+    uint64_t write;
+    uint64_t row_hit;
+    uint64_t row_empty;
+    uint64_t row_conflict;
+    uint64_t latency;       // cycles of all the accesses
+    uint64_t untimed;       // accesses while the timing model is disabled
+} dram_stats_t;
+dram_stats_t dram_stats;
+
+void print_dram_stats();
+
+
+dram_access_t bus_read_cacheline(uint64_t paddr, uint8_t *block);
+dram_access_t bus_write_cacheline(uint64_t paddr, uint8_t *block);
+
+// the disk transfers the physical page by DMA, bypassing the SRAM cache
+// write back and invalidate the cached lines of this page before that
+void sram_cache_flush_page(uint64_t ppn);
+// write back and invalidate the whole cache
+void sram_cache_flush();
+
+
+/*======================================*/
+/*      SRAM cache                      */
+/*======================================*/
+
+// counted for each byte accessed by the CPU
+typedef struct{
+    uint64_t hit;
+    uint64_t miss;
+    uint64_t writeback;     // dirty lines written back to DRAM
+} sram_cache_stats_t;
+sram_cache_stats_t sram_cache_stats;
+
+void print_cache_stats();
+
+void sram_save_state(FILE *fp);
+void sram_load_state(FILE *fp);
+
+
+/*======================================*/
+/*      page table management           */
+/*======================================*/
+
+// page tables are stored in the simulated physical memory
+// allocate one zeroed physical page for a page table, return its PPN
+// a new address space is created by: cr3 = allocate_pagetable()
+uint64_t allocate_pagetable();
+
+// map the virtual page starting from vaddr to the physical page ppn
+// in the page table pointed by cr3
+// level: PAGE_LEVEL_4K, PAGE_LEVEL_2M or PAGE_LEVEL_1G
+// for large page, both vaddr and ppn must be aligned to the page size
+void map_page(uint64_t vaddr, uint64_t ppn, int level);
+
+// remove the 4KB page mapping of vaddr from the page table pointed by cr3
+// the physical page or the swap slot is released
+void unmap_page(uint64_t vaddr);
+
+// duplicate the address space of cr3 for the child process, return its PGD
+// the 4KB pages are shared readonly by both, and copied on the first write
+// the large pages are shared by both
+uint64_t fork_pagetable();
+
+
+/*======================================*/
+/*      swap space                      */
+/*======================================*/
+
+#define DEFAULT_SWAP_NUM_SLOTS  (1024)
+
+// create the swap device file with num_slots 4KB slots
+// called lazily with DEFAULT_SWAP_NUM_SLOTS if not called before use
+void swap_init(uint64_t num_slots);
+
+// slot 0 is never allocated: daddr = 0 means no swap slot
+uint64_t swap_alloc_slot();
+void swap_free_slot(uint64_t daddr);
+// the slot is shared by the PTEs of the forked processes
+// swap_free_slot releases it when the last PTE drops it
+void swap_dup_slot(uint64_t daddr);
+uint64_t swap_slot_count(uint64_t daddr);
+
+// transfer one physical page from/to the swap slot
+int swap_in(uint64_t daddr, uint64_t ppn);
+int swap_out(uint64_t daddr, uint64_t ppn);
+// read the consecutive slots [daddr, daddr + n) into the frames
+// the batch is the following entries of one page table at most
+#define MAX_SWAP_BATCH (PAGE_TABLE_ENTRY_NUM - 1)
+int swap_in_batch(uint64_t daddr, uint64_t *ppns, uint64_t n);
+
+// copy the page and queue it for the writeback daemon, return at once
+// swap_in of the slot is served from the queue until it is written
+void swap_out_async(uint64_t daddr, uint64_t ppn);
+// the same for the page in the host buffer
+void swap_write_async(uint64_t daddr, const uint8_t *page);
+// wait until all the queued pages are written to the swap device
+void swap_sync();
+
+typedef struct{
+    uint64_t slot_used;
+    uint64_t page_in;
+    uint64_t page_out;
+
+    uint64_t read_batch;        // pread/preadv calls
+    uint64_t write_batch;       // pwritev calls of the writeback daemon
+    uint64_t writeback_stall;   // swap out waited for the full queue
+    uint64_t writeback_hit;     // swap in served from the writeback queue
+} swap_stats_t;
+swap_stats_t swap_stats;
+
+void print_swap_stats();
+
+// the slot metadata and the pages of the slots in use
+void swap_save_state(FILE *fp);
+void swap_load_state(FILE *fp);
+
+
+/*======================================*/
+/*      compressed swap cache (zswap)   */
+/*======================================*/
+
+// the pool size in bytes. 0 disables zswap
+#define DEFAULT_ZSWAP_POOL_SIZE (0)
+void zswap_config(uint64_t pool_size);
+
+// compress the page into the pool as the content of the swap slot
+// the oldest pages are written to the swap device when the pool is full
+// return 0 if not stored: write the page to the swap device instead
+int zswap_store(uint64_t daddr, uint64_t ppn);
+// return 1 if the page of the swap slot is found in the pool
+int zswap_load(uint64_t daddr, uint64_t ppn);
+int zswap_contains(uint64_t daddr);
+void zswap_invalidate(uint64_t daddr);
+
+typedef struct{
+    uint64_t stored_pages;
+    uint64_t pool_bytes;
+
+    uint64_t store;
+    uint64_t same_filled;   // stored as one word, no data in the pool
+    uint64_t reject;        // compressed size exceeds the limit
+    uint64_t writeback;     // moved to the swap device for the full pool
+    uint64_t load_hit;
+    uint64_t load_miss;
+
+    uint64_t compressed_in;     // bytes before compression
+    uint64_t compressed_out;    // bytes after compression
+} zswap_stats_t;
+zswap_stats_t zswap_stats;
+
+void print_zswap_stats();
+
+void zswap_save_state(FILE *fp);
+void zswap_load_state(FILE *fp);
+
+
+/*======================================*/
+/*      physical frame management       */
+/*======================================*/
+
+// create the page descriptors and the free frame list for num_pages frames
+// the physical memory is enlarged to hold them if required
+// the descriptors of the frames never used are not touched: O(1) for any size
+// called lazily with MAX_NUM_PHYSICAL_PAGE if not called before use
+void frame_allocator_init(uint64_t num_pages);
+
+// pop one free frame in O(1)
+// when there is no free frame, CLOCK replacement reclaims one
+uint64_t allocate_frame();
+void free_frame(uint64_t ppn);
+// drop the mapping of the PTE at pte_paddr to the frame
+// the frame is freed with its last mapping
+void put_frame(uint64_t ppn, uint64_t pte_paddr);
+
+// add or remove the PTE at pte_paddr in the reversed mapping of the frame
+void page_add_rmap(uint64_t ppn, uint64_t pte_paddr, uint64_t vaddr);
+void page_remove_rmap(uint64_t ppn, uint64_t pte_paddr);
+
+// the swap slot is not used by any PTE any more
+void release_swap_entry(uint64_t daddr);
+
+// the PTE at physical address pte_paddr is not present for vaddr,
+// or it is readonly for the write
+//  never mapped:   demand-zero page, the shared zero page for the read
+//  swapped out:    bring the page back from swap space
+//  copy on write:  copy the shared page for the write
+void page_fault_handler(uint64_t pte_paddr, uint64_t vaddr, int write);
+
+// under memory pressure, the dirty frames not referenced recently are
+// written back in advance: keep low_watermark clean frames for CLOCK
+// 0 disables the writeback
+#define DEFAULT_WRITEBACK_LOW_WATERMARK (2)
+void writeback_config(uint64_t low_watermark);
+
+// on the swap in, read at most window following pages into free frames
+// when they are in the following swap slots. 0 disables the readahead
+// the window is limited to MAX_SWAP_BATCH
+#define DEFAULT_SWAP_READAHEAD_WINDOW (7)
+void swap_readahead_config(uint64_t window);
+
+typedef struct{
+    uint64_t page_fault;
+    uint64_t evict_clean;   // reclaimed without writing to swap space
+    uint64_t evict_dirty;   // written to swap space before reclaimed
+    uint64_t clock_scan;    // frames visited by the CLOCK hand
+    uint64_t writeback;     // dirty frames cleaned ahead of the reclaim
+
+    uint64_t readahead;         // pages read ahead from swap space
+    uint64_t readahead_hit;     // faults served by the pages read ahead
+    uint64_t readahead_waste;   // pages read ahead but reclaimed before use
+
+    uint64_t demand_zero;   // zeroed frames for the first write
+    uint64_t file_page;     // pages read from the images of the file-backed areas
+    uint64_t zero_page;     // first reads mapped to the shared zero page
+    uint64_t cow_copy;      // shared pages copied on write
+    uint64_t cow_reuse;     // the last mapping of the shared page made writable
+    uint64_t swap_cache_hit;    // swapped in by the other mapping of the shared page
+    uint64_t unmap_shared;      // PTEs unmapped by the eviction of the shared pages
+} pagefault_stats_t;
+pagefault_stats_t pagefault_stats;
+
+void print_pagefault_stats();
+
+// page_map with the reversed mappings, the free frames and the swap cache
+void frame_save_state(FILE *fp);
+void frame_load_state(FILE *fp);
+
+
+/*======================================*/
+/*      virtual memory areas            */
+/*======================================*/
+
+// the areas of the address space created by the loader
+// the page in a file-backed area is read from its image at the first touch,
+// the other pages are demand-zero
+// the areas may share one page: it is writable only if all of them are,
+// so the page holding any code is never writable
+
+// image: the contents of [start, start + size) owned by the area, NULL for anonymous
+void vma_add(uint64_t cr3, uint64_t start, uint64_t size, int writable, uint8_t *image);
+// the child address space of fork has the same areas, with their own images
+void vma_fork(uint64_t parent, uint64_t child);
+
+// return 1 if the page of vaddr is in a file-backed area of cr3
+int vma_file_page(uint64_t cr3, uint64_t vaddr, int *writable);
+// copy the images of the page of vaddr into the zeroed frame ppn
+void vma_fill_page(uint64_t cr3, uint64_t vaddr, uint64_t ppn);
+
+void vma_save_state(FILE *fp);
+void vma_load_state(FILE *fp);
+
+// the stack of the loaded program
+#define STACK_TOP   (0x7ffffffff000)
+#define STACK_SIZE  (0x800000)
+
+
+/*======================================*/
+/*      checkpoint                      */
+/*======================================*/
+
+// the whole state of the simulated machine in one binary file:
+//  registers, flags, PC, control registers, the random generators
+//  TLB, paging-structure caches, SRAM cache
+//  page_map, the frame allocator, the swap slots and zswap
+//  the virtual memory areas
+//  physical memory, holding the page tables
+// the physical memory is written as a sparse file: the zero pages are holes
+// the configs of the models and the statistics are not saved
+void checkpoint_save(const char *path);
+// the physical memory is mapped from the file, loaded lazily on the first touch
+void checkpoint_restore(const char *path);
+
+// used by the modules to write and read their state
+void checkpoint_write(FILE *fp, const void *buf, uint64_t size);
+void checkpoint_read(FILE *fp, void *buf, uint64_t size);
 
 
 
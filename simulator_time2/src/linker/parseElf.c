@@ -210,7 +210,8 @@ static void parse_relocation(char *str, rl_entry_t *rte){
 
 
 
-static int read_elf(const char *filename, uint64_t bufaddr){
+// the buffer grows with the lines of the file
+static int read_elf(const char *filename, elf_line_t **bufptr){
     // open file and read 
     FILE *fp;
     fp = fopen(filename, "r");
@@ -222,6 +223,8 @@ static int read_elf(const char *filename, uint64_t bufaddr){
     // read text file line by line
     char line[MAX_ELF_FILE_WIDTH];
     int line_counter = 0;
+    elf_line_t *buffer = NULL;
+    int capacity = 0;
 
     while (fgets(line, MAX_ELF_FILE_WIDTH, fp) != NULL){
         
@@ -249,38 +252,41 @@ static int read_elf(const char *filename, uint64_t bufaddr){
         // to this line, this line is not white and contains information
 
 
-        if (line_counter < MAX_ELF_FILE_LENGTH){
-            // store this line to buffer[line_counter]！！
-            uint64_t addr = bufaddr + line_counter * MAX_ELF_FILE_WIDTH * sizeof(char);
-            char *linebuf = (char *)addr;
+        // grow the buffer: double the lines
+        if (line_counter == capacity){
+            capacity = capacity == 0 ? 64 : 2 * capacity;
+            buffer = realloc(buffer, capacity * sizeof(elf_line_t));
+            assert(buffer != NULL);
+        }
+        // store this line to buffer[line_counter]！！
+        char *linebuf = buffer[line_counter];
 
-            int i = 0;
-            while (i < len && i < MAX_ELF_FILE_WIDTH){
+        int i = 0;
+        while (i < len && i < MAX_ELF_FILE_WIDTH){
 
-                if ((line[i] == '\n') ||
-                    (line[i] == '\r') ||
-                    (((i + 1) < len) &&
-                     ((i + 1) < MAX_ELF_FILE_WIDTH) &&
-                    line[i] == '/' && line[i + 1] == '/')){
+            if ((line[i] == '\n') ||
+                (line[i] == '\r') ||
+                (((i + 1) < len) &&
+                 ((i + 1) < MAX_ELF_FILE_WIDTH) &&
+                line[i] == '/' && line[i + 1] == '/')){
 
-                        break;
-                }
-                linebuf[i] = line[i];
-                i++; 
+                    break;
             }
-            linebuf[i] = '\0';
-            line_counter++;
+            linebuf[i] = line[i];
+            i++; 
         }
-        else {
-            debug_printf(DEBUG_LINKER, "elf file %s is too long (> %d)\n", filename, MAX_ELF_FILE_LENGTH);
-            fclose(fp);
-            exit(1);
+        // the white space before the comment
+        while (i > 0 && (linebuf[i - 1] == ' ' || linebuf[i - 1] == '\t')){
+            i--;
         }
+        linebuf[i] = '\0';
+        line_counter++;
 
         
     }
     fclose(fp);
-    assert(string2uint((char *)bufaddr) == line_counter);
+    assert(line_counter > 0 && string2uint(buffer[0]) == line_counter);
+    *bufptr = buffer;
     return line_counter;
 }
 
@@ -310,8 +316,8 @@ static void init_dictionary(){
 void parse_elf(const char *filename, elf_t *elf){
 
     assert(elf != NULL);
-    elf->line_count = read_elf(filename, (uint64_t)(&(elf->buffer)));
-    // int line_counter = read_elf(filename, (uint64_t)(&(elf->buffer)));
+    memset(elf, 0, sizeof(elf_t));
+    elf->line_count = read_elf(filename, &elf->buffer);
     for (int i = 0; i < elf->line_count; i++){
         printf("[%d]\t%s\n", i, elf->buffer[i]);
     }
@@ -431,9 +437,23 @@ void write_eof(const char *filename, elf_t *eof){
 
 
 
+void alloc_elf(elf_t *elf, uint64_t line_count){
+    assert(elf != NULL);
+    memset(elf, 0, sizeof(elf_t));
+    elf->line_count = line_count;
+    elf->buffer = calloc(line_count ? line_count : 1, sizeof(elf_line_t));
+    assert(elf->buffer != NULL);
+}
+
+
 void free_elf(elf_t *elf){
     assert(elf != NULL);
     
+    if (elf->buffer != NULL){
+        free(elf->buffer);
+        elf->buffer = NULL;
+    }
+
 
     if (elf->sht != NULL){
         free(elf->sht);
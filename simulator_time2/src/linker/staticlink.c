@@ -8,8 +8,11 @@
 
 
 
-#define MAX_SYMBOL_MAP_LENGTH 64
 #define MAX_SECTION_BUFFER_LENGTH 64
+// the sections loaded start at the page boundary
+// so the page of .text, readonly, is never shared with .data
+#define SECTION_ALIGNMENT (4096)
+#define ALIGN_SECTION(addr) (((addr) + SECTION_ALIGNMENT - 1) & ~(uint64_t)(SECTION_ALIGNMENT - 1))
 #define MAX_RELOCATION_LINES 64
 
 // internal mapping between source and destination symbol entries
@@ -20,6 +23,33 @@ typedef struct{
     st_entry_t  *dst;   // dst symbol: used for relocation - find the function referencing the undefined symbol
 }smap_t;
 
+// the lookups of the symbols are O(1), linking is linear in the number of symbols
+// name -> index in smap_table of the global symbol
+// open addressing, at most half full, -1 - empty slot
+static int *global_symbols = NULL;
+static uint64_t global_symbols_mask = 0;
+// smap_index[i][j]: index in smap_table of srcs[i]->symt[j], or -1 if it is not cached
+static int **smap_index = NULL;
+
+// FNV-1a
+static uint64_t symbol_hash(const char *name){
+    uint64_t h = 0xcbf29ce484222325;
+    for (; *name != '\0'; ++ name){
+        h ^= (uint8_t)*name;
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+// the slot of the global symbol name, or the empty slot for it
+static int *find_global_symbol(smap_t *smap_table, const char *name){
+    uint64_t i = symbol_hash(name) & global_symbols_mask;
+    while (global_symbols[i] >= 0 && strcmp(smap_table[global_symbols[i]].src->st_name, name) != 0){
+        i = (i + 1) & global_symbols_mask;
+    }
+    return &global_symbols[i];
+}
+
 
 /* ------------------------------------ */
 /* Symbol Processing                    */
@@ -43,6 +73,18 @@ static void merge_section(elf_t **srcs, int num_srcs, elf_t *dst,
 static void relocation_processing(elf_t **srcs, int num_srcs, elf_t *dst,
     smap_t *smap_table, int *smap_count);
 
+// the lines of one symbol in its section, inclusive
+typedef struct{
+    uint64_t start;
+    uint64_t end;
+    int index;      // in symt
+} sym_range_t;
+
+// the symbols of the section in one ELF, sorted by st_value
+static sym_range_t *section_ranges(elf_t *elf, const char *section, int *count);
+// the index in symt of the symbol holding the row, or -1
+static int find_range(sym_range_t *ranges, int count, uint64_t row);
+
 static void R_X86_64_32_handler(elf_t *dst, sh_entry_t *sh,
     int row_referencing, int col_referencing, int addend,
     st_entry_t *sym_referenced);
@@ -85,12 +127,18 @@ void link_elf(elf_t **srcs, int num_srcs, elf_t *dst){
     memset(dst, 0, sizeof(elf_t));
 
     // create the map table to connect the source elf files and destination elf file symbols
+    // at most one entry for each source symbol
+    uint64_t num_symbols = 0;
+    for (int i = 0; i < num_srcs; ++ i){
+        num_symbols += srcs[i]->symt_count;
+    }
     int smap_count = 0;
-    smap_t smap_table[MAX_SYMBOL_MAP_LENGTH];
+    smap_t *smap_table = calloc(num_symbols ? num_symbols : 1, sizeof(smap_t));
+    assert(smap_table != NULL);
 
     // update the smap table - symbol processing
     symbol_processing(srcs, num_srcs, dst,
-        (smap_t *)&smap_table, &smap_count);
+        smap_table, &smap_count);
     
 
     printf("================================================================\n");
@@ -140,14 +188,41 @@ void link_elf(elf_t **srcs, int num_srcs, elf_t *dst){
     }
     // printf("\t\t\t\t\t\t\tfinished\n");
 
+    free(global_symbols);
+    global_symbols = NULL;
+    for (int i = 0; i < num_srcs; ++ i){
+        free(smap_index[i]);
+    }
+    free(smap_index);
+    smap_index = NULL;
+    free(smap_table);
+
     
 }
 
 static void symbol_processing(elf_t **srcs, int num_srcs, elf_t *dst,
     smap_t *smap_table, int *smap_count){
 
+        uint64_t num_symbols = 0;
+        for (int i = 0; i < num_srcs; ++ i){
+            num_symbols += srcs[i]->symt_count;
+        }
+        uint64_t num_slots = 2;
+        while (num_slots < 2 * num_symbols){
+            num_slots <<= 1;
+        }
+        global_symbols = malloc(num_slots * sizeof(int));
+        assert(global_symbols != NULL);
+        memset(global_symbols, 0xff, num_slots * sizeof(int));
+        global_symbols_mask = num_slots - 1;
+
+        smap_index = calloc(num_srcs ? num_srcs : 1, sizeof(int *));
+        assert(smap_index != NULL);
+
         for (int i = 0; i < num_srcs; ++i){
             elf_t *elfp = srcs[i];
+            smap_index[i] = calloc(elfp->symt_count ? elfp->symt_count : 1, sizeof(int));
+            assert(smap_index[i] != NULL);
 
             // for every elf files
             for (int j = 0; j < elfp->symt_count; j++){
@@ -157,35 +232,31 @@ static void symbol_processing(elf_t **srcs, int num_srcs, elf_t *dst,
                 if (sym->bind == STB_LOCAL){
                     // insert the static (local) symbol to new elf with confidence:
                     // compiler would check if the symbol is redeclared in one *.c file
-                    assert(*smap_count < MAX_SYMBOL_MAP_LENGTH);
                     // even if local symbol has the same name, just insert it into dst
                     smap_table[*smap_count].src = sym;
                     smap_table[*smap_count].elf = elfp;
+                    // the local symbol is never replaced
+                    smap_index[i][j] = *smap_count;
                     // we have not created dst here
                     (*smap_count) ++;
                 }
                 else if (sym->bind == STB_GLOBAL){
                     // for other bind: STB_GLOBAL, etc. it's possible to have name conflict
                     // check if this symbol has been cached in the map
-                    for (int k = 0; k < *smap_count; ++ k){
-                        // check name conflict
-                        // what if the cached symbol is STB_LOCAL?
-                        st_entry_t *candidate = smap_table[k].src;
-                        if (candidate->bind == STB_GLOBAL &&
-                            (strcmp(candidate->st_name, sym->st_name) == 0)){
-
-                            // having name conflict, do simple symbol resolution
-                            // pick one symbol from current sym and cached map[k]
-                            simple_resolution(sym, elfp, &smap_table[k]);
-                            goto NEXT_SYMBOL_PROCESS;
-                        }
+                    // only the global symbols are in the table: no conflict with STB_LOCAL
+                    int *slot = find_global_symbol(smap_table, sym->st_name);
+                    if (*slot >= 0){
+                        // having name conflict, do simple symbol resolution
+                        // pick one symbol from current sym and cached map[k]
+                        simple_resolution(sym, elfp, &smap_table[*slot]);
+                        goto NEXT_SYMBOL_PROCESS;
                     }
                     // not find any name conflict
                     // cache current symbol sym to the map since there is no name conflict
-                    assert(*smap_count <= MAX_SYMBOL_MAP_LENGTH);
                     // update map table
                     smap_table[*smap_count].src = sym;
                     smap_table[*smap_count].elf = elfp;
+                    *slot = *smap_count;
                     (*smap_count) ++;
                 }
                 NEXT_SYMBOL_PROCESS:
@@ -198,6 +269,20 @@ static void symbol_processing(elf_t **srcs, int num_srcs, elf_t *dst,
         }
 
         // all the elf files have been processed
+        // index the global symbols: only the one picked by the resolution is cached
+        for (int i = 0; i < num_srcs; ++ i){
+            for (int j = 0; j < srcs[i]->symt_count; ++ j){
+                st_entry_t *sym = &srcs[i]->symt[j];
+                if (sym->bind == STB_GLOBAL){
+                    int k = *find_global_symbol(smap_table, sym->st_name);
+                    smap_index[i][j] = smap_table[k].src == sym ? k : -1;
+                }
+                else if (sym->bind != STB_LOCAL){
+                    smap_index[i][j] = -1;
+                }
+            }
+        }
+
         // cleanup: check if there is any undefined symbols in the map table
         for (int i = 0; i < *smap_count; ++ i){
             st_entry_t *s = smap_table[i].src;
@@ -349,16 +434,19 @@ static void compute_section_header(elf_t *dst, smap_t *smap_table, int *smap_cou
     dst->sht_count = (count_text != 0) + (count_rodata != 0) + (count_data != 0) + 1;
     // count the total lines
     dst->line_count = 1 + 1 + dst->sht_count + count_text + count_rodata + count_data + *smap_count;
+    // the buffer holds all the lines of the EOF
+    dst->buffer = calloc(dst->line_count, sizeof(elf_line_t));
+    assert(dst->buffer != NULL);
     // the target dst: line_count, sht_count, sht, .text, .rodata, .data, .symtab
     // print to buffer
     sprintf(dst->buffer[0], "%ld", dst->line_count);
     sprintf(dst->buffer[1], "%ld", dst->sht_count);
 
 
-    // compute the run-time address of the sections: compact in memory
+    // compute the run-time address of the sections: each one from a new page
     uint64_t text_runtime_addr = 0x00400000;    // 虚拟地址中从0x00400000开始的地址是只读状态，故从这里开始写代码段
-    uint64_t rodata_runtime_addr = text_runtime_addr + count_text * MAX_INSTRUCTION_CHAR * sizeof(char);
-    uint64_t data_runtime_addr = rodata_runtime_addr + count_rodata * sizeof(uint64_t);
+    uint64_t rodata_runtime_addr = ALIGN_SECTION(text_runtime_addr + count_text * MAX_INSTRUCTION_CHAR * sizeof(char));
+    uint64_t data_runtime_addr = ALIGN_SECTION(rodata_runtime_addr + count_rodata * sizeof(uint64_t));
     uint64_t symtab_runtime_addr = 0; // For EOF, .symtab is not loaded into run-time memory but still on disk
 
     // write the section header table
@@ -534,54 +622,51 @@ static void merge_section(elf_t **srcs, int num_srcs, elf_t *dst,
                         //先对比当前所遍历的symbol所在的节名字是否与目标section一致
                         if (strcmp(sym->st_shndx, target_sh->sh_name) == 0){
                             
-                            // 一致则继续遍历smap_table中源相同的symbol
-                            for (int k = 0; k < *smap_count; ++ k){
-                                // scan the cached dst symbols to check
-                                // if this symbol should be merged into this section
-                                // 对比是否是同一个symbol
-                                if (sym == smap_table[k].src){
-                                    // 如果是，则进行处理
-                                    
-                                    
-                                    // exactly the cached symbol
-                                    printf("\t\tsymbol '%s'\n", sym->st_name);
-                                    // this symbol should be merged into dst's section target_sh
-                                    // copy this symbol from srcs[i].buffer into dst.buffer
-                                    // srcs[i].buffer[sh_offset + st_value, sh_offset + st_value + st_size] inclusive
-                                    for (int t = 0; t < sym->st_size; ++ t){
-                                        int dst_index = line_written + t;
-                                        int src_index = srcs[i]->sht[src_section_index].sh_offset + sym->st_value + t;
-
-                                        assert(dst_index < MAX_ELF_FILE_LENGTH);
-                                        assert(src_index < MAX_ELF_FILE_LENGTH);
-
-                                        strcpy(
-                                            dst->buffer[dst_index],
-                                            srcs[i]->buffer[src_index]);
-                                    }
-                                    // copy the symbol table entry from srcs[i].symt[j] to
-                                    // dst.symt[symt_written]
-                                    assert(symt_written < dst->symt_count);
-                                    // copy the entry
-                                    strcpy(dst->symt[symt_written].st_name, sym->st_name);
-                                    dst->symt[symt_written].bind = sym->bind;
-                                    dst->symt[symt_written].type = sym->type;
-                                    strcpy(dst->symt[symt_written].st_shndx, sym->st_shndx);
-                                    // MUST NOT BE A COMMON, so the section offset MUST NOT BE alignment
-                                    dst->symt[symt_written].st_value = sym_section_offset;
-                                    dst->symt[symt_written].st_size = sym->st_size;
-
-                                    // update the smap_table
-                                    // this will help the relocation
-                                    smap_table[k].dst = &dst->symt[symt_written];
-
-                                    // udpate the counter
-                                    symt_written += 1;
-                                    line_written += sym->st_size;
-                                    sym_section_offset += sym->st_size;
-
-                                    
+                            // 一致则找到smap_table中源相同的symbol
+                            // check if this symbol should be merged into this section
+                            int k = smap_index[i][j];
+                            if (k >= 0){
+                                // 如果是，则进行处理
+                                
+                                
+                                // exactly the cached symbol
+                                printf("\t\tsymbol '%s'\n", sym->st_name);
+                                // this symbol should be merged into dst's section target_sh
+                                // copy this symbol from srcs[i].buffer into dst.buffer
+                                // srcs[i].buffer[sh_offset + st_value, sh_offset + st_value + st_size] inclusive
+                                for (int t = 0; t < sym->st_size; ++ t){
+                                    int dst_index = line_written + t;
+                                    int src_index = srcs[i]->sht[src_section_index].sh_offset + sym->st_value + t;
+
+                                    assert(dst_index < dst->line_count);
+                                    assert(src_index < srcs[i]->line_count);
+
+                                    strcpy(
+                                        dst->buffer[dst_index],
+                                        srcs[i]->buffer[src_index]);
                                 }
+                                // copy the symbol table entry from srcs[i].symt[j] to
+                                // dst.symt[symt_written]
+                                assert(symt_written < dst->symt_count);
+                                // copy the entry
+                                strcpy(dst->symt[symt_written].st_name, sym->st_name);
+                                dst->symt[symt_written].bind = sym->bind;
+                                dst->symt[symt_written].type = sym->type;
+                                strcpy(dst->symt[symt_written].st_shndx, sym->st_shndx);
+                                // MUST NOT BE A COMMON, so the section offset MUST NOT BE alignment
+                                dst->symt[symt_written].st_value = sym_section_offset;
+                                dst->symt[symt_written].st_size = sym->st_size;
+
+                                // update the smap_table
+                                // this will help the relocation
+                                smap_table[k].dst = &dst->symt[symt_written];
+
+                                // udpate the counter
+                                symt_written += 1;
+                                line_written += sym->st_size;
+                                sym_section_offset += sym->st_size;
+
+                                
                             }
                             // symbol srcs[i].symt[j] has been checked
                         }
@@ -635,161 +720,135 @@ static void relocation_processing(elf_t **srcs, int num_srcs, elf_t *dst,
         elf_t *elf = srcs[i];
 
         // .rel.text
+        // the referencing symbol is the .text symbol holding r_row
+        int num_ranges = 0;
+        sym_range_t *ranges = section_ranges(elf, ".text", &num_ranges);
         for (int j = 0; j < elf->reltext_count; ++ j){
             rl_entry_t *r = &elf->reltext[j];
 
-            // search the referencing symbol
-            for (int k = 0; k < elf->symt_count; ++ k){
-                st_entry_t *sym = &elf->symt[k];
-                
-
-                // 当前部分处理text的重定位
-                // 故只筛选出位于.text的symbol
-                if (strcmp(sym->st_shndx, ".text") == 0){
-                    // must be referenced by a .text symbol
-                    // check if this symbol is the one referencing
-                    int sym_text_start = sym->st_value;
-                    int sym_text_end = sym->st_value + sym->st_size - 1;
-
-                    // 并筛选出使r在symbol所定义的.text段范围内的symbol（比如main， sum函数）
-                    if (sym_text_start <= r->r_row && r->r_row <= sym_text_end){
-                        // symt[k] is referencing reltext[j].sym
-                        // search the smap table to find the EOF location
-                        int smap_found = 0;
-
-                        // 找到当前要重定位的symbol后，在smap数组中搜索对应的smap
-                        for (int t = 0; t < *smap_count; ++ t){
-                            if (smap_table[t].src == sym){
-                                smap_found = 1;
-                                // 找到处理后的EOF的symbol,后面用来计算修改的位置
-                                st_entry_t *eof_referencing = smap_table[t].dst;
-
-                                // search the being referenced symbol
-                                for (int u = 0; u < *smap_count; ++ u){
-                                    // what is the EOF symbol name?
-                                    // how to get the referenced symbol name
-
-
-                                    // 将要修改的地方改到目标symbol处，第一步先找到r中的目标symbol
-                                    if (strcmp(elf->symt[r->sym].st_name, smap_table[u].dst->st_name) == 0 &&
-                                        smap_table[u].dst->bind == STB_GLOBAL){
-                                        // till now, the referencing row and referenced row are all found
-                                        // update the location
-                                        st_entry_t *eof_referenced = smap_table[u].dst;
-
-                                        (handler_table[(int)r->type])(
-                                            dst, eof_text_sh,
-                                            // r_offset  - ELF main.st_value + EOF main.st_value
-                                            r->r_row - sym->st_value + eof_referencing->st_value, 
-                                            r->r_col, 
-                                            r->r_addend,
-                                            eof_referenced);
-                                        goto NEXT_REFERENCE_IN_TEXT;
-                                    }
-                                }
-                            }
-                        }
-                        // referencing must be in smap_table
-                        // because it has definition, is a strong symbol
-                        assert(smap_found == 1);
-                    }
-                }
+            int k = find_range(ranges, num_ranges, r->r_row);
+            if (k < 0){
+                continue;
+            }
+            st_entry_t *sym = &elf->symt[k];
+
+            // referencing must be in smap_table
+            // because it has definition, is a strong symbol
+            int t = smap_index[i][k];
+            assert(t >= 0);
+            // 找到处理后的EOF的symbol,后面用来计算修改的位置
+            st_entry_t *eof_referencing = smap_table[t].dst;
+
+            // search the being referenced symbol by its name
+            int u = *find_global_symbol(smap_table, elf->symt[r->sym].st_name);
+            if (u >= 0){
+                // till now, the referencing row and referenced row are all found
+                // update the location
+                st_entry_t *eof_referenced = smap_table[u].dst;
+
+                (handler_table[(int)r->type])(
+                    dst, eof_text_sh,
+                    // r_offset  - ELF main.st_value + EOF main.st_value
+                    r->r_row - sym->st_value + eof_referencing->st_value, 
+                    r->r_col, 
+                    r->r_addend,
+                    eof_referenced);
             }
-NEXT_REFERENCE_IN_TEXT:
-            ;
         }
+        free(ranges);
 
         // .rel.data
+        // the referencing symbol is the .data symbol holding r_row
+        ranges = section_ranges(elf, ".data", &num_ranges);
         for (int j = 0; j < elf->reldata_count; ++ j){
             rl_entry_t *r = &elf->reldata[j];
 
-            // search the referencing symbol
-            for (int k = 0; k < elf->symt_count; ++ k){
-                st_entry_t *sym = &elf->symt[k];
-
-                if (strcmp(sym->st_shndx, ".data") == 0){
-                    // must be referenced by a .data symbol
-                    // check if this symbol is the one referencing
-                    int sym_data_start = sym->st_value;
-                    int sym_data_end = sym->st_value + sym->st_size - 1;
-
-                    if (sym_data_start <= r->r_row && r->r_row <= sym_data_end){
-                        // symt[k] is referencing reldata[j].sym
-                        // search the smap table to find the EOF location
-                        int smap_found = 0;
-                        for (int t = 0; t < *smap_count; ++ t){
-                            if (smap_table[t].src == sym){
-                                smap_found = 1;
-                                st_entry_t *eof_referencing = smap_table[t].dst;
-
-                                // search the being referenced symbol
-                                for (int u = 0; u < *smap_count; ++ u){
-                                    // what is the EOF symbol name?
-                                    // how to get the referenced symbol name
-                                    if (strcmp(elf->symt[r->sym].st_name, smap_table[u].dst->st_name) == 0 &&
-                                        smap_table[u].dst->bind == STB_GLOBAL){
-                                        // till now, the referencing row and referenced row are all found
-                                        // update the location
-                                        st_entry_t *eof_referenced = smap_table[u].dst;
-
-                                        (handler_table[(int)r->type])(
-                                            dst, eof_data_sh,
-                                            r->r_row - sym->st_value + eof_referencing->st_value, 
-                                            r->r_col, 
-                                            r->r_addend,
-                                            eof_referenced);
-                                        goto NEXT_REFERENCE_IN_DATA;
-                                    }
-                                }
-                            }
-                        }
-                        // referencing must be in smap_table
-                        // because it has definition, is a strong symbol
-                        assert(smap_found == 1);
-                    }
-                }
+            int k = find_range(ranges, num_ranges, r->r_row);
+            if (k < 0){
+                continue;
+            }
+            st_entry_t *sym = &elf->symt[k];
+
+            int t = smap_index[i][k];
+            assert(t >= 0);
+            st_entry_t *eof_referencing = smap_table[t].dst;
+
+            // search the being referenced symbol by its name
+            int u = *find_global_symbol(smap_table, elf->symt[r->sym].st_name);
+            if (u >= 0){
+                st_entry_t *eof_referenced = smap_table[u].dst;
+
+                (handler_table[(int)r->type])(
+                    dst, eof_data_sh,
+                    r->r_row - sym->st_value + eof_referencing->st_value, 
+                    r->r_col, 
+                    r->r_addend,
+                    eof_referenced);
             }
-NEXT_REFERENCE_IN_DATA:
-            ;
         }
+        free(ranges);
     }
 }
 
 
-// relocating handlers
+static int compare_range(const void *a, const void *b){
+    const sym_range_t *x = a;
+    const sym_range_t *y = b;
+    return x->start < y->start ? -1 : (x->start > y->start);
+}
 
-static uint64_t get_symbol_runtime_address(elf_t *dst, st_entry_t *sym){
-    // get the run-time address of symbol
-    uint64_t base = 0x00400000;
 
-    uint64_t text_base = base;
-    uint64_t rodata_base = base;
-    uint64_t data_base = base;
+static sym_range_t *section_ranges(elf_t *elf, const char *section, int *count){
 
-    int inst_size = sizeof(inst_t);
-    int data_size = sizeof(uint64_t);
+    sym_range_t *ranges = calloc(elf->symt_count ? elf->symt_count : 1, sizeof(sym_range_t));
+    assert(ranges != NULL);
 
-    // must visit in .text, .rodata, .data order
-    sh_entry_t *sht = dst->sht;
-    for (int i = 0; i < dst->sht_count; ++ i){
-        if (strcmp(sht[i].sh_name, ".text") == 0){
-            rodata_base = text_base + sht[i].sh_size * inst_size;
-            data_base = rodata_base;
-        }
-        else if (strcmp(sht[i].sh_name, ".rodata") == 0){
-            data_base = rodata_base + sht[i].sh_size * data_size;
+    *count = 0;
+    for (int k = 0; k < elf->symt_count; ++ k){
+        st_entry_t *sym = &elf->symt[k];
+        // the symbol without lines holds no row
+        if (sym->st_size > 0 && strcmp(sym->st_shndx, section) == 0){
+            ranges[*count].start = sym->st_value;
+            ranges[*count].end = sym->st_value + sym->st_size - 1;
+            ranges[*count].index = k;
+            (*count) ++;
         }
     }
+    qsort(ranges, *count, sizeof(sym_range_t), compare_range);
+    return ranges;
+}
+
+
+static int find_range(sym_range_t *ranges, int count, uint64_t row){
 
-    // check this symbol's section
-    if (strcmp(sym->st_shndx, ".text") == 0){
-        return text_base + inst_size * sym->st_value;
+    // the last range starting at or before the row
+    int lo = 0, hi = count;
+    while (lo < hi){
+        int mid = lo + (hi - lo) / 2;
+        if (ranges[mid].start <= row){
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
     }
-    else if (strcmp(sym->st_shndx, ".rodata") == 0){
-        return rodata_base + data_size * sym->st_value;
+    if (lo == 0 || row > ranges[lo - 1].end){
+        return -1;
     }
-    else if (strcmp(sym->st_shndx, ".data") == 0){
-        return data_base + data_size * sym->st_value;
+    return ranges[lo - 1].index;
+}
+
+
+// relocating handlers
+
+static uint64_t get_symbol_runtime_address(elf_t *dst, st_entry_t *sym){
+    // the run-time address of the section is in the section header table
+    // the instructions take MAX_INSTRUCTION_CHAR bytes each, like in the loader
+    for (int i = 0; i < dst->sht_count; ++ i){
+        if (strcmp(dst->sht[i].sh_name, sym->st_shndx) == 0){
+            uint64_t slot = strcmp(sym->st_shndx, ".text") == 0 ? MAX_INSTRUCTION_CHAR : sizeof(uint64_t);
+            return dst->sht[i].sh_addr + slot * sym->st_value;
+        }
     }
 
     return 0xFFFFFFFFFFFFFFFF;
@@ -827,7 +886,7 @@ static void R_X86_64_PC32_handler(elf_t *dst, sh_entry_t *sh,
     assert(strcmp(sh->sh_name, ".text") == 0);
 
     uint64_t sym_address = get_symbol_runtime_address(dst, sym_referenced);
-    uint64_t rip_value = 0x00400000 + (row_referencing + 1) * sizeof(inst_t);
+    uint64_t rip_value = sh->sh_addr + (row_referencing + 1) * MAX_INSTRUCTION_CHAR;
     char *s = &dst->buffer[sh->sh_offset + row_referencing][col_referencing];
     write_relocation(s, sym_address - rip_value);
     printf("row = %d, col = %d, symbol referered = %s\n", row_referencing, col_referencing, sym_referenced->st_name);
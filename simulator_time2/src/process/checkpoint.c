@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../header/cpu.h"
+#include "../header/memory.h"
+#include "../header/common.h"
+#include "../header/address.h"
+
+
+// the checkpoint file:
+//  header
+//  state of the modules, in the order of checkpoint_save
+//  physical memory, aligned to the host page for mmap
+#define CHECKPOINT_MAGIC    "CSAPPCKP"
+#define CHECKPOINT_VERSION  (4)
+
+typedef struct{
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint64_t pm_offset;
+    uint64_t pm_size;
+} checkpoint_header_t;
+
+
+void checkpoint_write(FILE *fp, const void *buf, uint64_t size){
+    if (size > 0 && fwrite(buf, 1, size, fp) != size){
+        printf("checkpoint: write failed\n");
+        exit(0);
+    }
+}
+
+
+void checkpoint_read(FILE *fp, void *buf, uint64_t size){
+    if (size > 0 && fread(buf, 1, size, fp) != size){
+        printf("checkpoint: truncated file\n");
+        exit(0);
+    }
+}
+
+
+static void save_cpu(FILE *fp){
+    checkpoint_write(fp, &cpu_reg, sizeof(cpu_reg));
+    checkpoint_write(fp, &cpu_flags, sizeof(cpu_flags));
+    checkpoint_write(fp, &cpu_pc, sizeof(cpu_pc));
+    checkpoint_write(fp, &cpu_controls, sizeof(cpu_controls));
+    checkpoint_write(fp, &ACTIVE_CORE, sizeof(ACTIVE_CORE));
+
+    // the TLB victims and the schedule continue the same after restore
+    rng_snapshot_t rng;
+    rng_save_state(&rng);
+    checkpoint_write(fp, &rng, sizeof(rng));
+}
+
+
+static void load_cpu(FILE *fp){
+    checkpoint_read(fp, &cpu_reg, sizeof(cpu_reg));
+    checkpoint_read(fp, &cpu_flags, sizeof(cpu_flags));
+    checkpoint_read(fp, &cpu_pc, sizeof(cpu_pc));
+    checkpoint_read(fp, &cpu_controls, sizeof(cpu_controls));
+    checkpoint_read(fp, &ACTIVE_CORE, sizeof(ACTIVE_CORE));
+
+    rng_snapshot_t rng;
+    checkpoint_read(fp, &rng, sizeof(rng));
+    rng_load_state(&rng);
+}
+
+
+static int is_zero(const uint8_t *buf, uint64_t size){
+    for (uint64_t i = 0; i < size; i += sizeof(uint64_t)){
+        uint64_t v;
+        memcpy(&v, &buf[i], sizeof(v));
+        if (v != 0){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// the zero host pages stay holes
+// a page not resident in the host may be swapped out, not zero: every page is checked
+static void save_physical_memory(int fd, uint64_t offset, uint64_t page_size){
+
+    uint64_t num_pages = (physical_memory_size + page_size - 1) / page_size;
+    for (uint64_t i = 0; i < num_pages; ++ i){
+        uint64_t size = (i + 1) * page_size <= physical_memory_size ? page_size : physical_memory_size - i * page_size;
+        if (is_zero(&pm[i * page_size], size) == 1){
+            continue;
+        }
+        ssize_t n = pwrite(fd, &pm[i * page_size], size, offset + i * page_size);
+        assert(n == size);
+    }
+
+    int rc = ftruncate(fd, offset + physical_memory_size);
+    assert(rc == 0);
+}
+
+
+void checkpoint_save(const char *path){
+
+    // the old file may be still mapped as the physical memory:
+    // a new inode keeps that mapping valid
+    unlink(path);
+
+    FILE *fp = fopen(path, "wb");
+    if (fp == NULL){
+        printf("checkpoint: cannot open %s\n", path);
+        exit(0);
+    }
+
+    checkpoint_header_t header;
+    memset(&header, 0, sizeof(header));
+    checkpoint_write(fp, &header, sizeof(header));
+
+    save_cpu(fp);
+    // the physical memory exists after the frame allocator
+    frame_save_state(fp);
+    mmu_save_state(fp);
+    sram_save_state(fp);
+    swap_save_state(fp);
+    zswap_save_state(fp);
+    vma_save_state(fp);
+    fflush(fp);
+
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.page_size = page_size;
+    header.pm_offset = (ftell(fp) + page_size - 1) / page_size * page_size;
+    header.pm_size = physical_memory_size;
+
+    int fd = fileno(fp);
+    save_physical_memory(fd, header.pm_offset, page_size);
+
+    ssize_t n = pwrite(fd, &header, sizeof(header), 0);
+    assert(n == sizeof(header));
+    fclose(fp);
+}
+
+
+void checkpoint_restore(const char *path){
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL){
+        printf("checkpoint: cannot open %s\n", path);
+        exit(0);
+    }
+
+    checkpoint_header_t header;
+    checkpoint_read(fp, &header, sizeof(header));
+    if (memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CHECKPOINT_VERSION || header.page_size != sysconf(_SC_PAGESIZE)){
+        printf("checkpoint: %s is not a checkpoint of this simulator\n", path);
+        exit(0);
+    }
+
+    load_cpu(fp);
+    frame_load_state(fp);
+    mmu_load_state(fp);
+    sram_load_state(fp);
+    swap_load_state(fp);
+    zswap_load_state(fp);
+    vma_load_state(fp);
+
+    // the mapping stays after the file is closed
+    physical_memory_map_file(fileno(fp), header.pm_offset, header.pm_size);
+    fclose(fp);
+}
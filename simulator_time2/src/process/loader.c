@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../header/cpu.h"
+#include "../header/memory.h"
+#include "../header/common.h"
+#include "../header/address.h"
+#include "../header/linker.h"
+
+
+// loader of the linked EOF
+// the sections are not copied into the physical memory by the loader:
+// each one is an area of the address space with its image, like mmap of the file,
+// and the page is read by the page fault handler at the first touch
+
+
+typedef struct VMA_STRUCT{
+    uint64_t cr3;
+    uint64_t start;
+    uint64_t size;
+    int writable;
+    uint8_t *image;     // owned by the area, NULL for the anonymous area
+    struct VMA_STRUCT *next;
+} vm_area_t;
+
+static vm_area_t *vma_list = NULL;
+
+
+void vma_add(uint64_t cr3, uint64_t start, uint64_t size, int writable, uint8_t *image){
+
+    vm_area_t *vma = malloc(sizeof(vm_area_t));
+    assert(vma != NULL);
+    vma->cr3 = cr3;
+    vma->start = start;
+    vma->size = size;
+    vma->writable = writable;
+    vma->image = image;
+    vma->next = vma_list;
+    vma_list = vma;
+}
+
+
+void vma_fork(uint64_t parent, uint64_t child){
+    for (vm_area_t *vma = vma_list; vma != NULL; vma = vma->next){
+        if (vma->cr3 == parent){
+            uint8_t *image = NULL;
+            if (vma->image != NULL){
+                image = malloc(vma->size);
+                assert(image != NULL);
+                memcpy(image, vma->image, vma->size);
+            }
+            vma_add(child, vma->start, vma->size, vma->writable, image);
+        }
+    }
+}
+
+
+static int vma_overlap(const vm_area_t *vma, uint64_t cr3, uint64_t page){
+    return vma->cr3 == cr3 && vma->image != NULL &&
+        vma->start < page + PAGE_SIZE && page < vma->start + vma->size;
+}
+
+
+int vma_file_page(uint64_t cr3, uint64_t vaddr, int *writable){
+
+    uint64_t page = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    int found = 0;
+    *writable = 1;
+    for (vm_area_t *vma = vma_list; vma != NULL; vma = vma->next){
+        if (vma_overlap(vma, cr3, page)){
+            found = 1;
+            // .text or .rodata in this page: readonly
+            *writable &= vma->writable;
+        }
+    }
+    if (found == 0){
+        *writable = 0;
+    }
+    return found;
+}
+
+
+void vma_fill_page(uint64_t cr3, uint64_t vaddr, uint64_t ppn){
+
+    uint64_t page = vaddr & ~(uint64_t)(PAGE_SIZE - 1);
+    for (vm_area_t *vma = vma_list; vma != NULL; vma = vma->next){
+        if (vma_overlap(vma, cr3, page)){
+            uint64_t begin = vma->start > page ? vma->start : page;
+            uint64_t end = vma->start + vma->size < page + PAGE_SIZE ? vma->start + vma->size : page + PAGE_SIZE;
+            dram_write((ppn << PHYSICAL_PAGE_OFFSET_LENGTH) + (begin - page),
+                &vma->image[begin - vma->start], end - begin);
+        }
+    }
+}
+
+
+void vma_save_state(FILE *fp){
+
+    uint64_t num_areas = 0;
+    for (vm_area_t *vma = vma_list; vma != NULL; vma = vma->next){
+        num_areas ++;
+    }
+    checkpoint_write(fp, &num_areas, sizeof(uint64_t));
+
+    for (vm_area_t *vma = vma_list; vma != NULL; vma = vma->next){
+        uint64_t has_image = vma->image != NULL;
+        checkpoint_write(fp, &vma->cr3, sizeof(uint64_t));
+        checkpoint_write(fp, &vma->start, sizeof(uint64_t));
+        checkpoint_write(fp, &vma->size, sizeof(uint64_t));
+        checkpoint_write(fp, &vma->writable, sizeof(int));
+        checkpoint_write(fp, &has_image, sizeof(uint64_t));
+        if (has_image == 1){
+            checkpoint_write(fp, vma->image, vma->size);
+        }
+    }
+}
+
+
+void vma_load_state(FILE *fp){
+
+    while (vma_list != NULL){
+        vm_area_t *vma = vma_list;
+        vma_list = vma->next;
+        free(vma->image);
+        free(vma);
+    }
+
+    uint64_t num_areas;
+    checkpoint_read(fp, &num_areas, sizeof(uint64_t));
+
+    // keep the order of the list
+    vm_area_t **tail = &vma_list;
+    for (uint64_t i = 0; i < num_areas; ++ i){
+        vm_area_t *vma = calloc(1, sizeof(vm_area_t));
+        assert(vma != NULL);
+
+        uint64_t has_image;
+        checkpoint_read(fp, &vma->cr3, sizeof(uint64_t));
+        checkpoint_read(fp, &vma->start, sizeof(uint64_t));
+        checkpoint_read(fp, &vma->size, sizeof(uint64_t));
+        checkpoint_read(fp, &vma->writable, sizeof(int));
+        checkpoint_read(fp, &has_image, sizeof(uint64_t));
+        if (has_image == 1){
+            vma->image = malloc(vma->size);
+            assert(vma->image != NULL);
+            checkpoint_read(fp, vma->image, vma->size);
+        }
+
+        *tail = vma;
+        tail = &vma->next;
+    }
+}
+
+
+/*--------------------------------------*/
+// loader
+
+// the image of one section: the instruction slots of .text, the words of .rodata and .data
+static uint8_t *section_image(const elf_t *eof, const sh_entry_t *sh, uint64_t *size){
+
+    int text = strcmp(sh->sh_name, ".text") == 0;
+    uint64_t slot = text ? MAX_INSTRUCTION_CHAR : sizeof(uint64_t);
+
+    *size = sh->sh_size * slot;
+    uint8_t *image = calloc(*size, 1);
+    assert(image != NULL);
+
+    for (uint64_t i = 0; i < sh->sh_size; ++ i){
+        const char *line = eof->buffer[sh->sh_offset + i];
+        if (text){
+            // the rest of the instruction slot is zero
+            strncpy((char *)&image[i * slot], line, MAX_INSTRUCTION_CHAR - 1);
+        }
+        else {
+            uint64_t value = string2uint(line);
+            memcpy(&image[i * slot], &value, sizeof(uint64_t));
+        }
+    }
+    return image;
+}
+
+
+uint64_t load_eof(const elf_t *eof, const char *entry){
+
+    uint64_t cr3 = allocate_pagetable();
+    cpu_controls.cr3 = cr3;
+    flush_tlb();
+
+    uint64_t text_addr = 0;
+    int has_text = 0;
+    for (int i = 0; i < eof->sht_count; ++ i){
+        const sh_entry_t *sh = &eof->sht[i];
+        int writable;
+
+        if (strcmp(sh->sh_name, ".text") == 0){
+            text_addr = sh->sh_addr;
+            has_text = 1;
+            writable = 0;
+        }
+        else if (strcmp(sh->sh_name, ".rodata") == 0){
+            writable = 0;
+        }
+        else if (strcmp(sh->sh_name, ".data") == 0){
+            writable = 1;
+        }
+        else {
+            // .symtab and the relocations are not loaded
+            continue;
+        }
+
+        if (sh->sh_size > 0){
+            uint64_t size;
+            uint8_t *image = section_image(eof, sh, &size);
+            vma_add(cr3, sh->sh_addr, size, writable, image);
+        }
+    }
+
+    // link_elf starts each section from a new page
+    // in an EOF packed otherwise, .data in the last page of .text is readonly
+    for (int i = 0; i < eof->sht_count; ++ i){
+        int writable;
+        if (strcmp(eof->sht[i].sh_name, ".data") == 0 &&
+            vma_file_page(cr3, eof->sht[i].sh_addr, &writable) == 1 && writable == 0){
+            printf("loader: .data at 0x%lx shares the page with readonly sections\n", eof->sht[i].sh_addr);
+        }
+    }
+
+    // the entry symbol in .text
+    const st_entry_t *sym = NULL;
+    for (int i = 0; i < eof->symt_count; ++ i){
+        if (strcmp(eof->symt[i].st_name, entry) == 0 && eof->symt[i].type == STT_FUNC &&
+            strcmp(eof->symt[i].st_shndx, ".text") == 0){
+            sym = &eof->symt[i];
+            break;
+        }
+    }
+    if (has_text == 0 || sym == NULL){
+        printf("loader: no entry symbol %s\n", entry);
+        exit(0);
+    }
+
+    // the stack is demand-zero
+    vma_add(cr3, STACK_TOP - STACK_SIZE, STACK_SIZE, 1, NULL);
+
+    memset(&cpu_reg, 0, sizeof(cpu_reg));
+    cpu_flags.__flag_value = 0;
+    // the entry returns to address 0
+    cpu_reg.rsp = STACK_TOP - sizeof(uint64_t);
+    cpu_write64bits_dram(va2pa_write(cpu_reg.rsp), 0);
+
+    cpu_pc.rip = text_addr + sym->st_value * MAX_INSTRUCTION_CHAR;
+    return cr3;
+}
@@ -0,0 +1,891 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../header/cpu.h"
+#include "../header/memory.h"
+#include "../header/common.h"
+#include "../header/address.h"
+
+
+// -------------------------------------------- //
+// physical frame allocator
+// -------------------------------------------- //
+
+// stack of free physical pages: O(1) allocate and free
+static uint64_t *free_frames = NULL;
+static uint64_t num_free_frames = 0;
+// the frames [0, num_untouched_frames) are never allocated
+// they are free without being listed, taken from the top after the stack is empty
+static uint64_t num_untouched_frames = 0;
+// no frame below it has ever been mapped: the rmap nodes are all above
+static uint64_t lowest_mapped_frame = 0;
+
+// CLOCK replacement: the hand sweeps the frames in the ring of page_map
+static uint64_t clock_hand = 0;
+
+// writeback keeps this number of clean frames ahead of the CLOCK hand
+static uint64_t writeback_low_watermark = DEFAULT_WRITEBACK_LOW_WATERMARK;
+
+// swap cache: the frames holding the page of the swap slot
+//  the pages read ahead into free frames, not mapped yet
+//  the shared page swapped in, while the slot is still used by the other PTEs
+// swap_cache[daddr]: 1 + ppn holding the page of the swap slot, 0 - not cached
+static uint64_t readahead_window = DEFAULT_SWAP_READAHEAD_WINDOW;
+static uint64_t *swap_cache = NULL;
+static uint64_t swap_cache_size = 0;
+
+// the shared zero page mapped readonly by the first reads, -1 if not allocated
+static int64_t zero_page = -1;
+
+
+static void free_page_map(){
+    if (page_map != NULL){
+        for (uint64_t i = lowest_mapped_frame; i < num_physical_page; ++ i){
+            while (page_map[i].rmap != NULL){
+                rmap_t *node = page_map[i].rmap;
+                page_map[i].rmap = node->next;
+                free(node);
+            }
+        }
+        free(page_map);
+        free(free_frames);
+    }
+}
+
+
+void frame_allocator_init(uint64_t num_pages){
+
+    assert(0 < num_pages && num_pages <= (1ul << PHYSICAL_PAGE_NUMBER_LENGTH));
+
+    // the physical memory backing all frames
+    if (pm == NULL || physical_memory_size < num_pages * PAGE_SIZE){
+        physical_memory_init(num_pages * PAGE_SIZE);
+    }
+
+    free_page_map();
+
+    num_physical_page = num_pages;
+    page_map = calloc(num_pages, sizeof(pd_t));
+    free_frames = malloc(num_pages * sizeof(uint64_t));
+    assert(page_map != NULL && free_frames != NULL);
+
+    // the frames on the top of the physical memory are allocated first
+    num_free_frames = 0;
+    num_untouched_frames = num_pages;
+    lowest_mapped_frame = num_pages;
+    clock_hand = 0;
+    zero_page = -1;
+    memset(&pagefault_stats, 0, sizeof(pagefault_stats_t));
+
+    if (swap_cache != NULL){
+        memset(swap_cache, 0, swap_cache_size * sizeof(uint64_t));
+    }
+}
+
+
+static void check_frame_allocator(){
+    if (page_map == NULL){
+        frame_allocator_init(MAX_NUM_PHYSICAL_PAGE);
+    }
+}
+
+
+// the compressed pool first, then the swap device
+static void swap_out_page(uint64_t daddr, uint64_t ppn){
+    if (zswap_store(daddr, ppn) == 0){
+        // the fault does not wait for the disk write
+        swap_out_async(daddr, ppn);
+    }
+}
+
+
+static void free_swap_slot(uint64_t daddr){
+    if (swap_slot_count(daddr) == 1){
+        // the last reference: the compressed copy is useless
+        zswap_invalidate(daddr);
+    }
+    swap_free_slot(daddr);
+}
+
+
+static uint64_t swap_cache_lookup(uint64_t daddr){
+    if (daddr < swap_cache_size && swap_cache[daddr] != 0){
+        return swap_cache[daddr];
+    }
+    return 0;
+}
+
+
+static void swap_cache_set(uint64_t daddr, uint64_t value){
+
+    if (daddr >= swap_cache_size){
+        uint64_t size = swap_cache_size == 0 ? 64 : swap_cache_size;
+        while (size <= daddr){
+            size *= 2;
+        }
+        swap_cache = realloc(swap_cache, size * sizeof(uint64_t));
+        assert(swap_cache != NULL);
+        memset(swap_cache + swap_cache_size, 0, (size - swap_cache_size) * sizeof(uint64_t));
+        swap_cache_size = size;
+    }
+    swap_cache[daddr] = value;
+}
+
+
+// the page read ahead is dropped before any use
+static void drop_readahead_frame(uint64_t ppn){
+    pd_t *pd = &page_map[ppn];
+    assert(pd->readahead == 1);
+
+    // the swap slot is still owned by the PTE
+    swap_cache_set(pd->daddr, 0);
+    pd->readahead = 0;
+    pd->daddr = 0;
+    pagefault_stats.readahead_waste ++;
+}
+
+
+void page_add_rmap(uint64_t ppn, uint64_t pte_paddr, uint64_t vaddr){
+
+    rmap_t *node = malloc(sizeof(rmap_t));
+    assert(node != NULL);
+    node->pte4 = pte_paddr;
+    node->vaddr = vaddr & ~((uint64_t)PAGE_SIZE - 1);
+    node->next = page_map[ppn].rmap;
+
+    page_map[ppn].rmap = node;
+    page_map[ppn].mapcount ++;
+
+    if (ppn < lowest_mapped_frame){
+        lowest_mapped_frame = ppn;
+    }
+}
+
+
+void page_remove_rmap(uint64_t ppn, uint64_t pte_paddr){
+
+    rmap_t **link = &page_map[ppn].rmap;
+    while (*link != NULL){
+        rmap_t *node = *link;
+        if (node->pte4 == pte_paddr){
+            *link = node->next;
+            free(node);
+            page_map[ppn].mapcount --;
+            return;
+        }
+        link = &node->next;
+    }
+    assert(0);
+}
+
+
+// page_referenced: test and clear the reference bits of all the mappings
+// the dirty bits are collected as well
+static int test_and_clear_referenced(uint64_t ppn, int *dirty){
+
+    int referenced = 0;
+    *dirty = 0;
+
+    for (rmap_t *node = page_map[ppn].rmap; node != NULL; node = node->next){
+        pte4_t pte = {
+            .pte_value = cpu_read64bits_dram(node->pte4)
+        };
+        assert(pte.present == 1 && pte.ppn == ppn);
+
+        *dirty |= pte.dirty;
+        if (pte.reference == 1){
+            // flush the TLB entry, or the next access will not set the reference bit again
+            pte.reference = 0;
+            cpu_write64bits_dram(node->pte4, pte.pte_value);
+            invalidate_tlb(node->vaddr);
+            referenced = 1;
+        }
+    }
+    return referenced;
+}
+
+
+// unmap the clean file page from all the page tables: the PTEs are zero as never mapped
+static void drop_file_frame(uint64_t ppn){
+
+    pd_t *pd = &page_map[ppn];
+    while (pd->rmap != NULL){
+        rmap_t *node = pd->rmap;
+        cpu_write64bits_dram(node->pte4, 0);
+        invalidate_tlb(node->vaddr);
+
+        pd->rmap = node->next;
+        free(node);
+    }
+    pd->mapcount = 0;
+}
+
+
+// write the frame to swap space if required
+// then unmap it from all the page tables by the reversed mapping
+static void evict_frame(uint64_t ppn, int dirty){
+
+    pd_t *pd = &page_map[ppn];
+
+    if (dirty == 0 && pd->daddr == 0 && pd->file == 1){
+        // the file page never written: read it from the image again on the next touch
+        drop_file_frame(ppn);
+        pagefault_stats.evict_clean ++;
+        return;
+    }
+
+    if (dirty == 1){
+        if (pd->daddr == 0){
+            // first time swapped out: bind it to one swap slot
+            pd->daddr = swap_alloc_slot();
+        }
+        swap_out_page(pd->daddr, ppn);
+        pagefault_stats.evict_dirty ++;
+    }
+    else {
+        // the copy in swap space is still up to date
+        pagefault_stats.evict_clean ++;
+    }
+
+    // try_to_unmap: each PTE refers to the swap slot now
+    // the TLB is not tagged by address space: flushed on switching cr3
+    pte4_t victim = {
+        .pte_value = 0
+    };
+    victim.present = 0;
+    victim.saddr = pd->daddr;
+
+    if (pd->mapcount > 1){
+        pagefault_stats.unmap_shared += pd->mapcount;
+    }
+    while (pd->rmap != NULL){
+        rmap_t *node = pd->rmap;
+        cpu_write64bits_dram(node->pte4, victim.pte_value);
+        invalidate_tlb(node->vaddr);
+        swap_dup_slot(pd->daddr);
+
+        pd->rmap = node->next;
+        free(node);
+    }
+    pd->mapcount = 0;
+
+    // the frame drops its own reference of the slot
+    if (swap_cache_lookup(pd->daddr) == ppn + 1){
+        swap_cache_set(pd->daddr, 0);
+    }
+    free_swap_slot(pd->daddr);
+}
+
+
+// enhanced second chance: sweep the frames with the reference bit and dirty bit of PTE
+//  reference = 1:              clear it and give a second chance
+//  reference = 0, clean:       reclaim it without disk write
+//  reference = 0, dirty:       remember the first one, reclaim it after one full rotation
+// the shared frame is referenced or dirty if any of its PTEs is
+static uint64_t reclaim_frame(){
+
+    int64_t dirty_victim = -1;
+
+    // the first rotation clears all the reference bits
+    // so one victim is always found by the end of the second rotation
+    for (uint64_t i = 0; i < 2 * num_physical_page; ++ i){
+
+        if (i >= num_physical_page && dirty_victim != -1){
+            break;
+        }
+
+        uint64_t ppn = clock_hand;
+        clock_hand = (clock_hand + 1) % num_physical_page;
+        pagefault_stats.clock_scan ++;
+
+        pd_t *pd = &page_map[ppn];
+        if (pd->allocated == 1 && pd->readahead == 1){
+            // not used since read ahead, no disk write
+            drop_readahead_frame(ppn);
+            return ppn;
+        }
+
+        if (pd->allocated == 0 || pd->pinned == 1 || pd->rmap == NULL){
+            // page tables and the frames without mapping are not swappable
+            continue;
+        }
+
+        int dirty = 0;
+        if (test_and_clear_referenced(ppn, &dirty) == 1){
+            // second chance
+            continue;
+        }
+
+        if (dirty == 0 && (pd->daddr != 0 || pd->file == 1)){
+            evict_frame(ppn, 0);
+            return ppn;
+        }
+
+        if (dirty_victim == -1){
+            dirty_victim = ppn;
+        }
+    }
+
+    if (dirty_victim == -1){
+        printf("PageFault: no physical page can be reclaimed\n");
+        exit(0);
+    }
+
+    // the hand stops right after the victim
+    clock_hand = (dirty_victim + 1) % num_physical_page;
+    evict_frame(dirty_victim, 1);
+    return dirty_victim;
+}
+
+
+// clean the dirty frames ahead of the CLOCK hand, before they are selected as victim
+// the pages are written by the writeback daemon in background
+static void writeback_frames(){
+
+    uint64_t clean = 0;
+
+    // look ahead of the hand in a bounded window
+    for (uint64_t i = 0; i < 2 * writeback_low_watermark && i < num_physical_page; ++ i){
+
+        if (clean >= writeback_low_watermark){
+            break;
+        }
+
+        uint64_t ppn = (clock_hand + i) % num_physical_page;
+        pd_t *pd = &page_map[ppn];
+        if (pd->allocated == 0 || pd->pinned == 1 || pd->rmap == NULL){
+            continue;
+        }
+
+        int dirty = 0;
+        int referenced = 0;
+        for (rmap_t *node = pd->rmap; node != NULL; node = node->next){
+            pte4_t pte = {
+                .pte_value = cpu_read64bits_dram(node->pte4)
+            };
+            dirty |= pte.dirty;
+            referenced |= pte.reference;
+        }
+
+        if (dirty == 0 && pd->daddr != 0){
+            clean ++;
+            continue;
+        }
+
+        if (referenced == 1){
+            // recently used: CLOCK will spare it anyway
+            continue;
+        }
+
+        if (pd->daddr == 0){
+            pd->daddr = swap_alloc_slot();
+        }
+        swap_out_page(pd->daddr, ppn);
+
+        // the next write sets the dirty bit again by page walk
+        for (rmap_t *node = pd->rmap; node != NULL; node = node->next){
+            pte4_t pte = {
+                .pte_value = cpu_read64bits_dram(node->pte4)
+            };
+            pte.dirty = 0;
+            cpu_write64bits_dram(node->pte4, pte.pte_value);
+            invalidate_tlb(node->vaddr);
+        }
+
+        clean ++;
+        pagefault_stats.writeback ++;
+    }
+}
+
+
+void writeback_config(uint64_t low_watermark){
+    writeback_low_watermark = low_watermark;
+}
+
+
+void swap_readahead_config(uint64_t window){
+    readahead_window = window < MAX_SWAP_BATCH ? window : MAX_SWAP_BATCH;
+}
+
+
+// pop one frame from the free frame list, no reclaim
+static int pop_free_frame(uint64_t *ppn){
+
+    while (num_free_frames > 0){
+        *ppn = free_frames[-- num_free_frames];
+        page_map[*ppn].listed = 0;
+
+        // the frame may be taken by map_page directly
+        if (page_map[*ppn].allocated == 0){
+            return 1;
+        }
+    }
+
+    while (num_untouched_frames > 0){
+        *ppn = -- num_untouched_frames;
+
+        // taken by map_page directly, or freed into the stack since
+        if (page_map[*ppn].allocated == 0 && page_map[*ppn].listed == 0){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+uint64_t allocate_frame(){
+
+    check_frame_allocator();
+
+    uint64_t ppn = 0;
+    if (pop_free_frame(&ppn) == 0){
+        // no free physical page
+        ppn = reclaim_frame();
+        writeback_frames();
+    }
+
+    assert(page_map[ppn].rmap == NULL);
+    page_map[ppn].allocated = 1;
+    page_map[ppn].pinned = 0;
+    page_map[ppn].readahead = 0;
+    page_map[ppn].mapcount = 0;
+    page_map[ppn].file = 0;
+    page_map[ppn].daddr = 0;
+    return ppn;
+}
+
+
+void free_frame(uint64_t ppn){
+
+    check_frame_allocator();
+    assert(ppn < num_physical_page && page_map[ppn].allocated == 1);
+    assert(page_map[ppn].rmap == NULL);
+
+    if (page_map[ppn].readahead == 1){
+        drop_readahead_frame(ppn);
+    }
+    else if (page_map[ppn].daddr != 0){
+        // the copy in swap space is useless now
+        // unless the slot is still used by the other PTEs
+        if (swap_cache_lookup(page_map[ppn].daddr) == ppn + 1){
+            swap_cache_set(page_map[ppn].daddr, 0);
+        }
+        free_swap_slot(page_map[ppn].daddr);
+        page_map[ppn].daddr = 0;
+    }
+
+    page_map[ppn].allocated = 0;
+    page_map[ppn].pinned = 0;
+    page_map[ppn].mapcount = 0;
+
+    if (page_map[ppn].listed == 0){
+        page_map[ppn].listed = 1;
+        free_frames[num_free_frames ++] = ppn;
+    }
+}
+
+
+void put_frame(uint64_t ppn, uint64_t pte_paddr){
+
+    check_frame_allocator();
+    assert(ppn < num_physical_page && page_map[ppn].allocated == 1);
+
+    if ((int64_t)ppn == zero_page){
+        // never freed
+        return;
+    }
+
+    page_remove_rmap(ppn, pte_paddr);
+    if (page_map[ppn].mapcount == 0){
+        free_frame(ppn);
+    }
+}
+
+
+void release_swap_entry(uint64_t daddr){
+
+    uint64_t cached = swap_cache_lookup(daddr);
+    if (cached != 0 && page_map[cached - 1].readahead == 1 && swap_slot_count(daddr) == 1){
+        // free_frame drops the swap cache and keeps the slot
+        free_frame(cached - 1);
+    }
+    free_swap_slot(daddr);
+
+    if (cached != 0 && page_map[cached - 1].readahead == 0 && swap_slot_count(daddr) == 1){
+        // the shared page swapped in holds the last reference
+        swap_cache_set(daddr, 0);
+    }
+}
+
+
+// -------------------------------------------- //
+// page fault
+// -------------------------------------------- //
+
+// the virtual pages following vaddr in the same page table
+// are swapped out to the following swap slots: read them in one batch
+// only free frames are used, the speculation never evicts pages
+static void swap_readahead(uint64_t pte_paddr, uint64_t daddr){
+
+    if (readahead_window == 0){
+        return;
+    }
+
+    uint64_t ppns[MAX_SWAP_BATCH];
+    uint64_t n = 0;
+
+    // index of the entry in the page table
+    uint64_t index = (pte_paddr & (PAGE_SIZE - 1)) / sizeof(pte4_t);
+    for (uint64_t k = 1; k <= readahead_window && index + k < PAGE_TABLE_ENTRY_NUM; ++ k){
+
+        pte4_t pte = {
+            .pte_value = cpu_read64bits_dram(pte_paddr + k * sizeof(pte4_t))
+        };
+        // the page in zswap is newer than the copy in the swap device
+        if (pte.present == 1 || pte.saddr != daddr + k || swap_cache_lookup(daddr + k) != 0 ||
+            zswap_contains(daddr + k) == 1){
+            break;
+        }
+
+        if (pop_free_frame(&ppns[n]) == 0){
+            break;
+        }
+        n ++;
+    }
+
+    if (n == 0){
+        return;
+    }
+
+    swap_in_batch(daddr + 1, ppns, n);
+
+    for (uint64_t k = 0; k < n; ++ k){
+        pd_t *pd = &page_map[ppns[k]];
+        pd->allocated = 1;
+        pd->pinned = 0;
+        pd->readahead = 1;
+        pd->daddr = daddr + k + 1;
+        swap_cache_set(pd->daddr, 1 + ppns[k]);
+    }
+    pagefault_stats.readahead += n;
+}
+
+
+// the kernel clears and copies the whole frame in bulk
+// the stale lines in SRAM cache are written back and dropped first
+static void clear_frame(uint64_t ppn){
+#ifdef USE_SRAM_CACHE
+    sram_cache_flush_page(ppn);
+#endif
+    dram_fill(ppn << PHYSICAL_PAGE_OFFSET_LENGTH, 0, PAGE_SIZE);
+}
+
+
+static void copy_frame(uint64_t dst, uint64_t src){
+#ifdef USE_SRAM_CACHE
+    sram_cache_flush_page(dst);
+    sram_cache_flush_page(src);
+#endif
+    dram_write(dst << PHYSICAL_PAGE_OFFSET_LENGTH, &pm[src << PHYSICAL_PAGE_OFFSET_LENGTH], PAGE_SIZE);
+}
+
+
+static uint64_t get_zero_page(){
+    if (zero_page == -1){
+        zero_page = allocate_frame();
+        page_map[zero_page].pinned = 1;
+        clear_frame(zero_page);
+    }
+    return zero_page;
+}
+
+
+// first touch of the virtual page
+static void do_anonymous_page(uint64_t pte_paddr, uint64_t vaddr, int write){
+
+    pte4_t pte = {
+        .pte_value = 0
+    };
+    pte.present = 1;
+
+    if (write == 0){
+        // all the pages never written are sharing the zero page
+        pte.readonly = 1;
+        pte.cow = 1;
+        pte.ppn = get_zero_page();
+        cpu_write64bits_dram(pte_paddr, pte.pte_value);
+        pagefault_stats.zero_page ++;
+        return;
+    }
+
+    uint64_t ppn = allocate_frame();
+    clear_frame(ppn);
+
+    pte.ppn = ppn;
+    cpu_write64bits_dram(pte_paddr, pte.pte_value);
+    page_add_rmap(ppn, pte_paddr, vaddr);
+    pagefault_stats.demand_zero ++;
+}
+
+
+// first touch of the page in a file-backed area
+// the frame is a private copy of the image: the writes never reach the image
+static void do_file_page(uint64_t pte_paddr, uint64_t vaddr, int writable){
+
+    uint64_t ppn = allocate_frame();
+    clear_frame(ppn);
+    vma_fill_page(cpu_controls.cr3, vaddr, ppn);
+    page_map[ppn].file = 1;
+
+    pte4_t pte = {
+        .pte_value = 0
+    };
+    pte.present = 1;
+    pte.readonly = writable == 0;
+    pte.ppn = ppn;
+    cpu_write64bits_dram(pte_paddr, pte.pte_value);
+    page_add_rmap(ppn, pte_paddr, vaddr);
+    pagefault_stats.file_page ++;
+}
+
+
+// write to the readonly page shared after fork, or the zero page
+static void do_wp_page(uint64_t pte_paddr, uint64_t vaddr){
+
+    pte4_t pte = {
+        .pte_value = cpu_read64bits_dram(pte_paddr)
+    };
+    uint64_t old = pte.ppn;
+
+    if (pte.cow == 0){
+        printf("PageFault: write to readonly page at 0x%lx\n", vaddr);
+        exit(0);
+    }
+
+    // the swapped-out PTEs of the other process may still read it from the swap cache
+    uint64_t daddr = page_map[old].daddr;
+    if ((int64_t)old != zero_page && page_map[old].mapcount == 1 &&
+        (daddr == 0 || swap_slot_count(daddr) == 1)){
+        // the other process has copied or dropped it: no copy
+        pte.readonly = 0;
+        pte.cow = 0;
+        cpu_write64bits_dram(pte_paddr, pte.pte_value);
+        invalidate_tlb(vaddr);
+        pagefault_stats.cow_reuse ++;
+        return;
+    }
+
+    // pin the shared frame, or reclaim may pick it as the victim for the copy
+    // the zero page is always pinned
+    page_map[old].pinned = 1;
+    uint64_t ppn = allocate_frame();
+    if ((int64_t)old == zero_page){
+        clear_frame(ppn);
+        pagefault_stats.demand_zero ++;
+    }
+    else {
+        copy_frame(ppn, old);
+        page_map[old].pinned = 0;
+        put_frame(old, pte_paddr);
+        pagefault_stats.cow_copy ++;
+    }
+
+    pte.pte_value = 0;
+    pte.present = 1;
+    pte.ppn = ppn;
+    cpu_write64bits_dram(pte_paddr, pte.pte_value);
+    page_add_rmap(ppn, pte_paddr, vaddr);
+    invalidate_tlb(vaddr);
+}
+
+
+// bring the page back from swap space
+static void do_swap_page(uint64_t pte_paddr, uint64_t vaddr){
+
+    pte4_t pte = {
+        .pte_value = cpu_read64bits_dram(pte_paddr)
+    };
+
+    uint64_t daddr = pte.saddr;
+    uint64_t ppn = 0;
+    uint64_t cached = swap_cache_lookup(daddr);
+
+    if (cached != 0 && page_map[cached - 1].readahead == 1){
+        // minor fault: the page is read ahead already
+        // the frame takes the reference of the slot from the PTE
+        ppn = cached - 1;
+        page_map[ppn].readahead = 0;
+        pagefault_stats.readahead_hit ++;
+    }
+    else if (cached != 0){
+        // minor fault: the shared page is swapped in by the other PTE
+        ppn = cached - 1;
+        assert(page_map[ppn].daddr == daddr);
+        free_swap_slot(daddr);
+        pagefault_stats.swap_cache_hit ++;
+    }
+    else {
+        // free frame, or the victim selected by CLOCK
+        ppn = allocate_frame();
+        page_map[ppn].daddr = daddr;
+
+        if (zswap_load(daddr, ppn) == 0){
+            //Load page from disk to physical memory first
+            swap_in(daddr, ppn);
+            swap_readahead(pte_paddr, daddr);
+        }
+    }
+
+    pte.pte_value = 0;
+    pte.present = 1;
+    pte.ppn = ppn;
+
+    if (swap_slot_count(daddr) > 1){
+        // the other PTEs will find the page in the swap cache
+        swap_cache_set(daddr, 1 + ppn);
+    }
+    else {
+        swap_cache_set(daddr, 0);
+    }
+
+    if (swap_slot_count(daddr) > 1 || page_map[ppn].mapcount > 0){
+        // shared with the other mappings: copy on write
+        pte.readonly = 1;
+        pte.cow = 1;
+    }
+    cpu_write64bits_dram(pte_paddr, pte.pte_value);
+    page_add_rmap(ppn, pte_paddr, vaddr);
+}
+
+
+void page_fault_handler(uint64_t pte_paddr, uint64_t vaddr, int write){
+
+    pte4_t pte = {
+        .pte_value = cpu_read64bits_dram(pte_paddr)
+    };
+
+    pagefault_stats.page_fault ++;
+
+    if (pte.present == 1){
+        // protection fault
+        assert(write == 1 && pte.readonly == 1);
+        do_wp_page(pte_paddr, vaddr);
+    }
+    else if (pte.saddr == 0){
+        // the virtual page is never mapped, or its clean file page is dropped
+        int writable;
+        if (vma_file_page(cpu_controls.cr3, vaddr, &writable) == 1){
+            do_file_page(pte_paddr, vaddr, writable);
+        }
+        else {
+            do_anonymous_page(pte_paddr, vaddr, write);
+        }
+    }
+    else {
+        do_swap_page(pte_paddr, vaddr);
+    }
+}
+
+
+void frame_save_state(FILE *fp){
+
+    check_frame_allocator();
+
+    checkpoint_write(fp, &num_physical_page, sizeof(uint64_t));
+    checkpoint_write(fp, &num_free_frames, sizeof(uint64_t));
+    checkpoint_write(fp, &num_untouched_frames, sizeof(uint64_t));
+    checkpoint_write(fp, &lowest_mapped_frame, sizeof(uint64_t));
+    checkpoint_write(fp, &clock_hand, sizeof(uint64_t));
+    checkpoint_write(fp, &writeback_low_watermark, sizeof(uint64_t));
+    checkpoint_write(fp, &readahead_window, sizeof(uint64_t));
+    checkpoint_write(fp, &zero_page, sizeof(int64_t));
+    checkpoint_write(fp, free_frames, num_free_frames * sizeof(uint64_t));
+
+    // the frames never used are all zero: skip them
+    // but map_page may have taken the frames below num_untouched_frames directly
+    uint64_t first_frame = num_untouched_frames < lowest_mapped_frame ? num_untouched_frames : lowest_mapped_frame;
+    checkpoint_write(fp, &first_frame, sizeof(uint64_t));
+    for (uint64_t i = first_frame; i < num_physical_page; ++ i){
+        pd_t pd = page_map[i];
+        uint64_t num_rmap = 0;
+        for (rmap_t *node = pd.rmap; node != NULL; node = node->next){
+            num_rmap ++;
+        }
+        pd.rmap = NULL;
+        checkpoint_write(fp, &pd, sizeof(pd_t));
+        checkpoint_write(fp, &num_rmap, sizeof(uint64_t));
+        for (rmap_t *node = page_map[i].rmap; node != NULL; node = node->next){
+            checkpoint_write(fp, &node->pte4, sizeof(uint64_t));
+            checkpoint_write(fp, &node->vaddr, sizeof(uint64_t));
+        }
+    }
+
+    checkpoint_write(fp, &swap_cache_size, sizeof(uint64_t));
+    checkpoint_write(fp, swap_cache, swap_cache_size * sizeof(uint64_t));
+}
+
+
+void frame_load_state(FILE *fp){
+
+    free_page_map();
+
+    checkpoint_read(fp, &num_physical_page, sizeof(uint64_t));
+    checkpoint_read(fp, &num_free_frames, sizeof(uint64_t));
+    checkpoint_read(fp, &num_untouched_frames, sizeof(uint64_t));
+    checkpoint_read(fp, &lowest_mapped_frame, sizeof(uint64_t));
+    checkpoint_read(fp, &clock_hand, sizeof(uint64_t));
+    checkpoint_read(fp, &writeback_low_watermark, sizeof(uint64_t));
+    checkpoint_read(fp, &readahead_window, sizeof(uint64_t));
+    swap_readahead_config(readahead_window);
+    checkpoint_read(fp, &zero_page, sizeof(int64_t));
+
+    page_map = calloc(num_physical_page, sizeof(pd_t));
+    free_frames = malloc(num_physical_page * sizeof(uint64_t));
+    assert(page_map != NULL && free_frames != NULL);
+    checkpoint_read(fp, free_frames, num_free_frames * sizeof(uint64_t));
+
+    uint64_t first_frame;
+    checkpoint_read(fp, &first_frame, sizeof(uint64_t));
+    assert(first_frame <= num_physical_page);
+    for (uint64_t i = first_frame; i < num_physical_page; ++ i){
+        uint64_t num_rmap;
+        checkpoint_read(fp, &page_map[i], sizeof(pd_t));
+        checkpoint_read(fp, &num_rmap, sizeof(uint64_t));
+
+        // keep the order of the list
+        rmap_t **tail = &page_map[i].rmap;
+        for (uint64_t k = 0; k < num_rmap; ++ k){
+            rmap_t *node = malloc(sizeof(rmap_t));
+            assert(node != NULL);
+            checkpoint_read(fp, &node->pte4, sizeof(uint64_t));
+            checkpoint_read(fp, &node->vaddr, sizeof(uint64_t));
+            node->next = NULL;
+            *tail = node;
+            tail = &node->next;
+        }
+    }
+
+    free(swap_cache);
+    checkpoint_read(fp, &swap_cache_size, sizeof(uint64_t));
+    swap_cache = calloc(swap_cache_size ? swap_cache_size : 1, sizeof(uint64_t));
+    assert(swap_cache != NULL);
+    checkpoint_read(fp, swap_cache, swap_cache_size * sizeof(uint64_t));
+
+    memset(&pagefault_stats, 0, sizeof(pagefault_stats_t));
+}
+
+
+void print_pagefault_stats(){
+    printf("page fault: %lu\tevict clean %lu\tevict dirty %lu\tCLOCK scan %lu\twriteback %lu\n",
+        pagefault_stats.page_fault, pagefault_stats.evict_clean, pagefault_stats.evict_dirty,
+        pagefault_stats.clock_scan, pagefault_stats.writeback);
+    printf("swap readahead (window %lu): %lu pages\thit %lu\twaste %lu\n",
+        readahead_window, pagefault_stats.readahead, pagefault_stats.readahead_hit,
+        pagefault_stats.readahead_waste);
+    printf("demand zero: %lu\tzero page %lu\tfile page %lu\tcopy on write %lu\treuse %lu\n",
+        pagefault_stats.demand_zero, pagefault_stats.zero_page, pagefault_stats.file_page,
+        pagefault_stats.cow_copy, pagefault_stats.cow_reuse);
+    printf("shared page: swap cache hit %lu\tPTEs unmapped by eviction %lu\n",
+        pagefault_stats.swap_cache_hit, pagefault_stats.unmap_shared);
+}
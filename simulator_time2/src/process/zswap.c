@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "../header/cpu.h"
+#include "../header/memory.h"
+#include "../header/common.h"
+#include "../header/address.h"
+
+
+// compressed cache in front of the swap device
+// the pages swapped out are compressed into the host-side pool
+// and written to the swap device only when the pool is full
+
+
+// the pages compressed worse than this are written to the swap device directly
+#define ZSWAP_MAX_COMPRESSED_SIZE (PAGE_SIZE * 3 / 4)
+
+typedef struct ZSWAP_ENTRY_STRUCT{
+    uint64_t daddr;
+    uint64_t size;      // compressed size, 0 - same-filled page
+    uint64_t value;     // the word of the same-filled page
+    uint8_t *data;
+
+    // LRU list: head is the oldest
+    struct ZSWAP_ENTRY_STRUCT *prev;
+    struct ZSWAP_ENTRY_STRUCT *next;
+} zswap_entry_t;
+
+static uint64_t zswap_pool_size = DEFAULT_ZSWAP_POOL_SIZE;
+
+// zswap_tree[daddr]: entry of the swap slot
+static zswap_entry_t **zswap_tree = NULL;
+static uint64_t zswap_tree_size = 0;
+
+static zswap_entry_t *lru_head = NULL;
+static zswap_entry_t *lru_tail = NULL;
+
+
+static zswap_entry_t *lookup_entry(uint64_t daddr){
+    if (daddr < zswap_tree_size){
+        return zswap_tree[daddr];
+    }
+    return NULL;
+}
+
+
+static void set_entry(uint64_t daddr, zswap_entry_t *entry){
+
+    if (daddr >= zswap_tree_size){
+        uint64_t size = zswap_tree_size == 0 ? 64 : zswap_tree_size;
+        while (size <= daddr){
+            size *= 2;
+        }
+        zswap_tree = realloc(zswap_tree, size * sizeof(zswap_entry_t *));
+        assert(zswap_tree != NULL);
+        memset(zswap_tree + zswap_tree_size, 0, (size - zswap_tree_size) * sizeof(zswap_entry_t *));
+        zswap_tree_size = size;
+    }
+    zswap_tree[daddr] = entry;
+}
+
+
+static void lru_remove(zswap_entry_t *entry){
+    if (entry->prev != NULL){
+        entry->prev->next = entry->next;
+    }
+    else {
+        lru_head = entry->next;
+    }
+    if (entry->next != NULL){
+        entry->next->prev = entry->prev;
+    }
+    else {
+        lru_tail = entry->prev;
+    }
+    entry->prev = NULL;
+    entry->next = NULL;
+}
+
+
+static void lru_append(zswap_entry_t *entry){
+    entry->prev = lru_tail;
+    entry->next = NULL;
+    if (lru_tail != NULL){
+        lru_tail->next = entry;
+    }
+    else {
+        lru_head = entry;
+    }
+    lru_tail = entry;
+}
+
+
+static void decompress_entry(zswap_entry_t *entry, uint8_t *page){
+    if (entry->size == 0){
+        for (uint64_t i = 0; i < PAGE_SIZE; i += sizeof(uint64_t)){
+            memcpy(&page[i], &entry->value, sizeof(uint64_t));
+        }
+    }
+    else {
+        uint64_t size = lz_decompress(entry->data, entry->size, page, PAGE_SIZE);
+        assert(size == PAGE_SIZE);
+    }
+}
+
+
+static void free_entry(zswap_entry_t *entry){
+    lru_remove(entry);
+    set_entry(entry->daddr, NULL);
+
+    zswap_stats.pool_bytes -= entry->size;
+    zswap_stats.stored_pages --;
+    free(entry->data);
+    free(entry);
+}
+
+
+// the pool is full: move the oldest page to the swap device
+static void writeback_oldest(){
+
+    zswap_entry_t *entry = lru_head;
+    assert(entry != NULL);
+
+    uint8_t page[PAGE_SIZE];
+    decompress_entry(entry, page);
+    swap_write_async(entry->daddr, page);
+
+    zswap_stats.writeback ++;
+    free_entry(entry);
+}
+
+
+void zswap_config(uint64_t pool_size){
+
+    // the old entries are still valid: move them to the swap device
+    while (lru_head != NULL && zswap_stats.pool_bytes > pool_size){
+        writeback_oldest();
+    }
+    zswap_pool_size = pool_size;
+}
+
+
+int zswap_store(uint64_t daddr, uint64_t ppn){
+
+    // the old copy is stale now
+    zswap_invalidate(daddr);
+
+    if (zswap_pool_size == 0){
+        return 0;
+    }
+
+#ifdef USE_SRAM_CACHE
+    // the latest data may be still in the cache
+    sram_cache_flush_page(ppn);
+#endif
+
+    const uint8_t *page = &pm[ppn << PHYSICAL_PAGE_OFFSET_LENGTH];
+
+    zswap_entry_t *entry = calloc(1, sizeof(zswap_entry_t));
+    assert(entry != NULL);
+    entry->daddr = daddr;
+
+    if (same_filled(page, PAGE_SIZE, &entry->value) == 1){
+        // no data in pool
+        zswap_stats.same_filled ++;
+    }
+    else {
+        uint8_t buf[ZSWAP_MAX_COMPRESSED_SIZE];
+        uint64_t size = lz_compress(page, PAGE_SIZE, buf, ZSWAP_MAX_COMPRESSED_SIZE);
+
+        if (size == 0 || size > zswap_pool_size){
+            // poor compression
+            zswap_stats.reject ++;
+            free(entry);
+            return 0;
+        }
+
+        while (zswap_stats.pool_bytes + size > zswap_pool_size){
+            writeback_oldest();
+        }
+
+        entry->size = size;
+        entry->data = malloc(size);
+        assert(entry->data != NULL);
+        memcpy(entry->data, buf, size);
+    }
+
+    set_entry(daddr, entry);
+    lru_append(entry);
+
+    zswap_stats.store ++;
+    zswap_stats.stored_pages ++;
+    zswap_stats.pool_bytes += entry->size;
+    zswap_stats.compressed_in += PAGE_SIZE;
+    zswap_stats.compressed_out += entry->size;
+    return 1;
+}
+
+
+int zswap_load(uint64_t daddr, uint64_t ppn){
+
+    zswap_entry_t *entry = lookup_entry(daddr);
+    if (entry == NULL){
+        zswap_stats.load_miss ++;
+        return 0;
+    }
+
+#ifdef USE_SRAM_CACHE
+    // drop the stale cache lines of the previous page
+    sram_cache_flush_page(ppn);
+#endif
+
+    decompress_entry(entry, &pm[ppn << PHYSICAL_PAGE_OFFSET_LENGTH]);
+
+    // keep the entry: it is the only copy until the page is dirty again
+    lru_remove(entry);
+    lru_append(entry);
+
+    zswap_stats.load_hit ++;
+    return 1;
+}
+
+
+int zswap_contains(uint64_t daddr){
+    return lookup_entry(daddr) != NULL;
+}
+
+
+void zswap_invalidate(uint64_t daddr){
+    zswap_entry_t *entry = lookup_entry(daddr);
+    if (entry != NULL){
+        free_entry(entry);
+    }
+}
+
+
+void zswap_save_state(FILE *fp){
+
+    checkpoint_write(fp, &zswap_pool_size, sizeof(uint64_t));
+    checkpoint_write(fp, &zswap_stats.stored_pages, sizeof(uint64_t));
+
+    // from the oldest: the LRU order is rebuilt by the load
+    for (zswap_entry_t *entry = lru_head; entry != NULL; entry = entry->next){
+        checkpoint_write(fp, &entry->daddr, sizeof(uint64_t));
+        checkpoint_write(fp, &entry->size, sizeof(uint64_t));
+        checkpoint_write(fp, &entry->value, sizeof(uint64_t));
+        checkpoint_write(fp, entry->data, entry->size);
+    }
+}
+
+
+void zswap_load_state(FILE *fp){
+
+    while (lru_head != NULL){
+        free_entry(lru_head);
+    }
+    memset(&zswap_stats, 0, sizeof(zswap_stats_t));
+
+    uint64_t num_entries;
+    checkpoint_read(fp, &zswap_pool_size, sizeof(uint64_t));
+    checkpoint_read(fp, &num_entries, sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < num_entries; ++ i){
+        zswap_entry_t *entry = calloc(1, sizeof(zswap_entry_t));
+        assert(entry != NULL);
+        checkpoint_read(fp, &entry->daddr, sizeof(uint64_t));
+        checkpoint_read(fp, &entry->size, sizeof(uint64_t));
+        checkpoint_read(fp, &entry->value, sizeof(uint64_t));
+        if (entry->size > 0){
+            entry->data = malloc(entry->size);
+            assert(entry->data != NULL);
+            checkpoint_read(fp, entry->data, entry->size);
+        }
+
+        set_entry(entry->daddr, entry);
+        lru_append(entry);
+        zswap_stats.stored_pages ++;
+        zswap_stats.pool_bytes += entry->size;
+    }
+}
+
+
+void print_zswap_stats(){
+
+    printf("zswap (pool %lu bytes): %lu pages in %lu bytes\tstore %lu\tsame-filled %lu\treject %lu\twriteback %lu\n",
+        zswap_pool_size, zswap_stats.stored_pages, zswap_stats.pool_bytes,
+        zswap_stats.store, zswap_stats.same_filled, zswap_stats.reject, zswap_stats.writeback);
+
+    uint64_t loads = zswap_stats.load_hit + zswap_stats.load_miss;
+    printf("zswap compression ratio %.2f\tload hit %lu\tmiss %lu\thit rate %.2f%%\n",
+        zswap_stats.compressed_out == 0 ? 0.0 : (double)zswap_stats.compressed_in / zswap_stats.compressed_out,
+        zswap_stats.load_hit, zswap_stats.load_miss,
+        loads == 0 ? 0.0 : 100.0 * zswap_stats.load_hit / loads);
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <header/cpu.h>
+#include <header/common.h>
+#include <header/memory.h>
+
+// the cost of debug_printf in the hot loop when the category is off
+// build it twice to compare with the compiled-out debug output:
+//  make bench_debug
+
+#define NUM_CALLS           (10000000)
+#define NUM_INSTRUCTIONS    (200000)
+#define NUM_RUNS            (5)
+
+static volatile uint64_t sink = 0;
+
+
+static double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+// debug_printf before the macro: the arguments are evaluated and passed,
+// then the mask is checked in the callee
+static uint64_t __attribute__((noinline)) debug_printf_call(uint64_t open_set, const char *format, ...){
+
+    if ((open_set & debug_mask) == 0x0){
+        return 0x1;
+    }
+
+    va_list argptr;
+    va_start(argptr, format);
+    vfprintf(stderr, format, argptr);
+    va_end(argptr);
+
+    return 0x0;
+}
+
+
+static void load_program(){
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x0,%rax",
+        "mov    %rax,-0x8(%rbp)",
+        "cmpq   $0x1,-0x8(%rbp)",
+        "jne    0x400000",
+    };
+    for (int i = 0; i < 4; ++ i){
+        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+    }
+    cpu_reg.rsp = 0x7ffffffee110;
+    cpu_reg.rbp = 0x7ffffffee110;
+    cpu_pc.rip = 0x00400000;
+}
+
+
+// ns of each call, the best of the runs
+static double bench_loop(int mode, const char *inst_str){
+
+    double best = 0.0;
+    for (int run = 0; run < NUM_RUNS; ++ run){
+        double start = now_ns();
+        for (uint64_t i = 0; i < NUM_CALLS; ++ i){
+            if (mode == 1){
+                sink = debug_printf_call(DEBUG_INSTRUCTIONCYCLE, "%lx       %s\n", i, inst_str);
+            }
+            else if (mode == 2){
+                debug_printf(DEBUG_INSTRUCTIONCYCLE, "%lx       %s\n", i, inst_str);
+                sink = 0x1;
+            }
+            else {
+                sink = 0x1;
+            }
+        }
+        double ns = (now_ns() - start) / NUM_CALLS;
+        if (run == 0 || ns < best){
+            best = ns;
+        }
+    }
+    return best;
+}
+
+
+int main(){
+
+    char inst_str[MAX_INSTRUCTION_CHAR] = "mov    %rax,-0x8(%rbp)";
+
+    // the default set without the instruction cycle
+    debug_mask = DEBUG_VERBOSE_SET & ~DEBUG_INSTRUCTIONCYCLE;
+
+    printf("DEBUG_COMPILE_SET = 0x%lx\n", (uint64_t)DEBUG_COMPILE_SET);
+
+    // the empty loop is included in each
+    printf("empty loop:\t\t\t\t%.2f ns\n", bench_loop(0, inst_str));
+    printf("debug_printf off, function call:\t%.2f ns\n", bench_loop(1, inst_str));
+    printf("debug_printf off, macro:\t\t%.2f ns\n", bench_loop(2, inst_str));
+
+    // the whole instruction cycle with the debug output off
+    load_program();
+    double best = 0.0;
+    for (int run = 0; run < NUM_RUNS; ++ run){
+        double start = now_ns();
+        for (int i = 0; i < NUM_INSTRUCTIONS; ++ i){
+            instruction_cycle();
+        }
+        double ns = (now_ns() - start) / NUM_INSTRUCTIONS;
+        if (run == 0 || ns < best){
+            best = ns;
+        }
+    }
+    printf("instruction cycle:\t\t\t%.2f ns\n", best);
+
+    return 0;
+}
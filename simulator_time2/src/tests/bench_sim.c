@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <header/cpu.h>
+#include <header/common.h>
+#include <header/memory.h>
+
+// the speed of the simulator itself
+// each guest program runs the same number of instructions,
+// the configuration is the build: make bench builds and runs all of them
+//
+// the results are appended to RESULTS_PATH and compared with BASELINE_PATH:
+//  config,program,instructions,seconds,mips,ns_per_inst,host_cycles,host_instructions,host_cache_misses
+// the host counters are -1 if perf_event_open is not permitted
+//
+// ./bench_sim [instructions] [threshold]
+// fails if any program is slower than the baseline by more than threshold percent
+
+#define RESULTS_PATH                "./files/bench/results.csv"
+#define BASELINE_PATH               "./files/bench/baseline.csv"
+#define DEFAULT_BENCH_INSTRUCTIONS  (200000)
+#define DEFAULT_BENCH_THRESHOLD     (10.0)
+
+#define CODE_BASE   (0x00400000)
+#define DATA_SRC    (0x00608000)
+#define DATA_DST    (0x0060a000)
+#define CHASE_BASE  (0x0060c000)
+#define CHASE_NODES (64)
+
+#ifdef USE_NAVIE_VA2PA
+#define CONFIG_VA2PA "naive"
+#else
+#define CONFIG_VA2PA "pagetable"
+#endif
+
+#ifdef USE_SRAM_CACHE
+#define CONFIG_NAME CONFIG_VA2PA "+sram"
+#else
+#define CONFIG_NAME CONFIG_VA2PA
+#endif
+
+
+typedef struct{
+    const char *name;
+    void (*setup)();
+} bench_program_t;
+
+
+static void load_code(char (*assembly)[MAX_INSTRUCTION_CHAR], int n){
+    for (int i = 0; i < n; ++ i){
+        cpu_writeinst_dram(va2pa_write(i * 0x40 + CODE_BASE), assembly[i]);
+    }
+}
+
+
+static void reset_registers(){
+    memset(&cpu_reg, 0, sizeof(cpu_reg));
+    cpu_flags.__flag_value = 0;
+    cpu_reg.rbp = 0x7ffffffee230;
+    cpu_reg.rsp = 0x7ffffffee220;
+}
+
+
+// TestSumRecursiveCondition in test_hardware.c, called again and again
+static void setup_sum(){
+    char assembly[20][MAX_INSTRUCTION_CHAR] = {
+        "push   %rbp",              // 0
+        "mov    %rsp,%rbp",         // 1
+        "sub    $0x10,%rsp",        // 2
+        "mov    %rdi,-0x8(%rbp)",   // 3
+        "cmpq   $0x0,-0x8(%rbp)",   // 4
+        "jne    0x400200",          // 5: jump to 8
+        "mov    $0x0,%eax",         // 6
+        "jmp    0x400380",          // 7: jump to 14
+        "mov    -0x8(%rbp),%rax",   // 8
+        "sub    $0x1,%rax",         // 9
+        "mov    %rax,%rdi",         // 10
+        "callq  0x00400000",        // 11
+        "mov    -0x8(%rbp),%rdx",   // 12
+        "add    %rdx,%rax",         // 13
+        "leaveq ",                  // 14
+        "retq   ",                  // 15
+        "mov    $0x10,%edi",        // 16: main
+        "callq  0x00400000",        // 17
+        "mov    %rax,-0x8(%rbp)",   // 18
+        "jmp    0x400400",          // 19: jump to 16
+    };
+    load_code(assembly, 20);
+    reset_registers();
+    cpu_pc.rip = 16 * 0x40 + CODE_BASE;
+}
+
+
+// copy 2KB by words
+static void setup_memcpy(){
+    char assembly[11][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x00608000,%rsi",  // 0
+        "mov    $0x0060a000,%rdi",  // 1
+        "mov    $0x100,%rdx",       // 2
+        "mov    $0x8,%rbx",         // 3
+        "mov    (%rsi),%rax",       // 4
+        "mov    %rax,(%rdi)",       // 5
+        "add    %rbx,%rsi",         // 6
+        "add    %rbx,%rdi",         // 7
+        "sub    $0x1,%rdx",         // 8
+        "jne    0x400100",          // 9: jump to 4
+        "jmp    0x400000",          // 10: jump to 0
+    };
+    load_code(assembly, 11);
+    for (uint64_t i = 0; i < 0x100; ++ i){
+        cpu_write64bits_dram(va2pa_write(DATA_SRC + i * 8), i);
+    }
+    reset_registers();
+    cpu_pc.rip = CODE_BASE;
+}
+
+
+// the nodes of one cache line each, linked in random order
+static void setup_chase(){
+    char assembly[6][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x0060c000,%rax",  // 0
+        "mov    $0x400,%rdx",       // 1
+        "mov    (%rax),%rax",       // 2
+        "sub    $0x1,%rdx",         // 3
+        "jne    0x400080",          // 4: jump to 2
+        "jmp    0x400000",          // 5: jump to 0
+    };
+    load_code(assembly, 6);
+
+    uint64_t order[CHASE_NODES];
+    for (int i = 0; i < CHASE_NODES; ++ i){
+        order[i] = i;
+    }
+    rng_seed(DEFAULT_RNG_SEED);
+    for (int i = CHASE_NODES - 1; i > 1; -- i){
+        // keep node 0 first
+        uint64_t j = 1 + rng_below(RNG_WORKLOAD, i);
+        uint64_t t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+    for (int i = 0; i < CHASE_NODES; ++ i){
+        cpu_write64bits_dram(va2pa_write(CHASE_BASE + order[i] * 64),
+            CHASE_BASE + order[(i + 1) % CHASE_NODES] * 64);
+    }
+    reset_registers();
+    cpu_pc.rip = CODE_BASE;
+}
+
+
+static void setup_calls(){
+    char assembly[8][MAX_INSTRUCTION_CHAR] = {
+        "callq  0x00400100",        // 0
+        "callq  0x00400100",        // 1
+        "jmp    0x400000",          // 2: jump to 0
+        "jmp    0x400000",          // 3: not executed
+        "push   %rbp",              // 4: func
+        "mov    %rsp,%rbp",         // 5
+        "pop    %rbp",              // 6
+        "retq   ",                  // 7
+    };
+    load_code(assembly, 8);
+    reset_registers();
+    cpu_pc.rip = CODE_BASE;
+}
+
+
+static bench_program_t programs[] = {
+    {"sum_recursive", &setup_sum},
+    {"memcpy", &setup_memcpy},
+    {"pointer_chase", &setup_chase},
+    {"calls", &setup_calls},
+};
+
+
+/*--------------------------------------*/
+// host counters
+
+static int perf_open(uint64_t config){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int64_t perf_read(int fd){
+    int64_t value;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)){
+        return -1;
+    }
+    return value;
+}
+
+
+static double now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/*--------------------------------------*/
+// baseline
+
+// return the ns per instruction of the program in the baseline, or 0
+static double baseline_ns(const char *program){
+
+    FILE *fp = fopen(BASELINE_PATH, "r");
+    if (fp == NULL){
+        return 0.0;
+    }
+
+    char line[256];
+    double ns = 0.0;
+    while (fgets(line, sizeof(line), fp) != NULL){
+        char config[64], name[64];
+        double v;
+        if (sscanf(line, "%63[^,],%63[^,],%*u,%*f,%*f,%lf", config, name, &v) == 3 &&
+            strcmp(config, CONFIG_NAME) == 0 && strcmp(name, program) == 0){
+            ns = v;
+        }
+    }
+    fclose(fp);
+    return ns;
+}
+
+
+int main(int argc, char **argv){
+
+    uint64_t num_instructions = argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_BENCH_INSTRUCTIONS;
+    double threshold = argc > 2 ? strtod(argv[2], NULL) : DEFAULT_BENCH_THRESHOLD;
+    int regressions = 0;
+
+#ifdef USE_PAGETABLE_VA2PA
+    cpu_controls.cr3 = allocate_pagetable();
+#endif
+    // no debug output in the loop
+    debug_mask = 0;
+
+    int fds[3] = {
+        perf_open(PERF_COUNT_HW_CPU_CYCLES),
+        perf_open(PERF_COUNT_HW_INSTRUCTIONS),
+        perf_open(PERF_COUNT_HW_CACHE_MISSES),
+    };
+
+    FILE *results = fopen(RESULTS_PATH, "a");
+    if (results == NULL){
+        printf("bench: cannot open %s\n", RESULTS_PATH);
+        return 1;
+    }
+    if (ftell(results) == 0){
+        fprintf(results, "config,program,instructions,seconds,mips,ns_per_inst,host_cycles,host_instructions,host_cache_misses\n");
+    }
+
+    printf("%s: %lu instructions each\n", CONFIG_NAME, num_instructions);
+    for (int p = 0; p < sizeof(programs) / sizeof(programs[0]); ++ p){
+        programs[p].setup();
+
+        for (int i = 0; i < 3; ++ i){
+            if (fds[i] >= 0){
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+        double start = now_ns();
+        for (uint64_t i = 0; i < num_instructions; ++ i){
+            instruction_cycle();
+        }
+        double elapsed = now_ns() - start;
+        int64_t counters[3];
+        for (int i = 0; i < 3; ++ i){
+            if (fds[i] >= 0){
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            }
+            counters[i] = perf_read(fds[i]);
+        }
+
+        double ns = elapsed / num_instructions;
+        double mips = num_instructions / (elapsed / 1e3);
+        fprintf(results, "%s,%s,%lu,%.6f,%.3f,%.2f,%ld,%ld,%ld\n", CONFIG_NAME, programs[p].name,
+            num_instructions, elapsed / 1e9, mips, ns, counters[0], counters[1], counters[2]);
+
+        printf("\t%-16s %8.3f MIPS\t%8.2f ns/inst", programs[p].name, mips, ns);
+        if (counters[2] >= 0){
+            printf("\thost cache misses %.3f/inst", (double)counters[2] / num_instructions);
+        }
+        double base = baseline_ns(programs[p].name);
+        if (base > 0.0){
+            double change = 100.0 * (ns - base) / base;
+            printf("\tbaseline %.2f ns/inst (%+.1f%%)", base, change);
+            if (change > threshold){
+                printf("\tREGRESSION");
+                regressions ++;
+            }
+        }
+        printf("\n");
+    }
+
+    fclose(results);
+    for (int i = 0; i < 3; ++ i){
+        if (fds[i] >= 0){
+            close(fds[i]);
+        }
+    }
+
+    if (regressions > 0){
+        printf("%s: %d programs slower than the baseline by more than %.1f%%\n", CONFIG_NAME, regressions, threshold);
+        return 1;
+    }
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <header/common.h>
 
 typedef enum{
     MODIFIED,   // exclusive dirty, global 1
@@ -372,7 +373,7 @@ void print_cacheline(){
 
 
 int main(){
-    srand(123456);
+    rng_seed(123456);
 
     int read_value;
 
@@ -386,8 +387,8 @@ int main(){
 
 
     for (int i = 0; i < 100000; ++ i){
-        int core_index = rand() % NUM_PROCESSOR;
-        int op = rand() % 3;
+        int core_index = rng_below(RNG_SCHEDULE, NUM_PROCESSOR);
+        int op = rng_below(RNG_WORKLOAD, 3);
 
         int do_print = 0;
 
@@ -397,7 +398,7 @@ int main(){
         }
         else if (op == 1){
             // printf("write [%d]\n", core_index);
-            do_print = write_cacheline(core_index, rand() % 1000);
+            do_print = write_cacheline(core_index, rng_below(RNG_WORKLOAD, 1000));
         }
         else if (op == 2){
             // printf("evict [%d]\n", core_index);
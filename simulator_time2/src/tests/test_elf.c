@@ -1,8 +1,11 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 #include "../header/linker.h"
 #include "../header/common.h"
+#include "../header/instruction.h"
 
 // int read_elf(const char *filename, uint64_t buf);
 // int parse_table_entry(char *str, char ***ent);
@@ -14,6 +17,8 @@
 // void free_elf(elf_t *elf);
 
 
+static void TestLinkManySymbols();
+
 
 int main(){
 
@@ -33,6 +38,9 @@ int main(){
     write_eof("./files/exe/output.eof.txt", &dst);
     free_elf(&src[0]);
     free_elf(&src[1]);
+    free_elf(&dst);
+
+    TestLinkManySymbols();
     
     return 0;
    
@@ -59,4 +67,157 @@ int main(){
     // }
 
     // return 0;
-}
\ No newline at end of file
+}
+
+
+// link the generated files with a few thousand global symbols
+// the defining file: g0 .. gN-1 in .data, each line holds the address of fi
+// the referencing file: f0 .. fN-1 in .text, each line loads the address of gi
+// the symbols are declared in the reverse order
+#define NUM_LINK_SYMBOLS (3000)
+
+// the address written by the relocation at the column of the line
+static uint64_t relocated_value(const char *line, int col){
+    char value[19];
+    strncpy(value, &line[col], 18);
+    value[18] = '\0';
+    return string2uint(value);
+}
+
+static void TestLinkManySymbols(){
+
+    int n = NUM_LINK_SYMBOLS;
+    elf_t def, ref, dst;
+    alloc_elf(&def, n);
+    alloc_elf(&ref, n);
+
+    def.sht_count = 1;
+    def.sht = calloc(1, sizeof(sh_entry_t));
+    strcpy(def.sht[0].sh_name, ".data");
+    def.sht[0].sh_size = n;
+    def.symt_count = 2 * n;
+    def.symt = calloc(2 * n, sizeof(st_entry_t));
+    def.reldata_count = n;
+    def.reldata = calloc(n, sizeof(rl_entry_t));
+    for (int i = 0; i < n; ++ i){
+        strcpy(def.buffer[i], "0x0000000000000000");
+
+        st_entry_t *g = &def.symt[n - 1 - i];
+        sprintf(g->st_name, "g%d", i);
+        g->bind = STB_GLOBAL;
+        g->type = STT_OBJECT;
+        strcpy(g->st_shndx, ".data");
+        g->st_value = i;
+        g->st_size = 1;
+
+        st_entry_t *f = &def.symt[2 * n - 1 - i];
+        sprintf(f->st_name, "f%d", i);
+        f->bind = STB_GLOBAL;
+        f->type = STT_NOTYPE;
+        strcpy(f->st_shndx, "SHN_UNDEF");
+
+        def.reldata[i].r_row = i;
+        def.reldata[i].r_col = 0;
+        def.reldata[i].type = R_X86_64_32;
+        def.reldata[i].sym = 2 * n - 1 - i;
+    }
+
+    ref.sht_count = 1;
+    ref.sht = calloc(1, sizeof(sh_entry_t));
+    strcpy(ref.sht[0].sh_name, ".text");
+    ref.sht[0].sh_size = n;
+    ref.symt_count = 2 * n;
+    ref.symt = calloc(2 * n, sizeof(st_entry_t));
+    ref.reltext_count = n;
+    ref.reltext = calloc(n, sizeof(rl_entry_t));
+    for (int i = 0; i < n; ++ i){
+        strcpy(ref.buffer[i], "mov    0x0000000000000000,%rax");
+
+        st_entry_t *f = &ref.symt[n - 1 - i];
+        sprintf(f->st_name, "f%d", i);
+        f->bind = STB_GLOBAL;
+        f->type = STT_FUNC;
+        strcpy(f->st_shndx, ".text");
+        f->st_value = i;
+        f->st_size = 1;
+
+        st_entry_t *g = &ref.symt[2 * n - 1 - i];
+        sprintf(g->st_name, "g%d", i);
+        g->bind = STB_GLOBAL;
+        g->type = STT_NOTYPE;
+        strcpy(g->st_shndx, "SHN_UNDEF");
+
+        ref.reltext[i].r_row = i;
+        ref.reltext[i].r_col = 7;
+        ref.reltext[i].type = R_X86_64_32;
+        ref.reltext[i].sym = 2 * n - 1 - i;
+    }
+
+    elf_t *srcp[2] = {&ref, &def};
+    link_elf((elf_t **)&srcp, 2, &dst);
+
+    int match = 1;
+    // one definition of each symbol
+    match = match && (dst.symt_count == 2 * n);
+    match = match && (dst.sht_count == 3);
+
+    sh_entry_t *text = NULL;
+    sh_entry_t *data = NULL;
+    for (int i = 0; i < dst.sht_count; ++ i){
+        if (strcmp(dst.sht[i].sh_name, ".text") == 0){
+            text = &dst.sht[i];
+        }
+        else if (strcmp(dst.sht[i].sh_name, ".data") == 0){
+            data = &dst.sht[i];
+        }
+    }
+    match = match && (text != NULL && text->sh_size == n);
+    match = match && (data != NULL && data->sh_size == n);
+
+    // the line in dst of each symbol, and the address written into it
+    uint64_t *f_line = calloc(n, sizeof(uint64_t));
+    uint64_t *g_line = calloc(n, sizeof(uint64_t));
+    uint64_t *f_value = calloc(n, sizeof(uint64_t));
+    uint64_t *g_value = calloc(n, sizeof(uint64_t));
+    for (int i = 0; match == 1 && i < dst.symt_count; ++ i){
+        st_entry_t *sym = &dst.symt[i];
+        int k = atoi(&sym->st_name[1]);
+        match = match && (sym->bind == STB_GLOBAL && sym->st_size == 1 && 0 <= k && k < n);
+        if (match == 1 && sym->st_name[0] == 'f'){
+            match = match && (strcmp(sym->st_shndx, ".text") == 0);
+            f_line[k] = sym->st_value;
+            f_value[k] = relocated_value(dst.buffer[text->sh_offset + sym->st_value], 7);
+        }
+        else if (match == 1){
+            match = match && (strcmp(sym->st_shndx, ".data") == 0);
+            g_line[k] = sym->st_value;
+            g_value[k] = relocated_value(dst.buffer[data->sh_offset + sym->st_value], 0);
+        }
+    }
+
+    // .data starts from a new page after .text
+    match = match && (text->sh_addr == 0x00400000 && data->sh_addr % 4096 == 0);
+    match = match && (data->sh_addr >= text->sh_addr + n * MAX_INSTRUCTION_CHAR);
+
+    // fi loads the address of gi, gi holds the address of fi
+    for (int i = 0; match == 1 && i < n; ++ i){
+        match = match && (f_value[i] == data->sh_addr + g_line[i] * sizeof(uint64_t));
+        match = match && (g_value[i] == text->sh_addr + f_line[i] * MAX_INSTRUCTION_CHAR);
+    }
+
+    free(f_line);
+    free(g_line);
+    free(f_value);
+    free(g_value);
+    free_elf(&def);
+    free_elf(&ref);
+    free_elf(&dst);
+
+    if (match == 1){
+        printf("link many symbols match\n");
+    }
+    else {
+        printf("link many symbols not match\n");
+    }
+    assert(match == 1);
+}
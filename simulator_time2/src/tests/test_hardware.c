@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <header/cpu.h>
 #include <header/common.h>
@@ -10,6 +11,13 @@
 static void TestAddFunctionCallAndComputation();
 static void TestString2Uint();
 static void TestSumRecursiveCondition();
+static void TestCycleTiming();
+static void TestOutOfOrder();
+static void TestBranchPredictor();
+static void TestSampledSimulation();
+static void TestRecordReplay();
+static void TestExecutionTrace();
+static void TestProfiler();
 
 void print_register();
 void print_stack();
@@ -22,6 +30,13 @@ void TestParse_instruciation();
 int main(){
 
     TestAddFunctionCallAndComputation();
+    TestCycleTiming();
+    TestOutOfOrder();
+    TestBranchPredictor();
+    TestSampledSimulation();
+    TestRecordReplay();
+    TestExecutionTrace();
+    TestProfiler();
     return 0;
 }
 
@@ -255,3 +270,515 @@ static void TestAddFunctionCallAndComputation(){
 }
 
 
+static void TestCycleTiming(){
+
+    timing_config_t config;
+    timing_default(&config);
+    config.op_latency[INST_MOV] = 3;
+    config.op_latency[INST_ADD] = 2;
+    timing_config(&config);
+
+    char assembly[5][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x1,%rax",         // 0
+        "mov    $0x2,%rbx",         // 1
+        "add    %rax,%rbx",         // 2
+        "sub    $0x1,%rbx",         // 3
+        "mov    %rbx,0x1000(%rax)", // 4
+    };
+
+    for (int i = 0; i < 5; ++ i){
+        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = 0x00400000;
+
+    for (int i = 0; i < 4; ++ i){
+        instruction_cycle();
+    }
+
+    // register operands only: no memory cycles
+    timing_stats_t *ts = &timing_stats[0];
+
+    int match = 1;
+    match = match && (cpu_reg.rbx == 0x2);
+    match = match && (ts->instructions == 4);
+    match = match && (ts->op_count[INST_MOV] == 2 && ts->op_cycles[INST_MOV] == 6);
+    match = match && (ts->op_count[INST_ADD] == 1 && ts->op_cycles[INST_ADD] == 2);
+    match = match && (ts->op_count[INST_SUB] == 1 && ts->op_cycles[INST_SUB] == DEFAULT_OP_LATENCY);
+    match = match && (ts->cycles == 8 + DEFAULT_OP_LATENCY);
+    match = match && (ts->tlb_cycles + ts->cache_cycles + ts->dram_cycles + ts->fault_cycles == 0);
+
+    // without the SRAM cache, the store goes to DRAM
+    instruction_cycle();
+    match = match && (ts->dram_cycles == DEFAULT_DRAM_ACCESS_LATENCY);
+    match = match && (ts->op_cycles[INST_MOV] == 6 + 3 + DEFAULT_DRAM_ACCESS_LATENCY);
+
+    print_timing_stats();
+
+    if (match == 1){
+        printf("cycle timing match\n");
+    }
+    else {
+        printf("cycle timing not match\n");
+    }
+}
+
+
+// mov 0x8(%base),%dst
+static void load_instruction(inst_t *inst, uint64_t *base, uint64_t *dst){
+    memset(inst, 0, sizeof(inst_t));
+    inst->op = INST_MOV;
+    inst->src.type = MEM_IMM_REG1;
+    inst->src.imm = 0x8;
+    inst->src.reg1 = (uint64_t)base;
+    inst->dst.type = REG;
+    inst->dst.reg1 = (uint64_t)dst;
+}
+
+static void TestOutOfOrder(){
+
+    uint64_t *regs[8] = {
+        &cpu_reg.rax, &cpu_reg.rbx, &cpu_reg.rcx, &cpu_reg.rdx,
+        &cpu_reg.rsi, &cpu_reg.rdi, &cpu_reg.r8, &cpu_reg.r9,
+    };
+    uint64_t miss = 100;
+    inst_t inst;
+
+    ooo_config_t config;
+    ooo_default(&config);
+
+    // independent misses overlap
+    ooo_config(&config);
+    for (int i = 0; i < 8; ++ i){
+        load_instruction(&inst, &cpu_reg.rbp, regs[i]);
+        ooo_instruction(&inst, 1, miss, 0, 0);
+    }
+    ooo_stats_t independent = ooo_stats[0];
+
+    // pointer chasing: each miss waits for the previous one
+    ooo_config(&config);
+    for (int i = 0; i < 8; ++ i){
+        load_instruction(&inst, &cpu_reg.rax, &cpu_reg.rax);
+        ooo_instruction(&inst, 1, miss, 0, 0);
+    }
+    ooo_stats_t dependent = ooo_stats[0];
+
+    // one MSHR: the misses are serialized again
+    config.mshr = 1;
+    ooo_config(&config);
+    for (int i = 0; i < 8; ++ i){
+        load_instruction(&inst, &cpu_reg.rbp, regs[i]);
+        ooo_instruction(&inst, 1, miss, 0, 0);
+    }
+    ooo_stats_t one_mshr = ooo_stats[0];
+    print_ooo_stats();
+    ooo_config(NULL);
+
+    int match = 1;
+    match = match && (independent.instructions == 8);
+    match = match && (independent.cycles > miss && independent.cycles < 2 * miss);
+    match = match && (independent.miss_cycles > 4 * independent.miss_busy_cycles);
+    match = match && (dependent.cycles >= 8 * miss);
+    match = match && (dependent.miss_cycles == dependent.miss_busy_cycles);
+    match = match && (one_mshr.cycles >= 8 * miss && one_mshr.mshr_full == 7);
+
+    if (match == 1){
+        printf("out-of-order match\n");
+    }
+    else {
+        printf("out-of-order not match\n");
+    }
+}
+
+
+// a loop of 8 iterations inside a function, called 200 times
+//  0x400000:   loop body
+//  0x400040:   jne 0x400000
+//  0x400080:   ret
+//  0x401000:   call 0x400000
+//  0x401040:   jmp 0x401000
+static uint64_t RunBranches(bpred_type_t type){
+
+    bpred_config_t config;
+    bpred_default(&config);
+    config.type = type;
+    bpred_config(&config);
+
+    for (int n = 0; n < 200; ++ n){
+        bpred_branch(INST_CALL, 0x401000, 0x400000);
+        for (int i = 0; i < 8; ++ i){
+            bpred_branch(INST_JNE, 0x400040, i < 7 ? 0x400000 : 0x400080);
+        }
+        bpred_branch(INST_RET, 0x400080, 0x401040);
+        bpred_branch(INST_JMP, 0x401040, 0x401000);
+    }
+    return bpred_stats.direction_miss;
+}
+
+static void TestBranchPredictor(){
+
+    uint64_t bimodal = RunBranches(BPRED_BIMODAL);
+    uint64_t gshare = RunBranches(BPRED_GSHARE);
+    uint64_t tage = RunBranches(BPRED_TAGE);
+    print_bpred_stats();
+
+    uint64_t branches, mispredicts;
+    int found = bpred_pc_stats(0x400040, &branches, &mispredicts);
+
+    int match = 1;
+    // bimodal misses the loop exit each time
+    match = match && (bimodal >= 200);
+    // the history of the last 7 outcomes predicts the exit
+    match = match && (gshare < bimodal / 4);
+    match = match && (tage < bimodal / 4);
+    // only the first call and jmp miss in BTB, the returns are all predicted by RAS
+    match = match && (bpred_stats.branches == 200 * 11);
+    match = match && (bpred_stats.btb_miss <= 3);
+    match = match && (bpred_stats.ras_miss == 0);
+    match = match && (found == 1 && branches == 1600 && mispredicts == tage);
+    match = match && (bpred_pc_stats(0x400080, &branches, &mispredicts) == 1 && mispredicts == 0);
+
+    // the penalty is charged by the timing layer
+    timing_config_t timing;
+    timing_default(&timing);
+    timing_config(&timing);
+
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x0,%rax",         // 0
+        "mov    %rax,-0x8(%rbp)",   // 1
+        "cmpq   $0x1,-0x8(%rbp)",   // 2
+        "jne    0x400000",          // 3: jump to 0
+    };
+    for (int i = 0; i < 4; ++ i){
+        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+    }
+    cpu_pc.rip = 0x00400000;
+
+    bpred_config_t config;
+    bpred_default(&config);
+    config.type = BPRED_BIMODAL;
+    bpred_config(&config);
+    for (int i = 0; i < 40; ++ i){
+        instruction_cycle();
+    }
+
+    // weakly not taken at first: the first jne misses both in direction and BTB
+    match = match && (bpred_stats.branches == 10 && bpred_stats.mispredict == 1);
+    match = match && (timing_stats[0].branch_cycles == DEFAULT_MISPREDICT_LATENCY);
+    bpred_config(NULL);
+
+    if (match == 1){
+        printf("branch predictor match\n");
+    }
+    else {
+        printf("branch predictor not match\n");
+    }
+}
+
+
+static void TestSampledSimulation(){
+
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x0,%rax",         // 0
+        "mov    %rax,-0x8(%rbp)",   // 1
+        "cmpq   $0x1,-0x8(%rbp)",   // 2
+        "jne    0x400000",          // 3: jump to 0
+    };
+    for (int i = 0; i < 4; ++ i){
+        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+    }
+
+    // the full detailed simulation
+    timing_config_t timing;
+    timing_default(&timing);
+    timing_config(&timing);
+    cpu_pc.rip = 0x00400000;
+    for (int i = 0; i < 1000; ++ i){
+        instruction_cycle();
+    }
+    double cpi = (double)timing_stats[0].cycles / timing_stats[0].instructions;
+
+    sample_config_t config;
+    sample_default(&config);
+    config.fast_forward = 800;
+    config.warmup = 100;
+    config.detail = 100;
+    config.interval = 1000;
+    sample_config(&config);
+
+    timing_config(&timing);
+    cpu_pc.rip = 0x00400000;
+    sample_run(10000);
+    sample_finish();
+    print_sample_stats();
+
+    int match = 1;
+    match = match && (sample_stats.windows == 10);
+    match = match && (sample_stats.fast_forward == 8000 && sample_stats.detail == 1000);
+    // only the warm-up and detail windows are simulated in detail
+    match = match && (timing_stats[0].instructions == 2000);
+    match = match && ((double)sample_stats.detail_cycles / sample_stats.detail == cpi);
+    match = match && (cpu_fast_forward == 0);
+
+    // one basic block of 4 instructions
+    match = match && (sample_stats.intervals == 10 && sample_stats.basic_blocks == 1);
+    FILE *fp = fopen(DEFAULT_BBV_PATH, "r");
+    char line[64];
+    int lines = 0;
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL){
+        match = match && (strcmp(line, "T:1:1000 \n") == 0);
+        lines ++;
+    }
+    match = match && (lines == 10);
+    if (fp != NULL){
+        fclose(fp);
+    }
+
+    if (match == 1){
+        printf("sampled simulation match\n");
+    }
+    else {
+        printf("sampled simulation not match\n");
+    }
+}
+
+
+static void TestRecordReplay(){
+
+    const char *path = "./files/replay/test.rr";
+    uint64_t recorded[64];
+    uint64_t tlb[16];
+
+    int match = 1;
+
+    // the TLB stream is not changed by the draws of the other components
+    rng_seed(42);
+    for (int i = 0; i < 16; ++ i){
+        tlb[i] = rng_next(RNG_TLB);
+    }
+
+    rng_seed(42);
+    rr_record(path);
+    for (int i = 0; i < 16; ++ i){
+        recorded[4 * i] = rng_next(RNG_TLB);
+        recorded[4 * i + 1] = rng_below(RNG_SCHEDULE, NUM_CORES);
+        recorded[4 * i + 2] = rng_next(RNG_WORKLOAD);
+        // the input from the host
+        recorded[4 * i + 3] = rr_input(0, (uint64_t)&recorded[i]);
+        match = match && (recorded[4 * i] == tlb[i]);
+    }
+    match = match && (rr_stop() == 64);
+
+    // another seed, another binary: the same values from the log
+    rng_seed(7);
+    rr_replay(path);
+    for (int i = 0; i < 16; ++ i){
+        match = match && (rng_next(RNG_TLB) == recorded[4 * i]);
+        match = match && (rng_below(RNG_SCHEDULE, NUM_CORES) == recorded[4 * i + 1]);
+        match = match && (rng_next(RNG_WORKLOAD) == recorded[4 * i + 2]);
+        match = match && (rr_input(0, 0) == recorded[4 * i + 3]);
+    }
+    match = match && (rr_stop() == 64);
+
+    // the same seed restarts the same streams
+    rng_seed(42);
+    for (int i = 0; i < 16; ++ i){
+        match = match && (rng_next(RNG_TLB) == tlb[i]);
+    }
+
+    if (match == 1){
+        printf("record replay match\n");
+    }
+    else {
+        printf("record replay not match\n");
+    }
+}
+
+
+static void TestExecutionTrace(){
+
+    const char *path = "./files/trace/test.trace";
+
+    char assembly[4][MAX_INSTRUCTION_CHAR] = {
+        "mov    $0x0,%rax",         // 0
+        "mov    %rax,-0x8(%rbp)",   // 1: store
+        "cmpq   $0x1,-0x8(%rbp)",   // 2: load
+        "jne    0x400000",          // 3: jump to 0
+    };
+    for (int i = 0; i < 4; ++ i){
+        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+    }
+
+    // more records than the ring: the core waits for the drain thread
+    uint64_t num_instructions = 40000;
+    trace_start(path);
+    cpu_pc.rip = 0x00400000;
+    for (int i = 0; i < num_instructions; ++ i){
+        instruction_cycle();
+    }
+    trace_stop();
+    print_trace_stats();
+
+    int match = 1;
+    match = match && (trace_stats.records == num_instructions * 5 / 2);
+    // the loop compresses well
+    match = match && (trace_stats.file_bytes * 2 < trace_stats.raw_bytes);
+
+    trace_reader_t reader;
+    trace_record_t record;
+    uint64_t count[NUM_TRACE_TYPE] = {0};
+    uint64_t time = 0;
+    match = match && (trace_reader_open(&reader, path) == 1);
+    while (match == 1 && trace_reader_next(&reader, &record) == 1){
+        count[record.type] ++;
+        // the records of one core are in order
+        match = match && (record.time >= time && record.core == 0);
+        time = record.time;
+
+        uint64_t i = (record.time - 1) % 4;
+        match = match && (record.pc == i * 0x40 + 0x00400000);
+        if (record.type == TRACE_INSTRUCTION){
+            match = match && (record.op == (i == 3 ? INST_JNE : i == 2 ? INST_CMP : INST_MOV));
+        }
+        if (record.type == TRACE_FETCH){
+            match = match && (record.vaddr == record.pc);
+        }
+        if (record.type == TRACE_STORE){
+            match = match && (i == 1 && record.vaddr == cpu_reg.rbp - 0x8 && record.flags == TRACE_FLAG_WRITE);
+        }
+        if (record.type == TRACE_LOAD){
+            match = match && (i == 2 && record.vaddr == cpu_reg.rbp - 0x8);
+        }
+    }
+    trace_reader_close(&reader);
+
+    match = match && (time == num_instructions);
+    match = match && (count[TRACE_INSTRUCTION] == num_instructions && count[TRACE_FETCH] == num_instructions);
+    match = match && (count[TRACE_STORE] == num_instructions / 4 && count[TRACE_LOAD] == num_instructions / 4);
+    // not traced when it is off
+    instruction_cycle();
+    match = match && (trace_stats.records == num_instructions * 5 / 2);
+
+    if (match == 1){
+        printf("execution trace match\n");
+    }
+    else {
+        printf("execution trace not match\n");
+    }
+}
+
+
+static void TestProfiler(){
+
+    char assembly[6][MAX_INSTRUCTION_CHAR] = {
+        "callq  0x00400100",        // 0: main
+        "callq  0x00400100",        // 1
+        "jmp    0x400000",          // 2: jump to 0
+        "mov    $0x0,%rax",         // 3: not executed
+        "mov    $0x1,%rax",         // 4: func
+        "retq   ",                  // 5
+    };
+    for (int i = 0; i < 6; ++ i){
+        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
+    }
+    cpu_reg.rbp = 0x7ffffffee110;
+    cpu_reg.rsp = 0x7ffffffee0f0;
+
+    timing_config_t timing;
+    timing_default(&timing);
+    timing_config(&timing);
+
+    profile_config_t config;
+    profile_default(&config);
+    profile_config(&config);
+    profile_add_symbol("func", 0x00400100, 2 * 0x40);
+    profile_add_symbol("main", 0x00400000, 4 * 0x40);
+
+    // 7 instructions each loop
+    cpu_pc.rip = 0x00400000;
+    for (int i = 0; i < 700; ++ i){
+        instruction_cycle();
+    }
+    print_profile();
+
+    int match = 1;
+    profile_count_t main_count, func_count, ret_count;
+    match = match && (profile_symbol_count("main", &main_count) == 1 && main_count.instructions == 300);
+    match = match && (profile_symbol_count("func", &func_count) == 1 && func_count.instructions == 400);
+    match = match && (main_count.cycles + func_count.cycles == timing_stats[0].cycles);
+    match = match && (profile_pc_count(0x00400140, &ret_count) == 1 && ret_count.instructions == 200);
+    match = match && (profile_pc_count(0x004000c0, &ret_count) == 0);
+
+    // the collapsed stacks of main and main;func
+    const char *path = DEFAULT_PROFILE_STACKS_PATH;
+    match = match && (profile_write_stacks(path) == 2);
+    FILE *fp = fopen(path, "r");
+    char line[128];
+    uint64_t cycles = 0;
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL){
+        if (strncmp(line, "main ", 5) == 0){
+            match = match && (strtoull(&line[5], NULL, 10) == main_count.cycles);
+        }
+        else if (strncmp(line, "main;func ", 10) == 0){
+            match = match && (strtoull(&line[10], NULL, 10) == func_count.cycles);
+        }
+        else {
+            match = 0;
+        }
+        cycles += strtoull(strchr(line, ' ') + 1, NULL, 10);
+    }
+    match = match && (cycles == timing_stats[0].cycles);
+    if (fp != NULL){
+        fclose(fp);
+    }
+
+    // sampled: every 7th instruction is the same one
+    config.period = 7;
+    profile_config(&config);
+    profile_add_symbol("main", 0x00400000, 4 * 0x40);
+    cpu_pc.rip = 0x00400000;
+    for (int i = 0; i < 700; ++ i){
+        instruction_cycle();
+    }
+    match = match && (profile_symbol_count("main", &main_count) == 1 && main_count.instructions == 700);
+
+    // recursion deeper than the tree: the rets of the calls not pushed must not pop
+    config.period = 1;
+    profile_config(&config);
+    profile_add_symbol("func", 0x00400100, 2 * 0x40);
+    profile_add_symbol("main", 0x00400000, 4 * 0x40);
+    cpu_pc.rip = 0x00400100;
+    for (int i = 0; i < 1100; ++ i){
+        profile_begin_instruction();
+        profile_end_instruction(i == 0 ? 0x00400000 : 0x00400100, INST_CALL);
+    }
+    for (int i = 0; i < 1099; ++ i){
+        profile_begin_instruction();
+        profile_end_instruction(0x00400140, INST_RET);
+    }
+    // only this instruction has cycles, it runs in the first frame of func
+    profile_begin_instruction();
+    timing_stats[0].cycles += 1000;
+    profile_end_instruction(0x00400100, INST_MOV);
+    match = match && (profile_write_stacks(path) == 1024);
+    fp = fopen(path, "r");
+    uint64_t marked = 0;
+    while (fp != NULL && fgets(line, sizeof(line), fp) != NULL){
+        if (strcmp(line, "main;func 1000\n") == 0){
+            marked ++;
+        }
+    }
+    match = match && (marked == 1);
+    if (fp != NULL){
+        fclose(fp);
+    }
+
+    profile_config(NULL);
+    match = match && (profile_enabled == 0);
+
+    if (match == 1){
+        printf("profiler match\n");
+    }
+    else {
+        printf("profiler not match\n");
+    }
+}
@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <header/cpu.h>
+#include <header/common.h>
+#include <header/memory.h>
+#include <header/linker.h>
+
+static void TestLargePageWalk();
+static void TestPageWalkCache();
+static void TestPageReplacement();
+static void TestSwapReadahead();
+static void TestZswap();
+static void TestCopyOnWrite();
+static void TestReverseMapping();
+static void TestSparsePhysicalMemory();
+static void TestDramAccess();
+static void TestDramTiming();
+static void TestCheckpoint();
+static void TestLoader();
+
+int main(){
+
+    // page tables are allocated in the simulated physical memory
+    // both tests share this address space
+    cpu_controls.cr3 = allocate_pagetable();
+
+    TestLargePageWalk();
+    TestPageWalkCache();
+    TestPageReplacement();
+    TestSwapReadahead();
+    TestZswap();
+    TestCopyOnWrite();
+    TestReverseMapping();
+    TestSparsePhysicalMemory();
+    TestDramAccess();
+    TestDramTiming();
+    TestCheckpoint();
+    TestLoader();
+    return 0;
+}
+
+static void TestLargePageWalk(){
+
+    memset(&mmu_stats, 0, sizeof(mmu_stats_t));
+    // count the full page walks
+    pagewalk_cache_config(0, 0, 0);
+
+    // 4KB page: 0x00400000 -> ppn 1
+    map_page(0x00400000, 1, PAGE_LEVEL_4K);
+    // 2MB page: 0x7f0000200000 -> ppn 0
+    map_page(0x7f0000200000, 0, PAGE_LEVEL_2M);
+    // 1GB page: 0x140000000 -> ppn 0
+    map_page(0x140000000, 0, PAGE_LEVEL_1G);
+
+    int match = 1;
+#ifdef USE_SRAM_CACHE
+    uint64_t sram_access = sram_cache_stats.hit + sram_cache_stats.miss;
+#endif
+
+    match = match && (va2pa(0x00400123) == 0x1123);
+    match = match && (va2pa(0x7f0000202345) == 0x2345);
+    match = match && (va2pa(0x140005678) == 0x5678);
+
+    // the walks stop at PMD and PUD
+    match = match && (mmu_stats.page_walk == 3);
+    match = match && (mmu_stats.page_walk_2m == 1);
+    match = match && (mmu_stats.page_walk_1g == 1);
+    match = match && (mmu_stats.page_walk_ref == 4 + 3 + 2);
+#ifdef USE_SRAM_CACHE
+    // the page walks read the entries through SRAM cache byte by byte
+    // and set the reference bits of the 3 leaf entries
+    match = match && (sram_cache_stats.hit + sram_cache_stats.miss == sram_access + (9 + 3) * 8);
+#endif
+
+    // any address inside the large pages hits the large page TLBs
+    match = match && (va2pa(0x7f0000203000) == 0x3000);
+    match = match && (va2pa(0x140004000) == 0x4000);
+    match = match && (va2pa(0x00400008) == 0x1008);
+    match = match && (mmu_stats.tlb_hit_2m == 1);
+    match = match && (mmu_stats.tlb_hit_1g == 1);
+    match = match && (mmu_stats.tlb_hit_4k == 1);
+    match = match && (mmu_stats.page_walk == 3);
+
+    // the 2MB page and 1GB page are sharing the same physical pages
+    cpu_write64bits_dram(va2pa(0x7f0000200100), 0x0123456789abcdef);
+    match = match && (cpu_read64bits_dram(va2pa(0x140000100)) == 0x0123456789abcdef);
+
+    print_mmu_stats();
+#ifdef USE_SRAM_CACHE
+    print_cache_stats();
+#endif
+
+    if (match == 1){
+        printf("large page match\n");
+    }
+    else {
+        printf("large page not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestPageWalkCache(){
+
+    memset(&mmu_stats, 0, sizeof(mmu_stats_t));
+    pagewalk_cache_config(2, 4, 32);
+
+    map_page(0x00600000, 1, PAGE_LEVEL_4K);
+    map_page(0x00601000, 2, PAGE_LEVEL_4K);
+    map_page(0x00800000, 3, PAGE_LEVEL_4K);
+    map_page(0x7f0000000000, 4, PAGE_LEVEL_4K);
+
+    int match = 1;
+
+    // cold walk: read all 4 levels
+    match = match && (va2pa(0x00600010) == 0x1010);
+    match = match && (mmu_stats.page_walk_ref == 4);
+    match = match && (mmu_stats.pwc_miss[2] == 1);
+
+    // same PT: PMD entry cache hit, read PT only
+    match = match && (va2pa(0x00601020) == 0x2020);
+    match = match && (mmu_stats.page_walk_ref == 4 + 1);
+    match = match && (mmu_stats.pwc_hit[2] == 1);
+
+    // same PMD: PUD entry cache hit, read PMD and PT
+    match = match && (va2pa(0x00800030) == 0x3030);
+    match = match && (mmu_stats.page_walk_ref == 5 + 2);
+    match = match && (mmu_stats.pwc_hit[1] == 2);
+
+    // another PGD entry: all miss
+    match = match && (va2pa(0x7f0000000040) == 0x4040);
+    match = match && (mmu_stats.page_walk_ref == 7 + 4);
+    match = match && (mmu_stats.pwc_miss[0] == 2);
+
+    print_mmu_stats();
+#ifdef USE_SRAM_CACHE
+    print_cache_stats();
+#endif
+
+    if (match == 1){
+        printf("page walk cache match\n");
+    }
+    else {
+        printf("page walk cache not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestPageReplacement(){
+
+    // 8 physical pages: PGD, PUD, PMD, PT and 4 pages for data
+    frame_allocator_init(8);
+    swap_init(16);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+    pagewalk_cache_config(2, 4, 32);
+
+    uint64_t base = 0x00a00000;
+    for (int i = 0; i < 5; ++ i){
+        // the 5th page is given by reclaiming one dirty page
+        map_page(base + i * PAGE_SIZE, allocate_frame(), PAGE_LEVEL_4K);
+        cpu_write64bits_dram(va2pa_write(base + i * PAGE_SIZE + 8 * i), 0xabcd0000 + i);
+    }
+
+    int match = 1;
+    match = match && (pagefault_stats.evict_dirty == 1);
+
+    // faults bring the pages back from swap space
+    for (int k = 0; k < 3; ++ k){
+        for (int i = 0; i < 5; ++ i){
+            match = match && (cpu_read64bits_dram(va2pa(base + i * PAGE_SIZE + 8 * i)) == 0xabcd0000 + i);
+        }
+    }
+    match = match && (pagefault_stats.page_fault > 0);
+    // the frames cleaned in advance are reclaimed without disk write
+    match = match && (pagefault_stats.writeback > 0 && pagefault_stats.evict_clean > 0);
+    // each fault reclaims one frame
+    match = match && (pagefault_stats.evict_clean + pagefault_stats.evict_dirty == pagefault_stats.page_fault + 1);
+    // raw pages in the swap device
+    match = match && (swap_stats.page_out == pagefault_stats.evict_dirty + pagefault_stats.writeback);
+    match = match && (swap_stats.page_in == pagefault_stats.page_fault);
+    // the writeback daemon writes in background
+    swap_sync();
+    match = match && (0 < swap_stats.write_batch && swap_stats.write_batch <= swap_stats.page_out);
+
+    print_mmu_stats();
+    print_pagefault_stats();
+    print_swap_stats();
+
+    if (match == 1){
+        printf("page replacement match\n");
+    }
+    else {
+        printf("page replacement not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestSwapReadahead(){
+
+    // 16 physical pages: PGD, PUD, PMD, PT and 12 pages for data
+    frame_allocator_init(16);
+    swap_init(64);
+    writeback_config(0);
+    swap_readahead_config(7);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+
+    // map in reversed order: CLOCK hand meets the lower pages first
+    // then they are swapped out to the consecutive slots
+    uint64_t base = 0x00c00000;
+    for (int i = 11; i >= 0; -- i){
+        map_page(base + i * PAGE_SIZE, allocate_frame(), PAGE_LEVEL_4K);
+        cpu_write64bits_dram(va2pa_write(base + i * PAGE_SIZE), 0x5a5a0000 + i);
+    }
+
+    // pages 0 - 7 are swapped out by the new pages
+    for (int i = 16; i < 24; ++ i){
+        map_page(base + i * PAGE_SIZE, allocate_frame(), PAGE_LEVEL_4K);
+        cpu_write64bits_dram(va2pa_write(base + i * PAGE_SIZE), 0x5a5a0000 + i);
+    }
+    // then released: 8 free frames for readahead
+    for (int i = 16; i < 24; ++ i){
+        unmap_page(base + i * PAGE_SIZE);
+    }
+    swap_sync();
+
+    int match = 1;
+    match = match && (pagefault_stats.evict_dirty == 8);
+
+    // the sequential scan faults once, then hits the pages read ahead
+    uint64_t read_batch = swap_stats.read_batch;
+    for (int i = 0; i < 12; ++ i){
+        match = match && (cpu_read64bits_dram(va2pa(base + i * PAGE_SIZE)) == 0x5a5a0000 + i);
+    }
+    match = match && (pagefault_stats.page_fault == 8);
+    match = match && (pagefault_stats.readahead == 7);
+    match = match && (pagefault_stats.readahead_hit == 7);
+    match = match && (pagefault_stats.readahead_waste == 0);
+    // one pread and one preadv
+    match = match && (swap_stats.read_batch == read_batch + 2);
+
+    print_pagefault_stats();
+    print_swap_stats();
+
+    if (match == 1){
+        printf("swap readahead match\n");
+    }
+    else {
+        printf("swap readahead not match\n");
+    }
+    assert(match == 1);
+}
+
+// word i of the test page k
+static uint64_t zswap_test_word(int k, int i){
+    switch (k % 4){
+        case 0:
+            // same-filled
+            return 0x1111111111111111 * k;
+        case 1:
+            // repeated pattern
+            return 0x0706050403020100 + (i % 4);
+        case 2:
+            // random: incompressible
+            {
+                uint64_t x = (k * 512 + i + 1) * 0x9e3779b97f4a7c15;
+                x ^= x >> 31;
+                x *= 0xbf58476d1ce4e5b9;
+                return x ^ (x >> 29);
+            }
+        default:
+            // half zero
+            return i < 256 ? 0 : i;
+    }
+}
+
+static void TestZswap(){
+
+    // 8 physical pages: PGD, PUD, PMD, PT and 4 pages for data
+    frame_allocator_init(8);
+    swap_init(32);
+    writeback_config(2);
+    swap_readahead_config(0);
+    zswap_config(2 * PAGE_SIZE);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+    memset(&zswap_stats, 0, sizeof(zswap_stats_t));
+
+    uint64_t base = 0x00e00000;
+    for (int k = 0; k < 12; ++ k){
+        map_page(base + k * PAGE_SIZE, allocate_frame(), PAGE_LEVEL_4K);
+        for (int i = 0; i < 512; ++ i){
+            cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + i * 8), zswap_test_word(k, i));
+        }
+    }
+
+    int match = 1;
+    for (int j = 0; j < 2; ++ j){
+        for (int k = 0; k < 12; ++ k){
+            for (int i = 0; i < 512; ++ i){
+                match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + i * 8)) == zswap_test_word(k, i));
+            }
+        }
+    }
+
+    match = match && (zswap_stats.same_filled > 0);
+    // the random pages go to the swap device
+    match = match && (zswap_stats.reject > 0);
+    match = match && (zswap_stats.load_hit > 0);
+    match = match && (zswap_stats.pool_bytes <= 2 * PAGE_SIZE);
+    // the faults are served by zswap or the swap device
+    match = match && (zswap_stats.load_hit + zswap_stats.load_miss == pagefault_stats.page_fault);
+    match = match && (zswap_stats.compressed_out < zswap_stats.compressed_in);
+
+    print_pagefault_stats();
+    print_zswap_stats();
+    print_swap_stats();
+
+    if (match == 1){
+        printf("zswap match\n");
+    }
+    else {
+        printf("zswap not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestCopyOnWrite(){
+
+    // 16 physical pages: 4 page tables for each process, the zero page and the data
+    frame_allocator_init(16);
+    swap_init(64);
+    writeback_config(2);
+    swap_readahead_config(0);
+    zswap_config(0);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+
+    int match = 1;
+    uint64_t base = 0x01000000;
+
+    // the first reads share the zero page, no page table is mapped before
+    match = match && (cpu_read64bits_dram(va2pa(base + 0x10)) == 0);
+    match = match && (cpu_read64bits_dram(va2pa(base + PAGE_SIZE + 0x10)) == 0);
+    match = match && (va2pa(base) >> 12 == va2pa(base + PAGE_SIZE) >> 12);
+    match = match && (pagefault_stats.zero_page == 2);
+
+    // the first writes: demand-zero pages
+    for (int k = 0; k < 4; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + 8), 0x1000 + k);
+    }
+    match = match && (pagefault_stats.demand_zero == 4);
+    match = match && (cpu_read64bits_dram(va2pa(base + 0x10)) == 0);
+
+    uint64_t parent = cpu_controls.cr3;
+    uint64_t child = fork_pagetable();
+
+    // the child sees the pages of the parent
+    cpu_controls.cr3 = child;
+    flush_tlb();
+    for (int k = 0; k < 4; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + 8)) == 0x1000 + k);
+    }
+    match = match && (va2pa(base + 8) >> 12 != va2pa(base + PAGE_SIZE + 8) >> 12);
+
+    // the child writes the first 2 pages: copied
+    for (int k = 0; k < 2; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + 8), 0x2000 + k);
+    }
+    match = match && (pagefault_stats.cow_copy == 2);
+
+    // the parent keeps its own data, and reuses the 2 pages without copy
+    cpu_controls.cr3 = parent;
+    flush_tlb();
+    for (int k = 0; k < 4; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + 8)) == 0x1000 + k);
+    }
+    for (int k = 0; k < 4; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + 16), 0x3000 + k);
+    }
+    match = match && (pagefault_stats.cow_reuse == 2);
+    match = match && (pagefault_stats.cow_copy == 4);
+
+    // the child still reads its own data
+    cpu_controls.cr3 = child;
+    flush_tlb();
+    for (int k = 0; k < 4; ++ k){
+        uint64_t expected = k < 2 ? 0x2000 + k : 0x1000 + k;
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + 8)) == expected);
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + 16)) == 0);
+    }
+
+    print_pagefault_stats();
+
+    // no free frame for the copy: the shared frame must not be the victim
+    // 10 physical pages: 4 page tables for each process, the 2 shared pages
+    frame_allocator_init(10);
+    swap_init(64);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+
+    for (int k = 0; k < 2; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + 8), 0x4000 + k);
+    }
+    parent = cpu_controls.cr3;
+    child = fork_pagetable();
+
+    cpu_controls.cr3 = child;
+    flush_tlb();
+    // the CLOCK hand reaches the frame of the second page first
+    cpu_write64bits_dram(va2pa_write(base + PAGE_SIZE + 8), 0x5000);
+    match = match && (pagefault_stats.cow_copy == 1);
+    match = match && (pagefault_stats.evict_dirty == 1);
+    match = match && (cpu_read64bits_dram(va2pa(base + 8)) == 0x4000);
+    match = match && (cpu_read64bits_dram(va2pa(base + PAGE_SIZE + 8)) == 0x5000);
+
+    cpu_controls.cr3 = parent;
+    flush_tlb();
+    for (int k = 0; k < 2; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + 8)) == 0x4000 + k);
+    }
+
+    print_pagefault_stats();
+
+    if (match == 1){
+        printf("copy on write match\n");
+    }
+    else {
+        printf("copy on write not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestReverseMapping(){
+
+    frame_allocator_init(16);
+    swap_init(64);
+    writeback_config(2);
+    swap_readahead_config(0);
+    zswap_config(0);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+
+    int match = 1;
+    uint64_t base = 0x01400000;
+    uint64_t other = 0x01600000;
+
+    for (int k = 0; k < 4; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE), 0x4000 + k);
+    }
+
+    uint64_t parent = cpu_controls.cr3;
+    uint64_t child = fork_pagetable();
+
+    // the child has its own pages: the shared pages are evicted from both page tables
+    cpu_controls.cr3 = child;
+    flush_tlb();
+    for (int j = 0; j < 2; ++ j){
+        for (int k = 0; k < 12; ++ k){
+            cpu_write64bits_dram(va2pa_write(other + k * PAGE_SIZE), 0x5000 + k);
+        }
+    }
+    match = match && (pagefault_stats.unmap_shared > 0);
+    match = match && (pagefault_stats.unmap_shared % 2 == 0);
+
+    // swapped in by the child, then found in the swap cache by the parent
+    for (int k = 0; k < 4; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE)) == 0x4000 + k);
+    }
+    cpu_controls.cr3 = parent;
+    flush_tlb();
+    for (int k = 0; k < 4; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE)) == 0x4000 + k);
+    }
+    match = match && (pagefault_stats.swap_cache_hit > 0);
+
+    // still copied on write after swapped in
+    for (int k = 0; k < 4; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE), 0x6000 + k);
+    }
+    cpu_controls.cr3 = child;
+    flush_tlb();
+    for (int k = 0; k < 4; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE)) == 0x4000 + k);
+    }
+    for (int k = 0; k < 12; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(other + k * PAGE_SIZE)) == 0x5000 + k);
+    }
+
+    print_pagefault_stats();
+    print_swap_stats();
+
+    if (match == 1){
+        printf("reverse mapping match\n");
+    }
+    else {
+        printf("reverse mapping not match\n");
+    }
+    assert(match == 1);
+}
+
+static uint64_t max_rss_kb(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void TestSparsePhysicalMemory(){
+
+    uint64_t rss = max_rss_kb();
+
+    // 64GB physical memory: 16M frames
+    uint64_t num_pages = (64ul << 30) / PAGE_SIZE;
+    frame_allocator_init(num_pages);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+
+    int match = 1;
+    match = match && (physical_memory_size == (64ul << 30));
+    match = match && (num_physical_page == num_pages);
+
+    // the frames on the top are allocated first
+    uint64_t base = 0x01800000;
+    for (int k = 0; k < 16; ++ k){
+        cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + 8 * k), 0x7000 + k);
+    }
+    match = match && (va2pa(base) / PAGE_SIZE >= num_pages - 32);
+
+    // a frame at the bottom mapped directly
+    map_page(base + 16 * PAGE_SIZE, 5, PAGE_LEVEL_4K);
+    cpu_write64bits_dram(va2pa_write(base + 16 * PAGE_SIZE), 0x7777);
+
+    for (int k = 0; k < 16; ++ k){
+        match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + 8 * k)) == 0x7000 + k);
+    }
+    match = match && (cpu_read64bits_dram(5 * PAGE_SIZE) == 0x7777);
+    match = match && (pagefault_stats.demand_zero == 16);
+    match = match && (pagefault_stats.evict_clean + pagefault_stats.evict_dirty == 0);
+
+    // only the pages touched are backed by the host
+    uint64_t rss_growth = max_rss_kb() - rss;
+    match = match && (rss_growth < 64 * 1024);
+    printf("physical memory %lu MB\tpages %lu\tmax RSS growth %lu KB\n",
+        physical_memory_size >> 20, num_physical_page, rss_growth);
+
+    // back to the small memory for the other tests
+    frame_allocator_init(MAX_NUM_PHYSICAL_PAGE);
+
+    if (match == 1){
+        printf("sparse physical memory match\n");
+    }
+    else {
+        printf("sparse physical memory not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestDramAccess(){
+
+    int match = 1;
+
+    // unaligned accesses of each width, little-endian
+    uint64_t paddr = 3 * PAGE_SIZE + 0x13;
+    dram_write64(paddr, 0x0123456789abcdef);
+    match = match && (dram_read8(paddr) == 0xef);
+    match = match && (dram_read16(paddr + 1) == 0xabcd);
+    match = match && (dram_read32(paddr + 4) == 0x01234567);
+    match = match && (dram_read64(paddr) == 0x0123456789abcdef);
+
+    dram_write8(paddr, 0x11);
+    dram_write16(paddr + 1, 0x2233);
+    dram_write32(paddr + 3, 0x44556677);
+    match = match && (dram_read64(paddr) == 0x0144556677223311);
+
+    // bulk transfer
+    uint8_t buf[PAGE_SIZE];
+    dram_fill(4 * PAGE_SIZE, 0x5a, PAGE_SIZE);
+    dram_read(4 * PAGE_SIZE, buf, PAGE_SIZE);
+    for (int i = 0; i < PAGE_SIZE; ++ i){
+        match = match && (buf[i] == 0x5a);
+        buf[i] = i & 0xff;
+    }
+    dram_write(4 * PAGE_SIZE + 1, buf, PAGE_SIZE - 1);
+    match = match && (dram_read8(4 * PAGE_SIZE) == 0x5a);
+    match = match && (dram_read32(4 * PAGE_SIZE + 1) == 0x03020100);
+
+    // the instructions are stored in 64-byte slots
+    char inst[MAX_INSTRUCTION_CHAR];
+    dram_fill(5 * PAGE_SIZE, 0xff, MAX_INSTRUCTION_CHAR);
+    cpu_writeinst_dram(5 * PAGE_SIZE, "mov    %rsp,%rbp");
+    cpu_readinst_dram(5 * PAGE_SIZE, inst);
+    match = match && (strcmp(inst, "mov    %rsp,%rbp") == 0);
+    match = match && (dram_read64(5 * PAGE_SIZE + MAX_INSTRUCTION_CHAR - 8) == 0);
+
+    if (match == 1){
+        printf("dram access match\n");
+    }
+    else {
+        printf("dram access not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestDramTiming(){
+
+    // 1 channel, 1 rank, 2 banks of 1KB rows
+    dram_timing_config_t config;
+    dram_timing_default(&config);
+    config.num_channels = 1;
+    config.num_ranks = 1;
+    config.num_banks = 2;
+    config.row_size = 1024;
+    config.tRCD = 10;
+    config.tCAS = 20;
+    config.tRP = 30;
+    config.tBURST = 4;
+    dram_timing_config(&config);
+
+    int match = 1;
+    uint8_t block[64];
+
+    // row | bank | column
+    dram_address_t addr = dram_map_address(0x40 + 1024 + 5 * 2048);
+    match = match && (addr.column == 0x40 && addr.bank == 1 && addr.row == 5 && addr.channel == 0);
+
+    dram_access_t a = bus_read_cacheline(0x40, block);
+    match = match && (a.row_status == DRAM_ROW_EMPTY && a.latency == 10 + 20 + 4);
+    a = bus_read_cacheline(0x80, block);
+    match = match && (a.row_status == DRAM_ROW_HIT && a.latency == 20 + 4);
+    // bank 1 is independent
+    a = bus_write_cacheline(1024, block);
+    match = match && (a.row_status == DRAM_ROW_EMPTY);
+    // row 1 of bank 0
+    a = bus_read_cacheline(2048, block);
+    match = match && (a.row_status == DRAM_ROW_CONFLICT && a.latency == 30 + 10 + 20 + 4);
+    a = bus_write_cacheline(1024 + 0x3c0, block);
+    match = match && (a.row_status == DRAM_ROW_HIT);
+    match = match && (dram_stats.read == 3 && dram_stats.write == 2);
+    match = match && (dram_stats.latency == 34 + 24 + 34 + 64 + 24);
+    print_dram_stats();
+
+    // closed-page: no hit, no conflict
+    config.policy = DRAM_CLOSED_PAGE;
+    dram_timing_config(&config);
+    for (int i = 0; i < 4; ++ i){
+        a = bus_read_cacheline(i * 2048, block);
+        match = match && (a.row_status == DRAM_ROW_EMPTY && a.latency == 34);
+        a = bus_read_cacheline(i * 2048 + 0x40, block);
+        match = match && (a.row_status == DRAM_ROW_EMPTY);
+    }
+
+    // disabled: no latency
+    dram_timing_config(NULL);
+    a = bus_read_cacheline(0, block);
+    match = match && (a.latency == 0);
+
+    if (match == 1){
+        printf("dram timing match\n");
+    }
+    else {
+        printf("dram timing not match\n");
+    }
+    assert(match == 1);
+}
+
+
+static int checkpoint_pages_match(uint64_t base, int num_pages){
+    int match = 1;
+    for (int k = 0; k < num_pages; ++ k){
+        for (int i = 0; i < 512; i += 7){
+            match = match && (cpu_read64bits_dram(va2pa(base + k * PAGE_SIZE + i * 8)) == zswap_test_word(k, i));
+        }
+    }
+    return match;
+}
+
+static void TestCheckpoint(){
+
+    const char *path = "./files/checkpoint/test.ckpt";
+
+    // 8 physical pages: the pages are in the frames, zswap and the swap device
+    // the rest of the 1MB physical memory is never touched
+    physical_memory_init(256 * PAGE_SIZE);
+    frame_allocator_init(8);
+    swap_init(32);
+    writeback_config(2);
+    swap_readahead_config(0);
+    zswap_config(PAGE_SIZE);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+
+    uint64_t base = 0x00f00000;
+    for (int k = 0; k < 12; ++ k){
+        for (int i = 0; i < 512; ++ i){
+            cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + i * 8), zswap_test_word(k, i));
+        }
+    }
+    cpu_reg.rax = 0x1234;
+    cpu_pc.rip = 0x00400040;
+    uint64_t cr3 = cpu_controls.cr3;
+    uint64_t pool_bytes = zswap_stats.pool_bytes;
+    uint64_t slot_used = swap_stats.slot_used;
+
+    checkpoint_save(path);
+    uint64_t draw = rng_next(RNG_TLB);
+
+    int match = 1;
+    // fan out: each experiment starts from the same checkpoint
+    for (int n = 0; n < 3; ++ n){
+
+        // the experiment changes everything
+        rng_next(RNG_TLB);
+        for (int k = 0; k < 12; ++ k){
+            cpu_write64bits_dram(va2pa_write(base + k * PAGE_SIZE + 8 * n), 0xdead0000 + k);
+        }
+        cpu_reg.rax = 0;
+        cpu_pc.rip = 0;
+        cpu_controls.cr3 = allocate_pagetable();
+
+        checkpoint_restore(path);
+
+        match = match && (cpu_reg.rax == 0x1234 && cpu_pc.rip == 0x00400040 && cpu_controls.cr3 == cr3);
+        // the draws continue from the checkpoint
+        match = match && (rng_next(RNG_TLB) == draw);
+        match = match && (zswap_stats.pool_bytes == pool_bytes && swap_stats.slot_used == slot_used);
+        match = match && (pagefault_stats.page_fault == 0);
+        match = match && (checkpoint_pages_match(base, 12) == 1);
+        // the pages are brought back from the restored zswap and swap device
+        match = match && (pagefault_stats.page_fault > 0);
+    }
+
+    // the new checkpoint over the file mapped now
+    checkpoint_save(path);
+    checkpoint_restore(path);
+    match = match && (checkpoint_pages_match(base, 12) == 1);
+
+    // the zero pages of the physical memory are holes in the file
+    struct stat st;
+    match = match && (stat(path, &st) == 0 && st.st_size > physical_memory_size);
+    match = match && (st.st_blocks * 512 < st.st_size - 128 * PAGE_SIZE);
+
+    // the frame taken by map_page below the untouched frames is kept by the checkpoint
+    frame_allocator_init(64);
+    cpu_controls.cr3 = allocate_pagetable();
+    flush_tlb();
+    uint64_t low = 0x01c00000;
+    map_page(low, 1, PAGE_LEVEL_4K);
+    cpu_write64bits_dram(va2pa_write(low), 0x600d);
+    checkpoint_save(path);
+    checkpoint_restore(path);
+    match = match && (page_map[1].allocated == 1 && page_map[1].mapcount == 1);
+    // all the other frames are allocated: none of them is the frame 1
+    for (int k = 1; k < 60; ++ k){
+        cpu_write64bits_dram(va2pa_write(low + k * PAGE_SIZE), 0xbad0000 + k);
+    }
+    match = match && (cpu_read64bits_dram(va2pa(low)) == 0x600d);
+
+    if (match == 1){
+        printf("checkpoint match\n");
+    }
+    else {
+        printf("checkpoint not match\n");
+    }
+    assert(match == 1);
+}
+
+static void TestLoader(){
+
+    frame_allocator_init(16);
+    swap_init(64);
+    writeback_config(2);
+    swap_readahead_config(0);
+    zswap_config(0);
+
+    // main calls add: result = a + b
+    elf_t src[2];
+    parse_elf("./files/exe/loader_main.elf.txt", &src[0]);
+    parse_elf("./files/exe/loader_add.elf.txt", &src[1]);
+    elf_t *srcp[2] = {&src[0], &src[1]};
+    elf_t elf;
+    link_elf((elf_t **)&srcp, 2, &elf);
+
+    uint64_t file_page = pagefault_stats.file_page;
+    uint64_t cr3 = load_eof(&elf, "main");
+
+    int match = 1;
+    match = match && (cpu_controls.cr3 == cr3 && cpu_pc.rip == 0x00400000);
+    // nothing is read before the first touch
+    match = match && (pagefault_stats.file_page == file_page);
+
+    // main returns to address 0
+    for (int i = 0; i < 100 && cpu_pc.rip != 0; ++ i){
+        instruction_cycle();
+    }
+    match = match && (cpu_pc.rip == 0);
+    match = match && (cpu_reg.rax == 0x1234abcd);
+    match = match && (cpu_read64bits_dram(va2pa(0x00401008)) == 0x1234abcd);
+    match = match && (pagefault_stats.file_page == file_page + 2);
+
+    // the code is never writable
+    int writable;
+    match = match && (vma_file_page(cr3, 0x00400000, &writable) == 1 && writable == 0);
+    match = match && (vma_file_page(cr3, 0x00401000, &writable) == 1 && writable == 1);
+
+    free_elf(&src[0]);
+    free_elf(&src[1]);
+    free_elf(&elf);
+    print_pagefault_stats();
+
+    if (match == 1){
+        printf("loader match\n");
+    }
+    else {
+        printf("loader not match\n");
+    }
+    assert(match == 1);
+}
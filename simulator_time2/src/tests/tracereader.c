@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../header/cpu.h"
+
+
+// convert the binary trace to text, or to the Chrome trace JSON
+// for chrome://tracing or ui.perfetto.dev
+
+int main(int argc, char **argv){
+
+    if (argc < 2 || (argc == 3 && strcmp(argv[2], "text") != 0 && strcmp(argv[2], "json") != 0)){
+        printf("usage: %s <trace> [text|json]\n", argv[0]);
+        return 1;
+    }
+    int json = argc == 3 && strcmp(argv[2], "json") == 0;
+
+    trace_reader_t reader;
+    if (trace_reader_open(&reader, argv[1]) == 0){
+        printf("%s is not a trace\n", argv[1]);
+        return 1;
+    }
+
+    trace_record_t record;
+    uint64_t count = 0;
+    if (json == 1){
+        printf("{\"traceEvents\":[\n");
+    }
+    while (trace_reader_next(&reader, &record) == 1){
+        if (json == 1){
+            trace_print_json(stdout, &record, count == 0);
+        }
+        else {
+            trace_print_text(stdout, &record);
+        }
+        count ++;
+    }
+    if (json == 1){
+        printf("\n]}\n");
+    }
+
+    trace_reader_close(&reader);
+    return 0;
+}